@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define DEBUG_LOG 0
+
+#include "aoutcache.h"
+#include "machine.h"
+
+#define AOUTCACHE_ENTRIES 16
+#define AOUTCACHE_BYTES (8 * 1024 * 1024)
+
+#ifdef UU_M68K_MINIX
+#define AOUTCACHE_ARCH "m68k"
+#else
+#define AOUTCACHE_ARCH "pdp11"
+#endif
+#define MAGIC_AOUTCACHE "UUAC"
+#define AOUTCACHE_VERSION 1
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+    uint32_t textStart;
+} aoutcache_key_t;
+
+// an image is in a file at the offset of textStart in a page, mapped to the guest by load():
+// the processes running the aout share its pages until written. The file is named by the
+// key in $TMPDIR for other invocations, it has the name once it is complete.
+typedef struct {
+    aoutcache_key_t key;
+    uint64_t used;
+    // header and [textStart, dataEnd) after relocation, len 0 if empty
+    uint8_t aout[32];
+    int fd;
+    off_t offset;
+    size_t len;
+} aoutcache_entry_t;
+
+// the first page of the file, the image after it
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    aoutcache_key_t key;
+    uint8_t aout[32];
+    uint32_t offset;
+    uint32_t len;
+} aoutcache_file_t;
+
+struct aoutcache_tag {
+    aoutcache_entry_t entries[AOUTCACHE_ENTRIES];
+    size_t bytes;
+    uint64_t clock;
+
+    // the last load() missed
+    bool pending;
+    aoutcache_key_t missed;
+};
+
+static void makeKey(machine_t *pm, const struct stat *ps, aoutcache_key_t *pk) {
+    memset(pk, 0, sizeof(*pk));
+    pk->dev = ps->st_dev;
+    pk->ino = ps->st_ino;
+    pk->mtime = ps->st_mtime;
+    pk->size = ps->st_size;
+    pk->textStart = pm->textStart;
+}
+
+static bool sameKey(const aoutcache_key_t *a, const aoutcache_key_t *b) {
+    return a->dev == b->dev && a->ino == b->ino && a->mtime == b->mtime
+        && a->size == b->size && a->textStart == b->textStart;
+}
+
+static void evict(aoutcache_t *pc, aoutcache_entry_t *pe) {
+    if (pe->len == 0) {
+        return;
+    }
+    pc->bytes -= pe->len;
+    close(pe->fd);
+    pe->fd = -1;
+    pe->len = 0;
+}
+
+static const char *tmpDir(void) {
+    const char *dir = getenv("TMPDIR");
+    return (dir != NULL && dir[0] != '\0') ? dir : "/tmp";
+}
+
+// the file of the key for all invocations, false if not shared: the inodes of a disk
+// image are of that image only
+static bool sharedPath(machine_t *pm, const aoutcache_key_t *pk, char *path, size_t len) {
+    if (pm->v6fs != NULL) {
+        return false;
+    }
+    int n = snprintf(path, len, "%s/uuinterp-aout-%s-%llx-%llx-%llx-%llx-%x", tmpDir(), AOUTCACHE_ARCH,
+        (unsigned long long)pk->dev, (unsigned long long)pk->ino,
+        (unsigned long long)pk->mtime, (unsigned long long)pk->size, pk->textStart);
+    return n >= 0 && n < len;
+}
+
+// above the guest fds as the checkpoint
+static int hostFd(int fd) {
+    if (fd < 0) {
+        return -1;
+    }
+    int hfd = fcntl(fd, F_DUPFD_CLOEXEC, CHECKPOINT_MAX_FDS);
+    close(fd);
+    return hfd;
+}
+
+// the shared file of the key, written by this user only; -1 if none
+static int openShared(machine_t *pm, const aoutcache_key_t *pk, aoutcache_file_t *ph) {
+    char path[PATH_MAX];
+    if (!sharedPath(pm, pk, path, sizeof(path))) {
+        return -1;
+    }
+    int fd = hostFd(open(path, O_RDONLY | O_NOFOLLOW));
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat s;
+    if (fstat(fd, &s) != 0 || !S_ISREG(s.st_mode) || s.st_uid != geteuid() || (s.st_mode & 022) != 0
+        || pread(fd, ph, sizeof(*ph), 0) != sizeof(*ph)
+        || memcmp(ph->magic, MAGIC_AOUTCACHE, sizeof(ph->magic)) != 0 || ph->version != AOUTCACHE_VERSION
+        || !sameKey(&ph->key, pk) || ph->len == 0 || ph->len > AOUTCACHE_BYTES
+        || ph->offset > s.st_size || ph->len > s.st_size - ph->offset) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// a new file for the image: the temporary name of the shared file in path, or unlinked
+static int imageFile(machine_t *pm, const aoutcache_key_t *pk, char *path, size_t len) {
+    char name[PATH_MAX];
+    bool shared = sharedPath(pm, pk, name, sizeof(name));
+    int n = shared ? snprintf(path, len, "%s.XXXXXX", name) : snprintf(path, len, "%s/uuinterp-aout-XXXXXX", tmpDir());
+    if (n < 0 || n >= len) {
+        return -1;
+    }
+    int fd = mkstemp(path);
+    if (fd >= 0 && !shared) {
+        unlink(path);
+        path[0] = '\0';
+    }
+    return hostFd(fd);
+}
+
+static bool writeAt(int fd, const uint8_t *p, size_t n, off_t offset) {
+    while (n > 0) {
+        ssize_t w = pwrite(fd, p, n, offset);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return false;
+        }
+        p += w;
+        n -= w;
+        offset += w;
+    }
+    return true;
+}
+
+// the least recently used entry, or an empty one
+static aoutcache_entry_t *victim(aoutcache_t *pc, bool empty) {
+    aoutcache_entry_t *pe = NULL;
+    for (int i = 0; i < AOUTCACHE_ENTRIES; i++) {
+        aoutcache_entry_t *p = &pc->entries[i];
+        if (p->len == 0) {
+            if (empty) {
+                return p;
+            }
+        } else if (pe == NULL || p->used < pe->used) {
+            pe = p;
+        }
+    }
+    return pe;
+}
+
+int aoutCacheInit(machine_t *pm) {
+    aoutcache_t *pc = calloc(1, sizeof(aoutcache_t));
+    if (pc == NULL) {
+        return errno;
+    }
+    pm->aoutcache = pc;
+    return 0;
+}
+
+void aoutCacheFree(machine_t *pm) {
+    aoutcache_t *pc = pm->aoutcache;
+    if (pc == NULL) {
+        return;
+    }
+    for (int i = 0; i < AOUTCACHE_ENTRIES; i++) {
+        evict(pc, &pc->entries[i]);
+    }
+    free(pc);
+    pm->aoutcache = NULL;
+}
+
+// an empty entry for len bytes, the least recently used entries make room
+static aoutcache_entry_t *room(aoutcache_t *pc, size_t len) {
+    while (pc->bytes + len > AOUTCACHE_BYTES) {
+        evict(pc, victim(pc, false));
+    }
+    aoutcache_entry_t *pe = victim(pc, true);
+    evict(pc, pe);
+    return pe;
+}
+
+// the image of the entry to the guest
+static bool hit(machine_t *pm, aoutcache_entry_t *pe) {
+    aoutcache_t *pc = pm->aoutcache;
+#if DEBUG_LOG
+    fprintf(stderr, "/ [DBG] aout cache: hit %lu (%zu bytes)\n", (unsigned long)pe->key.ino, pe->len);
+#endif
+    if (guestMapFile(pm, pe->fd, pm->textStart, pe->len, pe->offset) != 0) {
+        evict(pc, pe);
+        return false;
+    }
+    memcpy(&pm->aout, pe->aout, sizeof(pm->aout));
+    pm->sizeOfVM = guestSize(pm);
+    pe->used = ++pc->clock;
+    pm->relocated = true;
+    return true;
+}
+
+bool aoutCacheLookup(machine_t *pm, const struct stat *ps) {
+    aoutcache_t *pc = pm->aoutcache;
+    if (pc == NULL) {
+        return false;
+    }
+    pc->pending = false;
+
+    aoutcache_key_t key;
+    makeKey(pm, ps, &key);
+    for (int i = 0; i < AOUTCACHE_ENTRIES; i++) {
+        aoutcache_entry_t *pe = &pc->entries[i];
+        if (pe->len != 0 && sameKey(&pe->key, &key)) {
+            return hit(pm, pe);
+        }
+    }
+
+    // stored by another invocation
+    aoutcache_file_t h;
+    int fd = openShared(pm, &key, &h);
+    if (fd < 0) {
+        return false;
+    }
+    aoutcache_entry_t *pe = room(pc, h.len);
+    pe->key = key;
+    memcpy(pe->aout, h.aout, sizeof(pe->aout));
+    pe->fd = fd;
+    pe->offset = h.offset;
+    pe->len = h.len;
+    pc->bytes += h.len;
+    return hit(pm, pe);
+}
+
+void aoutCacheMiss(machine_t *pm, const struct stat *ps) {
+    aoutcache_t *pc = pm->aoutcache;
+    if (pc == NULL) {
+        return;
+    }
+    // modified in this second, it may change again without a new mtime
+    if (ps->st_mtime >= time(NULL)) {
+        return;
+    }
+    makeKey(pm, ps, &pc->missed);
+    pc->pending = true;
+}
+
+void aoutCacheStore(machine_t *pm) {
+    aoutcache_t *pc = pm->aoutcache;
+    if (pc == NULL || !pc->pending) {
+        return;
+    }
+    pc->pending = false;
+
+    const size_t len = pm->dataEnd - pm->textStart;
+    if (len > AOUTCACHE_BYTES) {
+        return;
+    }
+
+    aoutcache_entry_t *pe = room(pc, len);
+
+    // textStart and the offset in the file at the same place in a page, for mmap()
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    const off_t offset = pageSize + pm->textStart % pageSize;
+    aoutcache_file_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MAGIC_AOUTCACHE, sizeof(h.magic));
+    h.version = AOUTCACHE_VERSION;
+    h.key = pc->missed;
+    memcpy(h.aout, &pm->aout, sizeof(h.aout));
+    h.offset = offset;
+    h.len = len;
+
+    char tmp[PATH_MAX];
+    int fd = imageFile(pm, &pc->missed, tmp, sizeof(tmp));
+    if (fd < 0) {
+        return;
+    }
+    bool ok = writeAt(fd, &pm->virtualMemory[pm->textStart], len, offset)
+        && writeAt(fd, (const uint8_t *)&h, sizeof(h), 0);
+    if (tmp[0] != '\0') {
+        // complete, then by its name: the same image if another invocation won
+        char name[PATH_MAX];
+        if (!ok || !sharedPath(pm, &pc->missed, name, sizeof(name)) || rename(tmp, name) != 0) {
+            unlink(tmp);
+        }
+    }
+    if (!ok) {
+        close(fd);
+        return;
+    }
+    memcpy(pe->aout, &pm->aout, sizeof(pe->aout));
+    pe->fd = fd;
+    pe->offset = offset;
+    pe->len = len;
+    // the copy of this process is dropped for the pages of the file too
+    guestMapFile(pm, fd, pm->textStart, len, offset);
+    pe->key = pc->missed;
+    pe->used = ++pc->clock;
+    pc->bytes += len;
+#if DEBUG_LOG
+    fprintf(stderr, "/ [DBG] aout cache: store %lu (%zu bytes)\n", (unsigned long)pe->key.ino, len);
+#endif
+}
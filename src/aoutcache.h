@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+struct aoutcache_tag;
+#ifndef _AOUTCACHE_T_
+#define _AOUTCACHE_T_
+typedef struct aoutcache_tag aoutcache_t;
+#endif
+
+// relocated images by the stat of the aout file: of this process and its children, and of
+// other invocations of the same user by files in $TMPDIR (not for disk images)
+int aoutCacheInit(machine_t *pm);
+void aoutCacheFree(machine_t *pm);
+
+// load() of a cached file: the image is in the memory, true if so
+bool aoutCacheLookup(machine_t *pm, const struct stat *ps);
+
+// load() read the file, then the image is relocated
+void aoutCacheMiss(machine_t *pm, const struct stat *ps);
+void aoutCacheStore(machine_t *pm);
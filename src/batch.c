@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <limits.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#define DEBUG_LOG 0
+
+#include "batch.h"
+#include "machine.h"
+#include "md5.h"
+#include "util.h"
+
+/* job list, a job per line, fields separated by spaces:
+  root cwd expect aout args...
+root and cwd are host dirs relative to the cwd of uuinterp, expect is one of
+  -       exit status 0
+  <n>     exit status n
+  <md5>   exit status 0 and the md5 (32 hex digits) of the stdout of the job
+empty lines and lines from '#' are skipped
+*/
+#define BATCH_MAX_LINE 4096
+
+typedef struct {
+    int line;
+    const char *root;
+    const char *cwd;
+    int status;
+    bool md5;
+    uint8_t digest[16];
+    int argc;
+    char **argv;
+} job_t;
+
+// by the workers in shared memory, by job
+typedef struct {
+    bool done;
+    int error;
+    int status;
+    uint8_t digest[16];
+    double ms;
+} result_t;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static bool parseDigest(const char *s, uint8_t digest[16]) {
+    if (strlen(s) != 32) {
+        return false;
+    }
+    for (int i = 0; i < 16; i++) {
+        unsigned int x;
+        char hex[3] = { s[i * 2], s[i * 2 + 1], '\0' };
+        char *end;
+        x = strtoul(hex, &end, 16);
+        if (*end != '\0' || hex[0] == '+' || hex[0] == '-' || hex[0] == ' ') {
+            return false;
+        }
+        digest[i] = x;
+    }
+    return true;
+}
+
+// the whole list; NULL and errno on error
+static job_t *parseJobs(const char *path, int *pnjobs) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+    job_t *jobs = NULL;
+    int njobs = 0;
+    char buf[BATCH_MAX_LINE];
+    for (int line = 1; fgets(buf, sizeof(buf), fp) != NULL; line++) {
+        if (strchr(buf, '\n') == NULL && !feof(fp)) {
+            fprintf(stderr, "/ [ERR] %s:%d: too long\n", path, line);
+            goto bad;
+        }
+        char *fields[BATCH_MAX_LINE / 2];
+        int n = 0;
+        for (char *p = strtok(buf, " \t\r\n"); p != NULL && p[0] != '#'; p = strtok(NULL, " \t\r\n")) {
+            fields[n++] = p;
+        }
+        if (n == 0) {
+            continue;
+        }
+        if (n < 4) {
+            fprintf(stderr, "/ [ERR] %s:%d: root cwd expect aout args...\n", path, line);
+            goto bad;
+        }
+
+        job_t *p = realloc(jobs, (njobs + 1) * sizeof(job_t));
+        if (p == NULL) {
+            goto bad;
+        }
+        jobs = p;
+        job_t *pj = &jobs[njobs++];
+        memset(pj, 0, sizeof(*pj));
+        pj->line = line;
+        pj->argc = n - 3;
+        pj->argv = malloc((pj->argc + 1) * sizeof(char *));
+        pj->root = strdup(fields[0]);
+        pj->cwd = strdup(fields[1]);
+        if (pj->argv == NULL || pj->root == NULL || pj->cwd == NULL) {
+            goto bad;
+        }
+        for (int i = 0; i < pj->argc; i++) {
+            if ((pj->argv[i] = strdup(fields[i + 3])) == NULL) {
+                goto bad;
+            }
+        }
+        pj->argv[pj->argc] = NULL;
+
+        char *end;
+        if (strcmp(fields[2], "-") == 0) {
+            pj->status = 0;
+        } else if (parseDigest(fields[2], pj->digest)) {
+            pj->status = 0;
+            pj->md5 = true;
+        } else if ((pj->status = strtol(fields[2], &end, 10)), *end != '\0') {
+            fprintf(stderr, "/ [ERR] %s:%d: bad expect \"%s\"\n", path, line, fields[2]);
+            goto bad;
+        }
+    }
+    fclose(fp);
+    *pnjobs = njobs;
+    return jobs;
+
+bad:
+    // the process exits
+    fclose(fp);
+    errno = EINVAL;
+    return NULL;
+}
+
+// the root of the job to pm->rootdir, kept while the worker runs jobs of the same root
+static int resolveRoot(machine_t *pm, const char *root, const char *home) {
+    static const char *last = NULL;
+    if (last != NULL && strcmp(last, root) == 0) {
+        return 0;
+    }
+    last = NULL;
+    if (chdir(root) != 0 || getcwd(pm->rootdir, sizeof(pm->rootdir)) == NULL || chdir(home) != 0) {
+        return errno;
+    }
+    last = root;
+    return 0;
+}
+
+// the job in a child with stdout to a pipe, *prun is set in the child
+static int runJob(machine_t *pm, const job_t *pj, const char *home, result_t *pr, bool *prun) {
+    int ret = resolveRoot(pm, pj->root, home);
+    if (ret != 0) {
+        return ret;
+    }
+    if (chdir(pj->cwd) != 0 || getcwd(pm->curdir, sizeof(pm->curdir)) == NULL) {
+        ret = errno;
+        chdir(home);
+        return ret;
+    }
+    // aout to the cache of the worker, the job loads it from there
+    ret = preloadAout(pm, pj->argv[0]);
+    if (ret != 0) {
+        chdir(home);
+        return ret;
+    }
+
+    int out[2];
+    if (pipe(out) != 0) {
+        ret = errno;
+        chdir(home);
+        return ret;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int in = open("/dev/null", O_RDONLY);
+        if (in < 0 || dup2(in, STDIN_FILENO) < 0 || dup2(out[1], STDOUT_FILENO) < 0) {
+            _exit(EXIT_FAILURE);
+        }
+        close(in);
+        close(out[0]);
+        close(out[1]);
+        if (!serializeArgvReal(pm, pj->argc, pj->argv)) {
+            fprintf(stderr, "/ [ERR] Too big argv\n");
+            _exit(EXIT_FAILURE);
+        }
+        budgetRun(pm);
+        *prun = true;
+        return 0;
+    }
+    ret = (pid < 0) ? errno : 0;
+    close(out[1]);
+    chdir(home);
+
+    // stdout of the job to the md5, then its status
+    md5_t md5;
+    md5Init(&md5);
+    uint8_t buf[8192];
+    ssize_t sret;
+    while ((sret = read(out[0], buf, sizeof(buf))) != 0) {
+        if (sret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sret < 0) {
+            break;
+        }
+        md5Update(&md5, buf, sret);
+    }
+    close(out[0]);
+    md5Final(&md5, pr->digest);
+    if (ret != 0) {
+        return ret;
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return errno;
+        }
+    }
+    pr->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    return 0;
+}
+
+static void printString(const char *s) {
+    putchar('"');
+    for (; *s != '\0'; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static bool passed(const job_t *pj, const result_t *pr) {
+    return pr->done && pr->error == 0 && pr->status == pj->status
+        && (!pj->md5 || memcmp(pr->digest, pj->digest, sizeof(pj->digest)) == 0);
+}
+
+static void printResults(const job_t *jobs, const result_t *results, int njobs, int nworkers, double ms) {
+    int npassed = 0;
+    printf("{\n  \"jobs\": [");
+    for (int i = 0; i < njobs; i++) {
+        const job_t *pj = &jobs[i];
+        const result_t *pr = &results[i];
+        bool ok = passed(pj, pr);
+        npassed += ok;
+        printf("%s\n    {\"line\": %d, \"root\": ", (i == 0) ? "" : ",", pj->line);
+        printString(pj->root);
+        printf(", \"cwd\": ");
+        printString(pj->cwd);
+        printf(", \"argv\": [");
+        for (int j = 0; j < pj->argc; j++) {
+            printf((j == 0) ? "" : ", ");
+            printString(pj->argv[j]);
+        }
+        printf("], ");
+        if (!pr->done) {
+            printf("\"error\": \"not run\"");
+        } else if (pr->error != 0) {
+            printf("\"error\": ");
+            printString(strerror(pr->error));
+        } else {
+            printf("\"status\": %d, \"md5\": \"", pr->status);
+            for (int j = 0; j < 16; j++) {
+                printf("%02x", pr->digest[j]);
+            }
+            printf("\"");
+        }
+        printf(", \"ok\": %s, \"ms\": %.3f}", ok ? "true" : "false", pr->ms);
+    }
+    printf("\n  ],\n  \"passed\": %d,\n  \"failed\": %d,\n  \"workers\": %d,\n  \"ms\": %.3f\n}\n",
+        npassed, njobs - npassed, nworkers, ms);
+}
+
+int batchRun(machine_t *pm, const char *path) {
+    double start = now();
+    int njobs = 0;
+    job_t *jobs = parseJobs(path, &njobs);
+    if (jobs == NULL) {
+        return errno;
+    }
+    char home[PATH_MAX];
+    if (getcwd(home, sizeof(home)) == NULL) {
+        return errno;
+    }
+
+    // results shared by the workers, a job each
+    size_t size = (njobs > 0) ? njobs * sizeof(result_t) : 1;
+    result_t *results = mapShared(size);
+    if (results == MAP_FAILED) {
+        return errno;
+    }
+
+    // indexes of the jobs to the workers, taken a job at a time
+    int queue[2];
+    if (pipe(queue) != 0) {
+        return errno;
+    }
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int nworkers = (ncpus < 1) ? 1 : (ncpus > njobs) ? njobs : (int)ncpus;
+    fflush(stdout);
+    for (int w = 0; w < nworkers; w++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "/ [WRN] batch: %d workers: %s\n", w, strerror(errno));
+            nworkers = w;
+            break;
+        }
+        if (pid > 0) {
+            continue;
+        }
+
+        // worker
+        close(queue[1]);
+        uint32_t i;
+        while (read(queue[0], &i, sizeof(i)) == sizeof(i)) {
+            assert(i < njobs);
+            double t = now();
+            bool run = false;
+            int ret = runJob(pm, &jobs[i], home, &results[i], &run);
+            if (run) {
+                // the job itself
+                close(queue[0]);
+                return 0;
+            }
+            results[i].error = ret;
+            results[i].ms = now() - t;
+            results[i].done = true;
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    close(queue[0]);
+    for (uint32_t i = 0; i < njobs && nworkers > 0; i++) {
+        if (write(queue[1], &i, sizeof(i)) != sizeof(i)) {
+            break;
+        }
+    }
+    close(queue[1]);
+    while (wait(NULL) > 0 || errno == EINTR) {
+    }
+
+    printResults(jobs, results, njobs, nworkers, now() - start);
+    int npassed = 0;
+    for (int i = 0; i < njobs; i++) {
+        npassed += passed(&jobs[i], &results[i]);
+    }
+    exit((npassed == njobs) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
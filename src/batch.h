@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+// runs the jobs of the list on workers, one per core, then the results as JSON to stdout
+// returns 0 in the run of a job, with root, cwd and args of the job; exits when all jobs are done
+int batchRun(machine_t *pm, const char *jobs);
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#define DEBUG_LOG 0
+
+#include "budget.h"
+#include "machine.h"
+#ifdef UU_M68K_MINIX
+#include "../m68k/src/cpu.h"
+#else
+#include "../pdp11/src/cpu.h"
+#endif
+#include "util.h"
+
+// the instructions are checked at ticks of the cpu time of the host process, not at each one
+#define BUDGET_TICK_USEC 10000
+#define BUDGET_MAX_TICKING 8
+
+// limits, 0 for none
+struct budget_tag {
+    uint64_t insn;
+    uint64_t tree;
+    uint32_t brk;
+    int depth;
+
+    // pm->retired at the start of the process, and the part of it in *total
+    uint64_t start;
+    uint64_t counted;
+    int forks;
+    // instructions of the process tree, shared by it
+    uint64_t *total;
+
+    // by the timer of the host process
+    volatile sig_atomic_t tick;
+};
+
+// the machines of the host process with a tick, the timer is one per process
+static machine_t *volatile ticking[BUDGET_MAX_TICKING];
+
+static void ticker(int sig) {
+    for (int i = 0; i < BUDGET_MAX_TICKING; i++) {
+        machine_t *pm = ticking[i];
+        if (pm != NULL) {
+            pm->budget->tick = 1;
+            pm->interrupted = 1;
+            pm->runLimit = 0;
+        }
+    }
+}
+
+// pm->budget is set
+static int startTick(machine_t *pm) {
+    int slot = -1;
+    for (int i = 0; i < BUDGET_MAX_TICKING && slot < 0; i++) {
+        if (ticking[i] == pm) {
+            slot = i;
+        }
+    }
+    for (int i = 0; i < BUDGET_MAX_TICKING && slot < 0; i++) {
+        if (ticking[i] == NULL) {
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        return EBUSY;
+    }
+    ticking[slot] = pm;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    // syscalls of the guest go on, the tick is only for runAout()
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = ticker;
+    if (sigaction(SIGVTALRM, &sa, NULL) != 0) {
+        return errno;
+    }
+    struct itimerval it;
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_usec = BUDGET_TICK_USEC;
+    it.it_value = it.it_interval;
+    return (setitimer(ITIMER_VIRTUAL, &it, NULL) != 0) ? errno : 0;
+}
+
+static uint32_t pcOf(machine_t *pm) {
+#ifdef UU_M68K_MINIX
+    return getPC(pm->cpu);
+#else
+    return pm->cpu->pc;
+#endif
+}
+
+// as exit() of the guest with BUDGET_EXIT
+static void over(machine_t *pm, const char *what, unsigned long long limit) {
+#ifdef UU_M68K_MINIX
+    fprintf(stderr, "/ [ERR] pid %d: budget: %s over %llu (pc=%08x)\n", getpid(), what, limit, pcOf(pm));
+#else
+    fprintf(stderr, "/ [ERR] pid %d: budget: %s over %llu (pc=%06o)\n", getpid(), what, limit, pcOf(pm));
+#endif
+    memoTaint(pm, "budget");
+    profileExit(pm);
+    vtimeExit(pm);
+    budgetExit(pm);
+    if (pm->io != NULL) {
+        pm->exited = true;
+        pm->exitStatus = BUDGET_EXIT;
+        pm->interrupted = 1;
+        pm->runLimit = 0;
+        return;
+    }
+    _exit(BUDGET_EXIT);
+}
+
+int budgetOpen(machine_t *pm, const char *spec) {
+    budget_t *pb = calloc(1, sizeof(budget_t));
+    if (pb == NULL) {
+        return ENOMEM;
+    }
+    const char *p = spec;
+    while (*p != '\0') {
+        const char *eq = strchr(p, '=');
+        if (eq == NULL) {
+            free(pb);
+            return EINVAL;
+        }
+        char *end;
+        errno = 0;
+        unsigned long long n = strtoull(eq + 1, &end, 10);
+        if (errno != 0 || end == eq + 1 || (*end != ',' && *end != '\0') || n == 0) {
+            free(pb);
+            return EINVAL;
+        }
+        const size_t len = eq - p;
+        if (len == 4 && strncmp(p, "insn", len) == 0) {
+            pb->insn = n;
+        } else if (len == 4 && strncmp(p, "tree", len) == 0) {
+            pb->tree = n;
+        } else if (len == 3 && strncmp(p, "brk", len) == 0 && n <= UINT32_MAX) {
+            pb->brk = (uint32_t)n;
+        } else if (len == 5 && strncmp(p, "depth", len) == 0 && n <= INT32_MAX) {
+            pb->depth = (int)n;
+        } else {
+            free(pb);
+            return EINVAL;
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    if (pb->tree != 0) {
+        pb->total = mapShared(sizeof(uint64_t));
+        if (pb->total == MAP_FAILED) {
+            int e = errno;
+            free(pb);
+            return e;
+        }
+    }
+    pb->start = pm->retired;
+    pb->counted = pm->retired;
+    pm->budget = pb;
+    if (pb->insn != 0 || pb->tree != 0) {
+        int e = startTick(pm);
+        if (e != 0) {
+            pm->budget = NULL;
+            free(pb);
+            return e;
+        }
+    }
+    return 0;
+}
+
+// the instructions since the last count to the tree, the total then
+static uint64_t count(machine_t *pm) {
+    budget_t *pb = pm->budget;
+    const uint64_t n = pm->retired - pb->counted;
+    pb->counted = pm->retired;
+    return __sync_add_and_fetch(pb->total, n);
+}
+
+void budgetPoll(machine_t *pm) {
+    budget_t *pb = pm->budget;
+    if (pb == NULL || !pb->tick) {
+        return;
+    }
+    pb->tick = 0;
+    if (pb->insn != 0 && pm->retired - pb->start > pb->insn) {
+        over(pm, "instructions", pb->insn);
+        return;
+    }
+    if (pb->tree != 0) {
+        const uint64_t total = count(pm);
+#if DEBUG_LOG
+        fprintf(stderr, "/ [DBG] budget: %d: %llu of the tree\n", getpid(), (unsigned long long)total);
+#endif
+        if (total > pb->tree) {
+            over(pm, "instructions of the tree", pb->tree);
+        }
+    }
+}
+
+bool budgetBreak(machine_t *pm, uint32_t brk) {
+    budget_t *pb = pm->budget;
+    if (pb == NULL || pb->brk == 0 || brk <= pm->bssEnd || brk - pm->bssEnd <= pb->brk) {
+        return true;
+    }
+    over(pm, "break", pb->brk);
+    return false;
+}
+
+// a new host process: its own instructions, and its own tick as the timer is not inherited
+static void restart(machine_t *pm) {
+    budget_t *pb = pm->budget;
+    pb->tick = 0;
+    pb->start = pm->retired;
+    pb->counted = pm->retired;
+    int e = (pb->insn != 0 || pb->tree != 0) ? startTick(pm) : 0;
+    if (e != 0) {
+        fprintf(stderr, "/ [WRN] pid %d: budget: no tick: %s\n", getpid(), strerror(e));
+    }
+}
+
+void budgetRun(machine_t *pm) {
+    if (pm->budget == NULL) {
+        return;
+    }
+    restart(pm);
+}
+
+void budgetFork(machine_t *pm) {
+    budget_t *pb = pm->budget;
+    if (pb == NULL) {
+        return;
+    }
+    restart(pm);
+    if (pb->depth != 0 && ++pb->forks > pb->depth) {
+        over(pm, "fork depth", pb->depth);
+    }
+}
+
+void budgetExit(machine_t *pm) {
+    budget_t *pb = pm->budget;
+    if (pb == NULL || pb->tree == 0) {
+        return;
+    }
+    count(pm);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+struct budget_tag;
+#ifndef _BUDGET_T_
+#define _BUDGET_T_
+typedef struct budget_tag budget_t;
+#endif
+
+// exit status of a guest over a limit, as timeout(1)
+#define BUDGET_EXIT 124
+
+// limits of the guest: spec is "name=N[,name=N...]", names insn (instructions of a
+// process), tree (instructions of the process tree), brk (bytes of break() over the bss)
+// and depth (of fork()); errno on error
+int budgetOpen(machine_t *pm, const char *spec);
+
+// by runAout() while pm->interrupted: the instructions against the limits at each tick
+void budgetPoll(machine_t *pm);
+
+// break() to brk: false if over the limit, the guest ended then
+bool budgetBreak(machine_t *pm, uint32_t brk);
+
+// the child of fork(): one deeper, its own instructions and tick
+void budgetFork(machine_t *pm);
+
+// a host process forked to run a guest of its own (a zygote run, a batch job): its own
+// instructions and tick, at the depth of the server
+void budgetRun(machine_t *pm);
+
+// at exit(), the rest of the instructions to the tree
+void budgetExit(machine_t *pm);
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define DEBUG_LOG 0
+
+#include "checkpoint.h"
+#include "machine.h"
+#ifdef UU_M68K_MINIX
+#include "../m68k/src/cpu.h"
+#else
+#include "../pdp11/src/cpu.h"
+#endif
+#include "util.h"
+
+struct checkpoint_tag {
+    char path[PATH_MAX];
+
+    // checkpointLoad() for checkpointCpu()
+    bool resumed;
+    checkpoint_regs_t regs;
+};
+
+#ifndef UU_M68K_MINIX
+static volatile sig_atomic_t requested;
+
+static void onSignal(int sig) {
+    requested = 1;
+}
+
+static checkpoint_t *getCheckpoint(machine_t *pm) {
+    if (pm->checkpoint == NULL) {
+        pm->checkpoint = calloc(1, sizeof(checkpoint_t));
+    }
+    return pm->checkpoint;
+}
+
+// a checkpoint of another build of the core is refused, even if it is the same size
+static uint32_t cpuLayout(void) {
+    const size_t offsets[] = {
+        offsetof(cpu_t, r0), offsetof(cpu_t, r1), offsetof(cpu_t, r2), offsetof(cpu_t, r3),
+        offsetof(cpu_t, r4), offsetof(cpu_t, r5), offsetof(cpu_t, sp), offsetof(cpu_t, pc),
+    };
+    uint32_t h = 0;
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        h = h * 31 + (uint32_t)offsets[i];
+    }
+    return h;
+}
+
+// the guest fds on files, others are left to the new invocation
+static int openFiles(checkpoint_fd_t *fds) {
+    int n = 0;
+#ifdef __linux__
+    for (int fd = 3; fd < CHECKPOINT_MAX_FDS; fd++) {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0) {
+            continue;
+        }
+        char link[32];
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        checkpoint_fd_t *pf = &fds[n];
+        memset(pf, 0, sizeof(*pf));
+        ssize_t len = readlink(link, pf->path, sizeof(pf->path) - 1);
+        struct stat s;
+        if (len <= 0 || pf->path[0] != '/' || fstat(fd, &s) != 0 || !S_ISREG(s.st_mode)) {
+            fprintf(stderr, "/ [WRN] checkpoint: fd %d is not a file, not saved\n", fd);
+            continue;
+        }
+        pf->fd = fd;
+        pf->flags = flags & (O_ACCMODE | O_APPEND);
+        pf->offset = lseek(fd, 0, SEEK_CUR);
+        n++;
+    }
+#else
+    fprintf(stderr, "/ [WRN] checkpoint: fds are not saved on this host\n");
+#endif
+    return n;
+}
+
+static int save(machine_t *pm, const char *path) {
+    checkpoint_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MAGIC_CHECKPOINT, sizeof(h.magic));
+    h.version = CHECKPOINT_VERSION;
+    h.cpuSize = sizeof(cpu_t);
+    h.cpuLayout = cpuLayout();
+    h.textStart = pm->textStart;
+    h.textEnd = pm->textEnd;
+    h.dataStart = pm->dataStart;
+    h.dataEnd = pm->dataEnd;
+    h.bssStart = pm->bssStart;
+    h.bssEnd = pm->bssEnd;
+    h.brk = pm->brk;
+    h.sizeOfVM = pm->sizeOfVM;
+    h.relocated = pm->relocated;
+    h.argc = pm->argc;
+    h.envc = pm->envc;
+    h.argsbytes = pm->argsbytes;
+    memcpy(h.aout, &pm->aout, sizeof(h.aout));
+    memcpy(h.rootdir, pm->rootdir, sizeof(h.rootdir));
+    if (getcwd(h.cwd, sizeof(h.cwd)) == NULL) {
+        return errno;
+    }
+    if (pm->dirp != NULL) {
+        fprintf(stderr, "/ [WRN] checkpoint: reading a directory, not saved\n");
+    }
+
+    static checkpoint_fd_t fds[CHECKPOINT_MAX_FDS];
+    h.nfds = openFiles(fds);
+    size_t len = sizeof(h) + sizeof(checkpoint_regs_t) + h.argsbytes + h.nfds * sizeof(checkpoint_fd_t);
+    h.memOffset = (len + CHECKPOINT_ALIGN - 1) & ~(CHECKPOINT_ALIGN - 1);
+
+    checkpoint_regs_t regs;
+    memset(&regs, 0, sizeof(regs));
+    regs.r[0] = pm->cpu->r0;
+    regs.r[1] = pm->cpu->r1;
+    regs.r[2] = pm->cpu->r2;
+    regs.r[3] = pm->cpu->r3;
+    regs.r[4] = pm->cpu->r4;
+    regs.r[5] = pm->cpu->r5;
+    regs.sp = pm->cpu->sp;
+    regs.pc = pm->cpu->pc;
+    regs.c = isC(pm->cpu);
+
+    // a whole file or none
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        return errno;
+    }
+    static const uint8_t zero[CHECKPOINT_ALIGN];
+    bool ok = writeAll(fd, &h, sizeof(h))
+        && writeAll(fd, &regs, sizeof(regs))
+        && writeAll(fd, pm->args, h.argsbytes)
+        && writeAll(fd, fds, h.nfds * sizeof(checkpoint_fd_t))
+        && writeAll(fd, zero, h.memOffset - len)
+        && writeAll(fd, pm->virtualMemory, h.sizeOfVM);
+    int e = errno;
+    if (close(fd) != 0 && ok) {
+        ok = false;
+        e = errno;
+    }
+    if (!ok || rename(tmp, path) != 0) {
+        e = ok ? errno : e;
+        remove(tmp);
+        return (e != 0) ? e : EIO;
+    }
+    return 0;
+}
+#endif
+
+int checkpointArm(machine_t *pm, const char *path) {
+#ifdef UU_M68K_MINIX
+    return ENOTSUP;
+#else
+    checkpoint_t *pk = getCheckpoint(pm);
+    if (pk == NULL) {
+        return ENOMEM;
+    }
+    if (strlen(path) >= sizeof(pk->path)) {
+        return ENAMETOOLONG;
+    }
+    strcpy(pk->path, path);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGUSR1, &sa, NULL) != 0) {
+        return errno;
+    }
+    return 0;
+#endif
+}
+
+void checkpointPoll(machine_t *pm) {
+#ifndef UU_M68K_MINIX
+    checkpoint_t *pk = pm->checkpoint;
+    if (!requested || pk->path[0] == '\0') {
+        return;
+    }
+    // not between exec() and the layout of the new image, nor in a handler of a signal:
+    // its frame is not in the memory
+    if (getPC(pm->cpu) >= pm->sizeOfVM - 1 || guestSignalFramed(pm)) {
+        return;
+    }
+    requested = 0;
+
+    int ret = save(pm, pk->path);
+    if (ret != 0) {
+        fprintf(stderr, "/ [ERR] checkpoint: %s: %s\n", pk->path, strerror(ret));
+    } else {
+        fprintf(stderr, "/ [INF] pid %d: checkpoint: %s\n", (int)getpid(), pk->path);
+    }
+#endif
+}
+
+int checkpointLoad(machine_t *pm, const char *path) {
+#ifdef UU_M68K_MINIX
+    return ENOTSUP;
+#else
+    checkpoint_t *pk = getCheckpoint(pm);
+    if (pk == NULL) {
+        return ENOMEM;
+    }
+    // above the fds to restore
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno;
+    }
+    int hfd = fcntl(fd, F_DUPFD, CHECKPOINT_MAX_FDS);
+    close(fd);
+    if (hfd < 0) {
+        return errno;
+    }
+    fd = hfd;
+
+    int ret = ENOEXEC;
+    checkpoint_header_t h;
+    struct stat s;
+    if (fstat(fd, &s) != 0) {
+        ret = errno;
+        goto out;
+    }
+    if (pread(fd, &h, sizeof(h), 0) != sizeof(h)
+        || memcmp(h.magic, MAGIC_CHECKPOINT, sizeof(h.magic)) != 0
+        || h.version != CHECKPOINT_VERSION
+        || h.cpuSize != sizeof(cpu_t) || h.cpuLayout != cpuLayout()
+        || h.textStart != pm->textStart || h.sizeOfVM > GUEST_MEMORY_SIZE
+        || h.argsbytes > sizeof(pm->args) || h.nfds > CHECKPOINT_MAX_FDS
+        || h.memOffset > s.st_size || h.sizeOfVM > s.st_size - h.memOffset) {
+        goto out;
+    }
+
+    // registers and args
+    off_t offset = sizeof(h);
+    if (pread(fd, &pk->regs, sizeof(pk->regs), offset) != sizeof(pk->regs)
+        || pread(fd, pm->args, h.argsbytes, offset + sizeof(pk->regs)) != h.argsbytes) {
+        goto out;
+    }
+    offset += sizeof(pk->regs) + h.argsbytes;
+
+    // the cwd of the guest is the host one
+    if (chdir(h.cwd) != 0) {
+        ret = errno;
+        fprintf(stderr, "/ [ERR] checkpoint: %s: %s\n", h.cwd, strerror(ret));
+        goto out;
+    }
+    for (uint32_t i = 0; i < h.nfds; i++) {
+        checkpoint_fd_t f;
+        if (pread(fd, &f, sizeof(f), offset) != sizeof(f)) {
+            goto out;
+        }
+        offset += sizeof(f);
+        f.path[sizeof(f.path) - 1] = '\0';
+        int ffd = open(f.path, f.flags);
+        if (ffd < 0 || (ffd != f.fd && (dup2(ffd, f.fd) < 0 || close(ffd) != 0))) {
+            ret = errno;
+            fprintf(stderr, "/ [ERR] checkpoint: fd %d: %s: %s\n", f.fd, f.path, strerror(ret));
+            goto out;
+        }
+        lseek(f.fd, f.offset, SEEK_SET);
+    }
+
+    // memory from the file
+    ret = guestMapFile(pm, fd, 0, h.sizeOfVM, h.memOffset);
+    if (ret != 0) {
+        goto out;
+    }
+
+    memcpy(pm->rootdir, h.rootdir, sizeof(pm->rootdir));
+    pm->rootdir[sizeof(pm->rootdir) - 1] = '\0';
+    memcpy(&pm->aout, h.aout, sizeof(pm->aout));
+    pm->textEnd = h.textEnd;
+    pm->dataStart = h.dataStart;
+    pm->dataEnd = h.dataEnd;
+    pm->bssStart = h.bssStart;
+    pm->bssEnd = h.bssEnd;
+    pm->brk = h.brk;
+    pm->sizeOfVM = h.sizeOfVM;
+    pm->relocated = h.relocated;
+    ret = guestLimit(pm, pm->sizeOfVM);
+    if (ret != 0) {
+        goto out;
+    }
+    pm->argc = h.argc;
+    pm->envc = h.envc;
+    pm->argsbytes = h.argsbytes;
+    pk->resumed = true;
+    ret = 0;
+out:
+    close(fd);
+    return ret;
+#endif
+}
+
+void checkpointCpu(machine_t *pm) {
+#ifndef UU_M68K_MINIX
+    checkpoint_t *pk = pm->checkpoint;
+    if (pk == NULL || !pk->resumed) {
+        return;
+    }
+    pk->resumed = false;
+
+    // registers from the checkpoint, the rest of the cpu from init() of this process
+    const checkpoint_regs_t *pr = &pk->regs;
+    pm->cpu->r0 = pr->r[0];
+    pm->cpu->r1 = pr->r[1];
+    pm->cpu->r2 = pr->r[2];
+    pm->cpu->r3 = pr->r[3];
+    pm->cpu->r4 = pr->r[4];
+    pm->cpu->r5 = pr->r[5];
+    pm->cpu->sp = pr->sp;
+    pm->cpu->pc = pr->pc;
+    if (pr->c) {
+        setC(pm->cpu);
+    } else {
+        clearC(pm->cpu);
+    }
+#endif
+}
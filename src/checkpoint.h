@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// for PATH_MAX
+#ifdef __linux__
+#include <linux/limits.h>
+#endif
+#ifdef __APPLE__
+#include <sys/syslimits.h>
+#endif
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+struct checkpoint_tag;
+#ifndef _CHECKPOINT_T_
+#define _CHECKPOINT_T_
+typedef struct checkpoint_tag checkpoint_t;
+#endif
+
+/* checkpoint file, in host byte order:
+  checkpoint_header_t
+  checkpoint_regs_t
+  args
+  checkpoint_fd_t[nfds]
+  padding
+  memory:    [0, sizeOfVM) at memOffset
+*/
+#define MAGIC_CHECKPOINT "UUCK"
+#define CHECKPOINT_VERSION 3
+#define CHECKPOINT_ALIGN 4096
+#define CHECKPOINT_MAX_FDS 64
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    // of the core that wrote it, and the offsets of its registers
+    uint32_t cpuSize;
+    uint32_t cpuLayout;
+    uint32_t textStart;
+    uint32_t textEnd;
+    uint32_t dataStart;
+    uint32_t dataEnd;
+    uint32_t bssStart;
+    uint32_t bssEnd;
+    uint32_t brk;
+    uint32_t sizeOfVM;
+    uint32_t relocated;
+    int32_t argc;
+    int32_t envc;
+    uint32_t argsbytes;
+    uint32_t aout[8];
+    uint32_t nfds;
+    uint32_t memOffset;
+    char rootdir[PATH_MAX];
+    char cwd[PATH_MAX];
+} checkpoint_header_t;
+
+// the registers of the guest at the end of a syscall, where C is the only condition code
+// defined (V6 libc tests it, then sets the others anew)
+typedef struct {
+    uint16_t r[6];
+    uint16_t sp;
+    uint16_t pc;
+    uint16_t c;
+    uint16_t pad;
+} checkpoint_regs_t;
+
+// a guest fd on a host file, reopened by path
+typedef struct {
+    int32_t fd;
+    int32_t flags;
+    int64_t offset;
+    char path[PATH_MAX];
+} checkpoint_fd_t;
+
+// SIGUSR1 writes the guest to path at the end of the next syscall, then it goes on (PDP-11,
+// main() refuses -k and -R for the m68k)
+int checkpointArm(machine_t *pm, const char *path);
+void checkpointPoll(machine_t *pm);
+
+// the machine, the memory, cwd and fds of a checkpoint, instead of load()
+int checkpointLoad(machine_t *pm, const char *path);
+
+// after init() of the cpu: the registers of the checkpoint
+void checkpointCpu(machine_t *pm);
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#define DEBUG_LOG 0
+
+#include "dirty.h"
+#include "machine.h"
+
+struct dirty_tag {
+    size_t pageSize;
+    size_t npages;
+    uint32_t generation;
+    // by page: the generation of the last write, and writable (not protected)
+    uint32_t *written;
+    uint8_t *writable;
+};
+
+static bool isWritable(const dirty_t *pd, size_t page) {
+    return pd->writable[page >> 3] & (1 << (page & 7));
+}
+
+// the page is written now, and can be without a fault until dirtyNext()
+static bool touch(machine_t *pm, size_t page) {
+    dirty_t *pd = pm->dirty;
+    if (!isWritable(pd, page)) {
+        if (mprotect(&pm->virtualMemory[page * pd->pageSize], pd->pageSize, PROT_READ | PROT_WRITE) != 0) {
+            return false;
+        }
+        pd->writable[page >> 3] |= 1 << (page & 7);
+    }
+    pd->written[page] = pd->generation;
+    return true;
+}
+
+int dirtyOpen(machine_t *pm) {
+    dirty_t *pd = calloc(1, sizeof(dirty_t));
+    if (pd == NULL) {
+        return ENOMEM;
+    }
+    pd->pageSize = sysconf(_SC_PAGESIZE);
+    pd->npages = GUEST_MEMORY_SIZE / pd->pageSize;
+    pd->written = malloc(pd->npages * sizeof(pd->written[0]));
+    pd->writable = malloc((pd->npages + 7) / 8);
+    if (pd->written == NULL || pd->writable == NULL) {
+        free(pd->written);
+        free(pd->writable);
+        free(pd);
+        return ENOMEM;
+    }
+    // all written at the start, the memory is writable as mapped
+    pd->generation = 1;
+    for (size_t i = 0; i < pd->npages; i++) {
+        pd->written[i] = pd->generation;
+    }
+    memset(pd->writable, 0xff, (pd->npages + 7) / 8);
+    pm->dirty = pd;
+    return 0;
+}
+
+void dirtyFree(machine_t *pm) {
+    dirty_t *pd = pm->dirty;
+    if (pd == NULL) {
+        return;
+    }
+    pm->dirty = NULL;
+    mprotect(pm->virtualMemory, pm->mapped, PROT_READ | PROT_WRITE);
+    free(pd->written);
+    free(pd->writable);
+    free(pd);
+}
+
+uint32_t dirtyNext(machine_t *pm) {
+    dirty_t *pd = pm->dirty;
+    // a call for all pages, only writes after this fault
+    if (mprotect(pm->virtualMemory, pm->mapped, PROT_READ) == 0) {
+        memset(pd->writable, 0, (pd->npages + 7) / 8);
+    }
+    return pd->generation++;
+}
+
+bool dirtySince(machine_t *pm, uint32_t vaddr, size_t n, uint32_t gen) {
+    const dirty_t *pd = pm->dirty;
+    if (n == 0) {
+        return false;
+    }
+    const size_t last = (vaddr + n - 1) / pd->pageSize;
+    for (size_t page = vaddr / pd->pageSize; page <= last && page < pd->npages; page++) {
+        if (pd->written[page] > gen) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void dirtyWillWrite(machine_t *pm, uint32_t vaddr, size_t n) {
+    const dirty_t *pd = pm->dirty;
+    if (n == 0) {
+        return;
+    }
+    const size_t last = (vaddr + n - 1) / pd->pageSize;
+    for (size_t page = vaddr / pd->pageSize; page <= last && page < pd->npages; page++) {
+        touch(pm, page);
+    }
+}
+
+bool dirtyFault(machine_t *pm, const uint8_t *addr) {
+    const dirty_t *pd = pm->dirty;
+    if (pd == NULL || addr < pm->virtualMemory || addr >= pm->virtualMemory + pm->mapped) {
+        return false;
+    }
+    const size_t page = (addr - pm->virtualMemory) / pd->pageSize;
+    if (isWritable(pd, page)) {
+        // not a write to a protected page
+        return false;
+    }
+#if DEBUG_LOG
+    fprintf(stderr, "/ [DBG] dirty: page %zu at %u\n", page, pd->generation);
+#endif
+    return touch(pm, page);
+}
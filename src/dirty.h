@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+struct dirty_tag;
+#ifndef _DIRTY_T_
+#define _DIRTY_T_
+typedef struct dirty_tag dirty_t;
+#endif
+
+// writes to the guest memory by host page: the generation of the last write of each page.
+// Stores of the cpu by write faults on protected pages, stores of the host by guestWillWrite().
+int dirtyOpen(machine_t *pm);
+void dirtyFree(machine_t *pm);
+
+// pages written from now on are newer than the returned generation
+uint32_t dirtyNext(machine_t *pm);
+
+// any page of [vaddr, vaddr+n) written after generation gen
+bool dirtySince(machine_t *pm, uint32_t vaddr, size_t n, uint32_t gen);
+
+// host code is about to store into [vaddr, vaddr+n)
+void dirtyWillWrite(machine_t *pm, uint32_t vaddr, size_t n);
+
+// by the SIGSEGV handler: true if addr is on a protected page, now written and writable
+bool dirtyFault(machine_t *pm, const uint8_t *addr);
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define DEBUG_LOG 0
+
+#include "fuse.h"
+#include "machine.h"
+#ifdef UU_M68K_MINIX
+#include "../m68k/src/cpu.h"
+#else
+#include "../pdp11/src/cpu.h"
+#endif
+
+#ifndef UU_M68K_MINIX
+static uint16_t getReg(cpu_t *pcpu, unsigned r) {
+    switch (r) {
+    case 0: return pcpu->r0;
+    case 1: return pcpu->r1;
+    case 2: return pcpu->r2;
+    case 3: return pcpu->r3;
+    case 4: return pcpu->r4;
+    case 5: return pcpu->r5;
+    case 6: return pcpu->sp;
+    default: return pcpu->pc;
+    }
+}
+
+static void setReg(cpu_t *pcpu, unsigned r, uint16_t data) {
+    switch (r) {
+    case 0: pcpu->r0 = data; break;
+    case 1: pcpu->r1 = data; break;
+    case 2: pcpu->r2 = data; break;
+    case 3: pcpu->r3 = data; break;
+    case 4: pcpu->r4 = data; break;
+    case 5: pcpu->r5 = data; break;
+    case 6: pcpu->sp = data; break;
+    default: pcpu->pc = data; break;
+    }
+}
+
+// the instruction at the pc by the core
+static void step(machine_t *pm) {
+    fetch(pm->cpu);
+    decode(pm->cpu);
+    exec(pm->cpu);
+}
+
+// a register but the pc, or an immediate at *pnext: false for the other modes
+static bool operand(machine_t *pm, unsigned spec, uint16_t *pnext, uint16_t *pvalue) {
+    if ((spec & 070) == 0 && spec != 7) {
+        *pvalue = getReg(pm->cpu, spec);
+        return true;
+    }
+    if (spec == 027) {
+        *pvalue = guestLoad16LE(pm, *pnext);
+        *pnext += 2;
+        return true;
+    }
+    return false;
+}
+
+// br, and the conditional branches but the traps and the jumps of 0000400-0003777
+static bool isBranch(uint16_t b) {
+    const unsigned op = b >> 8;
+    return (op >= 0001 && op <= 0007) || (op >= 0200 && op <= 0207);
+}
+
+static bool taken(uint16_t b, bool n, bool z, bool v, bool c) {
+    switch (b >> 8) {
+    case 0001: return true;             // br
+    case 0002: return !z;               // bne
+    case 0003: return z;                // beq
+    case 0004: return n == v;           // bge
+    case 0005: return n != v;           // blt
+    case 0006: return !z && n == v;     // bgt
+    case 0007: return z || n != v;      // ble
+    case 0200: return !n;               // bpl
+    case 0201: return n;                // bmi
+    case 0202: return !c && !z;         // bhi
+    case 0203: return c || z;           // blos
+    case 0204: return !v;               // bvc
+    case 0205: return v;                // bvs
+    case 0206: return !c;               // bcc
+    default: return c;                  // bcs
+    }
+}
+#endif
+
+int fuseCompare(machine_t *pm, uint16_t pc, uint16_t w) {
+#ifdef UU_M68K_MINIX
+    return 0;
+#else
+    const bool tst = (w & 0070000) == 0;
+    const uint16_t mask = (w & 0100000) ? 0xff : 0xffff;
+    const uint16_t sign = mask ^ (mask >> 1);
+    uint16_t next = pc + 2;
+    uint16_t s = 0;
+    uint16_t d;
+    if (!tst && !operand(pm, (w >> 6) & 077, &next, &s)) {
+        return 0;
+    }
+    if (!operand(pm, w & 077, &next, &d)) {
+        return 0;
+    }
+    const uint16_t b = guestLoad16LE(pm, next);
+    if (!isBranch(b)) {
+        return 0;
+    }
+
+    // the condition codes as the core sets them, from the operands before it runs
+    s &= mask;
+    d &= mask;
+    bool n, z, v, c;
+    if (tst) {
+        n = (d & sign) != 0;
+        z = d == 0;
+        v = false;
+        c = false;
+    } else {
+        const uint16_t r = (s - d) & mask;
+        n = (r & sign) != 0;
+        z = r == 0;
+        v = ((s ^ d) & (s ^ r) & sign) != 0;
+        c = s < d;
+    }
+    step(pm);
+    next += 2;
+    pm->cpu->pc = taken(b, n, z, v, c) ? (uint16_t)(next + 2 * (int8_t)(b & 0xff)) : next;
+    return 2;
+#endif
+}
+
+int fusePushCall(machine_t *pm, uint16_t pc, uint16_t w) {
+#ifdef UU_M68K_MINIX
+    return 0;
+#else
+    // the index, the immediate or the address of the source
+    const unsigned src = (w >> 6) & 077;
+    const unsigned mode = src >> 3;
+    const bool word = mode >= 6 || ((src & 7) == 7 && (mode == 2 || mode == 3));
+    const uint16_t jpc = pc + (word ? 4 : 2);
+
+    const uint16_t j = guestLoad16LE(pm, jpc);
+    const unsigned link = (j >> 6) & 7;
+    const unsigned dst = j & 077;
+    if ((j & 0177000) != 0004000 || link == 6) {
+        return 0;
+    }
+    uint16_t ret = jpc + 2;
+    if (dst == 037 || dst == 067) {
+        ret += 2;
+    } else if ((dst & 070) != 010 || dst == 017) {
+        return 0;
+    }
+    step(pm);
+
+    // jsr: the target, the link to the stack, the return address to the link
+    uint16_t target;
+    if (dst == 037) {
+        target = guestLoad16LE(pm, jpc + 2);
+    } else if (dst == 067) {
+        target = ret + guestLoad16LE(pm, jpc + 2);
+    } else {
+        target = getReg(pm->cpu, dst & 7);
+    }
+    const uint16_t sp = pm->cpu->sp - 2;
+    // a store of the cpu as the core's own, not one of the host
+    guestStore16LE(pm, sp, (link == 7) ? ret : getReg(pm->cpu, link));
+    pm->cpu->sp = sp;
+    if (link != 7) {
+        setReg(pm->cpu, link, ret);
+    }
+    pm->cpu->pc = target;
+    return 2;
+#endif
+}
+
+int fuseSob(machine_t *pm, uint16_t pc, uint16_t w) {
+#ifdef UU_M68K_MINIX
+    return 0;
+#else
+    const unsigned r = (w >> 6) & 7;
+    if (r == 7) {
+        return 0;
+    }
+    const uint16_t count = getReg(pm->cpu, r) - 1;
+    setReg(pm->cpu, r, count);
+    pm->cpu->pc = (count != 0) ? (uint16_t)(pc + 2 - 2 * (w & 077)) : (uint16_t)(pc + 2);
+    return 1;
+#endif
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+// Fused sequences of the PDP-11, the most frequent pairs of -P, matched by runAout() on
+// the word w at the pc. Each returns the instructions it ran, 0 to leave them to the core.
+// The core runs the first instruction, so the PS stays its own; the second one only moves
+// the pc and the stack.
+
+// cmp, cmpb, tst or tstb of registers and immediates, then a branch
+int fuseCompare(machine_t *pm, uint16_t pc, uint16_t w);
+
+// mov or movb to -(sp), then jsr to (rn), @#a or a
+int fusePushCall(machine_t *pm, uint16_t pc, uint16_t w);
+
+// sob at the end of a loop
+int fuseSob(machine_t *pm, uint16_t pc, uint16_t w);
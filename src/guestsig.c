@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <errno.h>
+
+#define DEBUG_LOG 0
+
+#include "guestsig.h"
+#include "machine.h"
+#ifdef UU_M68K_MINIX
+#include "../m68k/src/cpu.h"
+#else
+#include "../pdp11/src/cpu.h"
+#endif
+
+// V6 NSIG, signals 1..19
+#define GUEST_NSIG 20
+
+// the handlers running at once, each delivery resets the handler to the default
+#define GUEST_MAX_FRAMES GUEST_NSIG
+
+// the cpu at the interrupted instruction, kept here: the PS is not in the API of the core
+typedef struct {
+    cpu_t cpu;
+    // the memory of the process, and the sp at the pushed pc
+    uint8_t *mem;
+    uint16_t sp;
+} guestsig_frame_t;
+
+struct guestsig_tag {
+    // as u.u_signal of V6: 0 default, odd ignored, else the handler
+    uint16_t handlers[GUEST_NSIG];
+
+    // of the handlers running, innermost last
+    guestsig_frame_t frames[GUEST_MAX_FRAMES];
+    int nframes;
+};
+
+// the machine of the host process with handlers, and the host signals caught for it
+static machine_t *signalled;
+static volatile sig_atomic_t pending;
+
+// the signals from outside (kill, the tty), the same numbers in the host;
+// the others come from the guest itself and are left to the host
+static bool isAsync(int sig) {
+    return sig == SIGHUP || sig == SIGINT || sig == SIGQUIT
+        || sig == SIGPIPE || sig == SIGALRM || sig == SIGTERM;
+}
+
+static void asyncSet(sigset_t *set) {
+    sigemptyset(set);
+    for (int sig = 1; sig < GUEST_NSIG; sig++) {
+        if (isAsync(sig)) {
+            sigaddset(set, sig);
+        }
+    }
+}
+
+// the host handler, the guest one runs from runAout()
+static void catcher(int sig) {
+    // the other async signals are blocked here
+    pending |= 1 << sig;
+    signalled->interrupted = 1;
+    signalled->runLimit = 0;
+}
+
+static int setHost(int sig, uint16_t func) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    // no SA_RESTART: syscalls of the guest return EINTR as in V6
+    asyncSet(&sa.sa_mask);
+    sa.sa_handler = (func == 0) ? SIG_DFL : (func & 1) ? SIG_IGN : catcher;
+    return sigaction(sig, &sa, NULL);
+}
+
+int guestSignal(machine_t *pm, int sig, uint16_t func, uint16_t *pold) {
+#ifdef UU_M68K_MINIX
+    return ENOTSUP;
+#else
+    if (sig <= 0 || sig >= GUEST_NSIG || sig == SIGKILL) {
+        return EINVAL;
+    }
+    if (pm->sigs == NULL) {
+        pm->sigs = calloc(1, sizeof(guestsig_t));
+        if (pm->sigs == NULL) {
+            return ENOMEM;
+        }
+        // ignored signals come through exec() (nohup, sh for &)
+        for (int i = 1; i < GUEST_NSIG; i++) {
+            struct sigaction sa;
+            if (isAsync(i) && sigaction(i, NULL, &sa) == 0 && sa.sa_handler == SIG_IGN) {
+                pm->sigs->handlers[i] = 1;
+            }
+        }
+    }
+    if (isAsync(sig)) {
+        signalled = pm;
+        if (setHost(sig, func) != 0) {
+            return errno;
+        }
+    }
+    *pold = pm->sigs->handlers[sig];
+    pm->sigs->handlers[sig] = func;
+    return 0;
+#endif
+}
+
+void guestSignalExec(machine_t *pm) {
+    if (pm->sigs == NULL) {
+        return;
+    }
+    // the handlers are gone with the old image
+    pm->sigs->nframes = 0;
+    for (int sig = 1; sig < GUEST_NSIG; sig++) {
+        uint16_t *ph = &pm->sigs->handlers[sig];
+        if (*ph != 0 && (*ph & 1) == 0) {
+            *ph = 0;
+            if (isAsync(sig)) {
+                setHost(sig, 0);
+            }
+        }
+    }
+}
+
+#ifndef UU_M68K_MINIX
+// V6 psig(): pc and ps to the stack of the user, then the handler, reset to the default;
+// the pc pushed is the end of the memory, rti of the handler goes back by guestSignalReturn()
+static void deliver(machine_t *pm, int sig) {
+    guestsig_t *gs = pm->sigs;
+    const uint16_t func = pm->sigs->handlers[sig];
+#if DEBUG_LOG
+    fprintf(stderr, "/ [DBG] signal %d to %06o at %06o\n", sig, func, pm->cpu->pc);
+#endif
+    if (func & 1) {
+        // ignored since
+        return;
+    }
+    memoTaint(pm, "signal");
+    if (func == 0) {
+        // default since: by the host
+        setHost(sig, 0);
+        raise(sig);
+        return;
+    }
+    pm->sigs->handlers[sig] = 0;
+    setHost(sig, 0);
+
+    // frames above the sp were left by their handlers (exit to an outer loop)
+    const uint16_t sp = pm->cpu->sp - 4;
+    while (gs->nframes > 0 && gs->frames[gs->nframes - 1].sp < sp) {
+        gs->nframes--;
+    }
+    if (gs->nframes == GUEST_MAX_FRAMES) {
+        fprintf(stderr, "/ [WRN] pid %d: signal %d: %d handlers running, by the host\n", getpid(), sig, gs->nframes);
+        raise(sig);
+        return;
+    }
+    guestsig_frame_t *pf = &gs->frames[gs->nframes++];
+    pf->cpu = *pm->cpu;
+    pf->mem = pm->virtualMemory;
+    pf->sp = sp;
+
+    // any instruction boundary: the flags stay in the copy of the cpu, the PS pushed is 0
+    pm->cpu->sp = sp;
+    guestWillWrite(pm, sp, 4);
+    guestStore16LE(pm, sp + 2, 0);
+    guestStore16LE(pm, sp, (pm->sizeOfVM - 1) & 0xffff);
+    pm->cpu->pc = func;
+}
+#endif
+
+bool guestSignalReturn(machine_t *pm) {
+#ifdef UU_M68K_MINIX
+    return false;
+#else
+    guestsig_t *gs = pm->sigs;
+    if (gs == NULL) {
+        return false;
+    }
+    // rti pops pc and ps, rts of a handler in C leaves the ps
+    const uint16_t sp = pm->cpu->sp;
+    for (int i = gs->nframes - 1; i >= 0; i--) {
+        guestsig_frame_t *pf = &gs->frames[i];
+        if (pf->mem == pm->virtualMemory && sp > pf->sp && sp <= pf->sp + 4) {
+#if DEBUG_LOG
+            fprintf(stderr, "/ [DBG] signal return to %06o\n", pf->cpu.pc);
+#endif
+            *pm->cpu = pf->cpu;
+            // the inner ones were left by their handlers
+            gs->nframes = i;
+            return true;
+        }
+    }
+    return false;
+#endif
+}
+
+bool guestSignalFramed(machine_t *pm) {
+    return pm->sigs != NULL && pm->sigs->nframes > 0;
+}
+
+
+void guestSignalPoll(machine_t *pm) {
+    if (pending == 0) {
+        // by a tick of the budget: no signal for the guest, none taken meanwhile
+        sigset_t set, old;
+        asyncSet(&set);
+        sigprocmask(SIG_BLOCK, &set, &old);
+        if (pending == 0) {
+            pm->interrupted = 0;
+        }
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        return;
+    }
+#ifndef UU_M68K_MINIX
+    if (pm->cpu->pc >= pm->sizeOfVM - 1) {
+        // exec(), at the first instruction of the new aout
+        return;
+    }
+    sigset_t set, old;
+    asyncSet(&set);
+    sigprocmask(SIG_BLOCK, &set, &old);
+    const int mask = pending;
+    pending = 0;
+    pm->interrupted = 0;
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    for (int sig = 1; sig < GUEST_NSIG; sig++) {
+        if (mask & (1 << sig)) {
+            deliver(pm, sig);
+        }
+    }
+#endif
+}
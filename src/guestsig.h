@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+struct guestsig_tag;
+#ifndef _GUESTSIG_T_
+#define _GUESTSIG_T_
+typedef struct guestsig_tag guestsig_t;
+#endif
+
+// signal() of the guest (PDP-11 V6): func 0 default, odd ignored, else caught; errno on error
+int guestSignal(machine_t *pm, int sig, uint16_t func, uint16_t *pold);
+
+// after load() of exec(): caught signals to the default, ignored ones stay
+void guestSignalExec(machine_t *pm);
+
+// by runAout() while pm->interrupted: pending signals to their handlers at this
+// instruction boundary, interrupted cleared
+void guestSignalPoll(machine_t *pm);
+
+// by runAout() at the end of the memory: the rti of a handler resumes the cpu at the
+// interrupted instruction, true if so
+bool guestSignalReturn(machine_t *pm);
+
+// a handler of the guest runs, its frame is not in the guest memory
+bool guestSignalFramed(machine_t *pm);
@@ -1,12 +1,54 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define DEBUG_LOG 0
 
 #include "machine.h"
+#include "fuse.h"
+#include "prelink.h"
 #include "util.h"
+#ifdef UU_M68K_MINIX
+#include "../m68k/src/cpu.h"
+#else
+#include "../pdp11/src/cpu.h"
+#endif
+
+// pad args to 4 bytes
+static size_t alignArgs(machine_t *pm, size_t nc) {
+    if (nc & 1) {
+        pm->args[nc++] = '\0';
+    }
+    if (nc & 2) {
+        pm->args[nc++] = '\0';
+        pm->args[nc++] = '\0';
+    }
+    return nc;
+}
+
+// append a guest string to args, false if it faults or doesn't fit
+static bool appendArgVirt(machine_t *pm, size_t *pnc, uint32_t vaddr) {
+    // keep room for the alignment
+    const size_t room = sizeof(pm->args) - 3 - *pnc;
+    ssize_t len = guestStrnlen(pm, vaddr, room);
+    if (len < 0 || (size_t)len >= room) {
+        return false;
+    }
+#if DEBUG_LOG
+    fprintf(stderr, "/ [DBG] %08x: %s\n", vaddr, (const char *)mmuV2R(pm, vaddr));
+#endif
+    memcpy(&pm->args[*pnc], mmuV2R(pm, vaddr), len + 1);
+    *pnc += len + 1;
+    return true;
+}
 
 bool serializeArgvReal(machine_t *pm, int argc, char *argv[]) {
     assert(argv[argc] == NULL);
@@ -14,203 +56,848 @@ bool serializeArgvReal(machine_t *pm, int argc, char *argv[]) {
     // args
     size_t nc = 0;
     for (int i = 0; i < argc; i++) {
-        const char *pa = argv[i];
-        do {
-            pm->args[nc++] = *pa;
-            if (nc >= sizeof(pm->args) - 1) {
-                return false;
-            }
-        } while (*pa++ != '\0');
+        size_t len = strlen(argv[i]) + 1;
+        if (len > sizeof(pm->args) - 3 - nc) {
+            return false;
+        }
+        memcpy(&pm->args[nc], argv[i], len);
+        nc += len;
     }
 
     // envs
     int ne = 0;
 
-    // alignment
-    if (nc & 1) {
-        pm->args[nc++] = '\0';
-    }
-    if (nc & 2) {
-        pm->args[nc++] = '\0';
-        pm->args[nc++] = '\0';
-    }
-
     pm->argc = argc;
     pm->envc = ne;
-    pm->argsbytes = nc;
+    pm->argsbytes = alignArgs(pm, nc);
     return true;
 }
 
-int serializeArgvVirt16(machine_t *pm, uint8_t *argv) {
+int serializeArgvVirt16(machine_t *pm, uint16_t vargv) {
     uint16_t na = 0;
-    uint16_t nc = 0;
-
-    uint16_t vaddr = read16(argv);
-    argv += 2;
-    while (vaddr != 0) {
-        const char *pa = (const char *)&pm->virtualMemory[vaddr];
+    size_t nc = 0;
 
-        vaddr = read16(argv);
-        argv += 2;
+    while (1) {
+        const uint8_t *p = guestSpan(pm, vargv, 2);
+        if (p == NULL) {
+            return -1;
+        }
+        uint16_t vaddr = read16(p);
+        vargv += 2;
+        if (vaddr == 0) {
+            break;
+        }
+        if (!appendArgVirt(pm, &nc, vaddr)) {
+            return -1;
+        }
         na++;
-
-        do {
-            pm->args[nc++] = *pa;
-            if (nc >= sizeof(pm->args) - 1) {
-                return -1;
-            }
-        } while (*pa++ != '\0');
-    }
-
-    // alignment
-    if (nc & 1) {
-        pm->args[nc++] = '\0';
-    }
-    if (nc & 2) {
-        pm->args[nc++] = '\0';
-        pm->args[nc++] = '\0';
     }
 
     pm->argc = na;
     pm->envc = 0;
-    pm->argsbytes = nc;
+    pm->argsbytes = alignArgs(pm, nc);
     return 0;
 }
 
-// TODO: virtual memory page をまたぐと動かない
 int serializeArgvVirt(machine_t *pm, uint32_t vaddr) {
     uint32_t na = 0;
     uint32_t ne = 0;
-    uint32_t nc = 0;
+    size_t nc = 0;
 
+    // argc, argv[0]...argv[na-1], NULL, envp[0]...envp[ne-1], NULL
+    // pointers are relative to vaddr
     uint32_t vp = vaddr;
-    uint32_t argc = read32(mmuV2R(pm, vp));
+    const uint8_t *p = guestSpan(pm, vp, 8);
+    if (p == NULL) {
+        return -1;
+    }
+    uint32_t argc = read32(p);
     vp += 4;
 
     // args
-    uint32_t varg = vaddr + read32(mmuV2R(pm, vp));
+    uint32_t varg = vaddr + read32(p + 4);
     vp += 4;
     while (varg > vaddr) {
-        const char *pa = (const char *)mmuV2R(pm, varg);
-
-        varg = vaddr + read32(mmuV2R(pm, vp));
-        vp += 4;
+        if (!appendArgVirt(pm, &nc, varg)) {
+            return -1;
+        }
         na++;
 
-#if DEBUG_LOG
-        fprintf(stderr, "/ [DBG] varg=%08x: ", mmuR2V(pm, (uint8_t *)pa));
-#endif
-        do {
-#if DEBUG_LOG
-            if (*pa != '\0') fprintf(stderr, "%c", *pa);
-#endif
-            pm->args[nc++] = *pa;
-            if (nc >= sizeof(pm->args) - 1) {
-                return -1;
-            }
-        } while (*pa++ != '\0');
-#if DEBUG_LOG
-        fprintf(stderr, "\n");
-#endif
+        p = guestSpan(pm, vp, 4);
+        if (p == NULL) {
+            return -1;
+        }
+        varg = vaddr + read32(p);
+        vp += 4;
     }
 
     // envs
-    uint32_t venv = vaddr + read32(mmuV2R(pm, vp));
+    p = guestSpan(pm, vp, 4);
+    if (p == NULL) {
+        return -1;
+    }
+    uint32_t venv = vaddr + read32(p);
     vp += 4;
     while (venv > vaddr) {
-        const char *pa = (const char *)mmuV2R(pm, venv);
+        if (!appendArgVirt(pm, &nc, venv)) {
+            return -1;
+        }
+        ne++;
 
-        venv = vaddr + read32(mmuV2R(pm, vp));
+        p = guestSpan(pm, vp, 4);
+        if (p == NULL) {
+            return -1;
+        }
+        venv = vaddr + read32(p);
         vp += 4;
-        ne++;
+    }
 
+    assert(na == argc);
+    pm->argc = na;
+    pm->envc = ne;
+    pm->argsbytes = alignArgs(pm, nc);
+    return 0;
+}
+
+// the machine of the guard pages, of the thread: SIGSEGV goes to the faulting one
+static __thread machine_t *faultMachine;
+static size_t pageSize;
+
+static void guestFault(int sig, siginfo_t *info, void *ctx) {
+    machine_t *pm = faultMachine;
+    const uint8_t *addr = info->si_addr;
+    if (pm != NULL && pm->dirty != NULL && dirtyFault(pm, addr)) {
+        // a write to a tracked page, again
+        return;
+    }
+    if (pm == NULL || addr < pm->virtualMemory - pageSize || addr >= pm->virtualMemory + GUEST_ADDRESS_SPACE + pageSize) {
+        // not the guest, crash as usual
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+
+    char msg[80];
+    int n = snprintf(msg, sizeof(msg), "/ [ERR] pid %d: memory fault at %08lx (pc=%08x)\n",
+        (int)getpid(), (long)(addr - pm->virtualMemory), (pm->cpu != NULL) ? getPC(pm->cpu) : 0);
+    if (n > 0) {
+        ssize_t ret = write(STDERR_FILENO, msg, ((size_t)n < sizeof(msg)) ? n : sizeof(msg) - 1);
+        (void)ret;
+    }
+    _exit(EXIT_FAILURE);
+}
+
+// the address space between the guard pages, [0, size) accessible; NULL and errno on error
+static uint8_t *mapSpace(size_t size) {
+    const size_t total = pageSize + GUEST_ADDRESS_SPACE + pageSize;
+
+    // private zero pages, only the touched ones take memory
+    int fd = open("/dev/zero", O_RDWR);
+    if (fd < 0) {
+        return NULL;
+    }
+    // (no fd stays open, guest fds are host fds)
+    uint8_t *p = mmap(NULL, total, PROT_NONE, MAP_PRIVATE, fd, 0);
+    int e = errno;
+    close(fd);
+    if (p == MAP_FAILED) {
+        errno = e;
+        return NULL;
+    }
+    if (size > 0 && mprotect(p + pageSize, size, PROT_READ | PROT_WRITE) != 0) {
+        e = errno;
+        munmap(p, total);
+        errno = e;
+        return NULL;
+    }
+    return p + pageSize;
+}
+
+static void unmapSpace(uint8_t *mem) {
+    munmap(mem - pageSize, pageSize + GUEST_ADDRESS_SPACE + pageSize);
+}
+
+int guestMap(machine_t *pm) {
+    pageSize = sysconf(_SC_PAGESIZE);
+    uint8_t *p = mapSpace(GUEST_MEMORY_SIZE);
+    if (p == NULL) {
+        return errno;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = guestFault;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGSEGV, &sa, NULL) != 0) {
+        int e = errno;
+        unmapSpace(p);
+        return e;
+    }
+
+    pm->virtualMemory = p;
+    pm->sizeOfVM = GUEST_MEMORY_SIZE;
+    pm->mapped = GUEST_MEMORY_SIZE;
+    faultMachine = pm;
+    return 0;
+}
+
+uint8_t *guestClone(machine_t *pm, uint32_t sp) {
+    uint8_t *mem = mapSpace(pm->mapped);
+    if (mem == NULL) {
+        return NULL;
+    }
+    const uint32_t brk = (pm->brk < pm->sizeOfVM) ? pm->brk : pm->sizeOfVM;
+    sp = (sp < pm->sizeOfVM) ? sp : pm->sizeOfVM;
+    memcpy(mem, pm->virtualMemory, brk);
+    memcpy(mem + sp, pm->virtualMemory + sp, pm->sizeOfVM - sp);
+    return mem;
+}
+
+void guestRelease(uint8_t *mem) {
+    unmapSpace(mem);
+}
+
+void guestUnmap(machine_t *pm) {
+    if (pm->virtualMemory == NULL) {
+        return;
+    }
+    unmapSpace(pm->virtualMemory);
+    pm->virtualMemory = NULL;
+    if (faultMachine == pm) {
+        faultMachine = NULL;
+    }
+}
+
+// the end of the memory of the aout with the header
+static size_t sizeOfAout(uint32_t textStart, const uint32_t *headerBE) {
+    if (!IS_MAGIC_BE(headerBE[0])) {
+        // PDP-11 V6: all of the 16-bit space
+        return GUEST_MEMORY_SIZE;
+    }
+
+    // m68k Minix: total is data, bss and stack, and text unless separate I&D
+    size_t size = textStart + (size_t)headerBE[6];
+    if (IS_SEPARATE(headerBE[0])) {
+        size += headerBE[2];
+    }
+    // in clicks
+    return (size + 0xff) & ~(size_t)0xff;
+}
+
+size_t guestSize(machine_t *pm) {
+    return sizeOfAout(pm->textStart, pm->aout.headerBE);
+}
+
+int guestLimit(machine_t *pm, size_t size) {
+    size_t end = (size + pageSize - 1) & ~(pageSize - 1);
+    end = (end < GUEST_MEMORY_SIZE) ? end : GUEST_MEMORY_SIZE;
+    if (end > pm->mapped) {
+        // zero, dropped at the last limit
+        if (mprotect(&pm->virtualMemory[pm->mapped], end - pm->mapped, PROT_READ | PROT_WRITE) != 0) {
+            return errno;
+        }
+    } else if (end < pm->mapped) {
+        int fd = open("/dev/zero", O_RDWR);
+        if (fd < 0) {
+            return errno;
+        }
+        void *p = mmap(&pm->virtualMemory[end], pm->mapped - end, PROT_NONE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+        int e = errno;
+        close(fd);
+        if (p == MAP_FAILED) {
+            return e;
+        }
+    }
 #if DEBUG_LOG
-        fprintf(stderr, "/ [DBG] venv=%08x: ", mmuR2V(pm, (uint8_t *)pa));
-#endif
-        do {
-#if DEBUG_LOG
-            if (*pa != '\0') fprintf(stderr, "%c", *pa);
+    fprintf(stderr, "/ [DBG] pid %d: memory %08zx -> %08zx\n", getpid(), pm->mapped, end);
 #endif
-            pm->args[nc++] = *pa;
-            if (nc >= sizeof(pm->args) - 1) {
-                return -1;
+    pm->mapped = end;
+    return 0;
+}
+
+void guestZero(machine_t *pm, uint32_t vaddr, size_t n) {
+    if (pm->dirty != NULL) {
+        dirtyWillWrite(pm, vaddr, n);
+    }
+    // whole pages inside
+    const uintptr_t start = ((uintptr_t)&pm->virtualMemory[vaddr] + pageSize - 1) & ~(uintptr_t)(pageSize - 1);
+    const uintptr_t end = (uintptr_t)&pm->virtualMemory[vaddr + n] & ~(uintptr_t)(pageSize - 1);
+
+    // a few pages are cheaper to clear
+    void *p = MAP_FAILED;
+    int fd;
+    if (end > start && end - start >= 16 * pageSize && (fd = open("/dev/zero", O_RDWR)) >= 0) {
+        p = mmap((void *)start, end - start, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+        close(fd);
+    }
+    if (p == MAP_FAILED) {
+        memset(&pm->virtualMemory[vaddr], 0, n);
+        return;
+    }
+    memset(&pm->virtualMemory[vaddr], 0, (uint8_t *)start - &pm->virtualMemory[vaddr]);
+    memset((uint8_t *)end, 0, &pm->virtualMemory[vaddr + n] - (uint8_t *)end);
+}
+
+// pread() of fd on the host, or of path in the disk image for fd -1, short only at the end of the file
+static ssize_t readAt(machine_t *pm, int fd, const char *path, void *buf, size_t n, off_t offset) {
+    if (pm->v6fs != NULL && fd < 0) {
+        return v6fsPread(pm->v6fs, path, buf, n, offset);
+    }
+    size_t done = 0;
+    while (done < n) {
+        ssize_t sret = pread(fd, (uint8_t *)buf + done, n - done, offset + done);
+        if (sret < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-        } while (*pa++ != '\0');
-#if DEBUG_LOG
-        fprintf(stderr, "\n");
-#endif
+            return -1;
+        }
+        if (sret == 0) {
+            break;
+        }
+        done += sret;
     }
+    return done;
+}
 
-    // alignment
-    if (nc & 1) {
-        pm->args[nc++] = '\0';
+// a section of the file straight to its address
+static int loadSection(machine_t *pm, int fd, const char *path, uint32_t vaddr, size_t size, off_t offset) {
+    if (size == 0) {
+        return 0;
     }
-    if (nc & 2) {
-        pm->args[nc++] = '\0';
-        pm->args[nc++] = '\0';
+    guestWillWrite(pm, vaddr, size);
+    ssize_t n = readAt(pm, fd, path, &pm->virtualMemory[vaddr], size, offset);
+    if (n < 0) {
+        return errno;
     }
+    return (n == size) ? 0 : ENOEXEC;
+}
 
-    assert(na == argc);
-    pm->argc = na;
-    pm->envc = ne;
-    pm->argsbytes = nc;
-    return 0;
+// pages of [vaddr, vaddr+size) shared with the file, the rest by readAt()
+static int mapSection(machine_t *pm, int fd, const char *path, uint32_t vaddr, size_t size, off_t offset) {
+    const uint32_t start = (vaddr + pageSize - 1) & ~(uint32_t)(pageSize - 1);
+    const uint32_t end = (vaddr + size) & ~(uint32_t)(pageSize - 1);
+    const off_t mapOffset = offset + (start - vaddr);
+    if (fd < 0 || end <= start || (mapOffset & (pageSize - 1)) != 0
+        || mmap(&pm->virtualMemory[start], end - start, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, mapOffset) == MAP_FAILED) {
+        return loadSection(pm, fd, path, vaddr, size, offset);
+    }
+    guestWillWrite(pm, start, end - start);
+    int ret = loadSection(pm, fd, path, vaddr, start - vaddr, offset);
+    if (ret == 0) {
+        ret = loadSection(pm, fd, path, end, vaddr + size - end, offset + (end - vaddr));
+    }
+    return ret;
 }
 
-int load(machine_t *pm, const char *src) {
-    char name[PATH_MAX];
-    addroot(name, sizeof(name), src, pm->rootdir);
+int guestMapFile(machine_t *pm, int fd, uint32_t vaddr, size_t size, off_t offset) {
+    return mapSection(pm, fd, NULL, vaddr, size, offset);
+}
 
-    FILE *fp;
-    fp = fopen(name, "rb");
-    if (fp == NULL) {
+// prelinked aout, to the memory as is
+static int loadPrelinked(machine_t *pm, int fd, const char *path, off_t fileSize) {
+    prelink_header_t h;
+    ssize_t n = readAt(pm, fd, path, &h, sizeof(h), 0);
+    if (n < 0) {
         return errno;
     }
+#ifdef UU_M68K_MINIX
+    const uint32_t arch = PRELINK_M68K_MINIX;
+#else
+    const uint32_t arch = PRELINK_PDP11_V6;
+#endif
+    if (n != sizeof(h) || h.version != PRELINK_VERSION || h.arch != arch || h.textStart != pm->textStart) {
+        return ENOEXEC;
+    }
+    const size_t vmSize = sizeOfAout(h.textStart, h.aout);
+    if (vmSize > GUEST_MEMORY_SIZE) {
+        return ENOMEM;
+    }
+    if (h.dataEnd < h.textStart || h.bssEnd > vmSize - 2
+        || h.imageOffset > fileSize || h.dataEnd - h.textStart > fileSize - h.imageOffset) {
+        return ENOEXEC;
+    }
 
-    size_t n;
-    size_t size;
-    size = sizeof(pm->aout.header);
-    n = fread(pm->aout.header, 1, size, fp);
+    int ret = mapSection(pm, fd, path, h.textStart, h.dataEnd - h.textStart, h.imageOffset);
+    if (ret != 0) {
+        return ret;
+    }
+    memcpy(&pm->aout, h.aout, sizeof(pm->aout));
+    pm->sizeOfVM = vmSize;
+    pm->relocated = true;
+    return 0;
+}
+
+static int loadFile(machine_t *pm, int fd, const char *path, off_t fileSize) {
+    // the header is validated before the guest memory and pm->aout are overwritten
+    union {
+        uint16_t header[8];
+        uint32_t headerBE[8];
+    } aout;
+    size_t size = sizeof(aout.header);
+    ssize_t n = readAt(pm, fd, path, aout.header, size, 0);
+    if (n < 0) {
+        return errno;
+    }
     if (n != size) {
-        fclose(fp);
         return ENOEXEC;
     }
+    if (memcmp(aout.header, MAGIC_PRELINK, 4) == 0) {
+        return loadPrelinked(pm, fd, path, fileSize);
+    }
 
-    if (!IS_MAGIC_BE(pm->aout.headerBE[0])) {
+    off_t headerLen;
+    uint32_t textSize, dataSize, dataStart;
+    off_t relocOffset = 0;
+    if (!IS_MAGIC_BE(aout.headerBE[0])) {
         // PDP-11 V6
         // TODO: endian
+        if (aout.header[0] != 0x0107 && aout.header[0] != 0x0108) {
+            return ENOEXEC;
+        }
+        headerLen = size;
+        textSize = aout.header[1];
+        dataSize = aout.header[2];
+        dataStart = pm->textStart + textSize;
+        if (aout.header[0] == 0x0108) {
+            // 8KB alignment
+            dataStart = (dataStart + 0x1fff) & ~0x1fff;
+        }
+        if (textSize == 0) {
+            return ENOEXEC;
+        }
+        if ((size_t)dataStart + dataSize + aout.header[3] > GUEST_MEMORY_SIZE - 2) {
+            return ENOMEM;
+        }
     } else {
         // m68k Minix
-        n = fread(&pm->aout.headerBE[4], 1, size, fp);
+        n = readAt(pm, fd, path, &aout.headerBE[4], size, size);
+        if (n < 0) {
+            return errno;
+        }
         if (n != size) {
-            fclose(fp);
             return ENOEXEC;
         }
 
-        pm->aout.headerBE[1] = ntohl(pm->aout.headerBE[1]) & 0xff; // header len
-        pm->aout.headerBE[2] = ntohl(pm->aout.headerBE[2]); // text size
-        pm->aout.headerBE[3] = ntohl(pm->aout.headerBE[3]); // data size
-        pm->aout.headerBE[4] = ntohl(pm->aout.headerBE[4]); // bss  size
-        pm->aout.headerBE[5] = ntohl(pm->aout.headerBE[5]); // entry
-        pm->aout.headerBE[6] = ntohl(pm->aout.headerBE[6]); // total
-        pm->aout.headerBE[7] = ntohl(pm->aout.headerBE[7]); // symbol
+        aout.headerBE[1] = ntohl(aout.headerBE[1]) & 0xff; // header len
+        aout.headerBE[2] = ntohl(aout.headerBE[2]); // text size
+        aout.headerBE[3] = ntohl(aout.headerBE[3]); // data size
+        aout.headerBE[4] = ntohl(aout.headerBE[4]); // bss  size
+        aout.headerBE[5] = ntohl(aout.headerBE[5]); // entry
+        aout.headerBE[6] = ntohl(aout.headerBE[6]); // total
+        aout.headerBE[7] = ntohl(aout.headerBE[7]); // symbol
+
+        headerLen = aout.headerBE[1];
+        textSize = aout.headerBE[2];
+        dataSize = aout.headerBE[3];
+        // data follows text also for separate I&D
+        dataStart = pm->textStart + textSize;
+        if (headerLen != 2 * size || textSize == 0 || textSize >= GUEST_MEMORY_SIZE || dataSize >= GUEST_MEMORY_SIZE) {
+            return ENOEXEC;
+        }
+        // the relocation table follows the symbol table
+        relocOffset = headerLen + (off_t)textSize + dataSize + aout.headerBE[7];
+
+        // the memory of the aout
+        const size_t vmSize = sizeOfAout(pm->textStart, aout.headerBE);
+        const uint64_t end = (uint64_t)dataStart + dataSize + aout.headerBE[4];
+        if (vmSize > GUEST_MEMORY_SIZE) {
+            return ENOMEM;
+        }
+        if ((end & 1) != 0 || end > vmSize - 2) {
+            return ENOEXEC;
+        }
+    }
+    if (fileSize < headerLen + (off_t)textSize + dataSize) {
+        return ENOEXEC;
     }
 
-    // TODO: validate aout before overwriting the virtual memory
-    if (sizeof(pm->virtualMemory) < pm->aout.headerBE[6]) {
-        return ENOMEM;
+    // only text, data and the relocation table
+    int ret = loadSection(pm, fd, path, pm->textStart, textSize, headerLen);
+    if (ret == 0) {
+        ret = loadSection(pm, fd, path, dataStart, dataSize, headerLen + textSize);
+    }
+    if (ret == 0 && relocOffset != 0) {
+        // at the end of data, up to the end of the memory
+        const uint32_t relocStart = dataStart + dataSize;
+        size_t relocSize = (fileSize > relocOffset) ? fileSize - relocOffset : 0;
+        const size_t room = GUEST_MEMORY_SIZE - relocStart;
+        relocSize = (relocSize < room) ? relocSize : room;
+        if (relocSize < 4) {
+            // no relocation
+            const size_t zero = (room < 4) ? room : 4;
+            guestWillWrite(pm, relocStart, zero);
+            memset(&pm->virtualMemory[relocStart], 0, zero);
+        }
+        ret = loadSection(pm, fd, path, relocStart, relocSize, relocOffset);
+    }
+    if (ret != 0) {
+        return ret;
     }
 
-    size = sizeof(pm->virtualMemory) - pm->textStart;
-    n = fread(&pm->virtualMemory[pm->textStart], 1, size, fp);
-    if (n <= 0) {
-        fclose(fp);
-        return ENOEXEC;
+    memcpy(&pm->aout, &aout, sizeof(pm->aout));
+    pm->sizeOfVM = guestSize(pm);
+    pm->relocated = false;
+    return 0;
+}
+
+static int loadImage(machine_t *pm, const char *src) {
+    struct stat s;
+    int ret;
+    if (pm->v6fs != NULL) {
+        // PDP-11 V6 aout in the disk image
+        if (v6fsStat(pm->v6fs, src, &s) != 0) {
+            return errno;
+        }
+        if (aoutCacheLookup(pm, &s)) {
+            return 0;
+        }
+        ret = loadFile(pm, -1, src, s.st_size);
+        if (ret == 0 && !pm->relocated) {
+            aoutCacheMiss(pm, &s);
+        }
+        return ret;
     }
-    fclose(fp);
-    fp = NULL;
 
+    char name[PATH_MAX];
+    addroot(name, sizeof(name), src, pm->rootdir);
+
+    if (stat(name, &s) == 0 && S_ISREG(s.st_mode) && aoutCacheLookup(pm, &s)) {
+        return 0;
+    }
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        return errno;
+    }
+    ret = (fstat(fd, &s) == 0) ? loadFile(pm, fd, name, s.st_size) : errno;
+    if (ret == 0 && !pm->relocated) {
+        aoutCacheMiss(pm, &s);
+    }
+    close(fd);
+    return ret;
+}
+
+int load(machine_t *pm, const char *src) {
+    // the new image may be larger than the old one, and its relocation table above it
+    int ret = guestLimit(pm, GUEST_MEMORY_SIZE);
+    if (ret != 0) {
+        return ret;
+    }
+    ret = loadImage(pm, src);
+    if (ret != 0) {
+        // the old image goes on
+        guestLimit(pm, pm->sizeOfVM);
+        return ret;
+    }
+    // runAout() against the new end of the memory
+    pm->runLimit = 0;
+    return 0;
+}
+
+// after the relocation: accesses beyond the memory of the aout fault with the guest pc
+static void limitAout(machine_t *pm) {
+    int ret = guestLimit(pm, pm->sizeOfVM);
+    if (ret != 0) {
+        fprintf(stderr, "/ [WRN] pid %d: Can't limit the memory: %s\n", getpid(), strerror(ret));
+    }
+}
+
+uint32_t startAout(machine_t *pm) {
+    if (!IS_MAGIC_BE(pm->aout.headerBE[0])) {
+        // PDP-11 V6
+        assert(pm->textStart == 0); // vectors not implemented
+        layoutAout(pm);
+
+        assert(pm->aout.header[0] == 0x0107 || pm->aout.header[0] == 0x0108);
+        assert(pm->aout.header[1] > 0);
+        assert(pm->bssEnd <= pm->sizeOfVM - 2);
+        // TODO: validate other fields
+
+#if DEBUG_LOG
+        fprintf(stderr, "/ pid %d: ready\n", getpid());
+        fprintf(stderr, "/ load: %s (root: %s)\n", (const char *)pm->args, pm->rootdir);
+        fprintf(stderr, "/ aout header (PDP-11 V6)\n");
+        fprintf(stderr, "/\n");
+        fprintf(stderr, "/ magic:     0x%04x\n", pm->aout.header[0]);
+        fprintf(stderr, "/ text size: 0x%04x\n", pm->aout.header[1]);
+        fprintf(stderr, "/ data size: 0x%04x\n", pm->aout.header[2]);
+        fprintf(stderr, "/ bss  size: 0x%04x\n", pm->aout.header[3]);
+        fprintf(stderr, "/ symbol:    0x%04x\n", pm->aout.header[4]);
+        fprintf(stderr, "/ entry:     0x%04x\n", pm->aout.header[5]);
+        fprintf(stderr, "/ unused:    0x%04x\n", pm->aout.header[6]);
+        fprintf(stderr, "/ flag:      0x%04x\n", pm->aout.header[7]);
+        fprintf(stderr, "\n");
+#endif
+
+        aoutCacheStore(pm);
+        limitAout(pm);
+
+        // bss
+        guestZero(pm, pm->bssStart, pm->aout.header[3]);
+
+        // stack
+        return pushArgs16(pm, 0);
+    } else {
+        // m68k Minix
+        if (pm->textStart != 0) {
+            // clear vectors
+            memset(&pm->virtualMemory[0], 0, pm->textStart);
+        }
+        layoutAout(pm);
+
+        assert(pm->aout.headerBE[1] == 32);
+        assert(pm->aout.headerBE[2] > 0);
+        assert(pm->bssEnd <= pm->sizeOfVM - 2);
+        assert((pm->brk & 1) == 0);
+        // TODO: validate other fields
+
+#if DEBUG_LOG
+        fprintf(stderr, "/ pid %d: ready\n", getpid());
+        fprintf(stderr, "/ load: %s (root: %s)\n", (const char *)pm->args, pm->rootdir);
+        fprintf(stderr, "/ aout header (m68k Minix)\n");
+        fprintf(stderr, "/\n");
+        fprintf(stderr, "/ magic:     0x%08x\n", ntohl(pm->aout.headerBE[0]));
+        fprintf(stderr, "/ header len:0x%08x\n", pm->aout.headerBE[1]);
+        fprintf(stderr, "/ text size: 0x%08x\n", pm->aout.headerBE[2]);
+        fprintf(stderr, "/ data size: 0x%08x\n", pm->aout.headerBE[3]);
+        fprintf(stderr, "/ bss  size: 0x%08x\n", pm->aout.headerBE[4]);
+        fprintf(stderr, "/ entry:     0x%08x\n", pm->aout.headerBE[5]);
+        fprintf(stderr, "/ total:     0x%08x\n", pm->aout.headerBE[6]);
+        fprintf(stderr, "/ symbol:    0x%08x\n", pm->aout.headerBE[7]);
+        fprintf(stderr, "/\n");
+        fprintf(stderr, "/ text: 0x%08x-0x%08x\n", pm->textStart, pm->textEnd);
+        fprintf(stderr, "/ data: 0x%08x-0x%08x\n", pm->dataStart, pm->dataEnd);
+        fprintf(stderr, "/ bss : 0x%08x-0x%08x\n", pm->bssStart, pm->bssEnd);
+        fprintf(stderr, "/ brk : 0x%08x-\n",       pm->brk);
+        fprintf(stderr, "\n");
+#endif
+
+        relocateAout(pm);
+        aoutCacheStore(pm);
+        limitAout(pm);
+
+        // bss
+        guestZero(pm, pm->bssStart, pm->aout.headerBE[4]);
+
+        // stack
+        return pushArgs(pm, pm->sizeOfVM);
+    }
+}
+
+// -P: the instruction at the pc, before it runs
+static void profileNext(machine_t *pm) {
+    const uint32_t pc = getPC(pm->cpu);
+    if (pc < pm->sizeOfVM - 1) {
+        profileStep(pm, pc);
+    }
+}
+
+// the pc reached pm->runLimit: the end of the memory, or a host signal; false to return
+static bool runEvent(machine_t *pm) {
+    const uint32_t eom = pm->sizeOfVM - 1;
+    // before interrupted is read: a host signal meanwhile clears it again
+    pm->runLimit = eom;
+    if (getPC(pm->cpu) >= eom && !pm->exited) {
+        // rti of a signal handler, before signals are delivered there
+        guestSignalReturn(pm);
+    }
+    if (pm->interrupted) {
+        budgetPoll(pm);
+        if (pm->exited) {
+            return false;
+        }
+        guestSignalPoll(pm);
+    }
+    // the end of the memory of the aout, exec() may have changed it
+    const uint32_t pc = getPC(pm->cpu);
+    if (pc >= eom) {
+#if DEBUG_LOG
+        fprintf(stderr, "/ pid %d: pc:%08x >= eom:%08x\n", getpid(), pc, eom);
+#endif
+        return false;
+    }
+    return true;
+}
+
+// after the instruction at pc, once retired reached the deadline
+static void runSlow(machine_t *pm, uint32_t pc) {
+    pm->deadline = (pm->procs != NULL) ? procStep(pm, pc) : UINT64_MAX;
+    if (pm->profile != NULL) {
+        // each instruction takes this path
+        pm->deadline = 0;
+        profileNext(pm);
+    }
+}
+
+// the first word of a fused sequence at the pc: the instructions run, 0 for the core
+static inline int fuseAt(machine_t *pm, uint32_t pc) {
+#ifdef UU_M68K_MINIX
     return 0;
+#else
+    if (pc & 1) {
+        return 0;
+    }
+    const uint16_t w = guestLoad16LE(pm, pc);
+    switch (w & 0070000) {
+    case 0000000:
+        // tst, tstb
+        return ((w & 0077700) == 0005700) ? fuseCompare(pm, pc, w) : 0;
+    case 0010000:
+        // mov, movb to -(sp)
+        return ((w & 077) == 046) ? fusePushCall(pm, pc, w) : 0;
+    case 0020000:
+        // cmp, cmpb
+        return fuseCompare(pm, pc, w);
+    case 0070000:
+        return ((w & 0177000) == 0077000) ? fuseSob(pm, pc, w) : 0;
+    default:
+        return 0;
+    }
+#endif
+}
+
+// no feature counts instructions: only the pc against runLimit
+static void runPlain(machine_t *pm) {
+    while (1) {
+        const uint32_t pc = getPC(pm->cpu);
+        if (pc >= pm->runLimit) {
+            if (!runEvent(pm)) {
+                break;
+            }
+            continue;
+        }
+        if (fuseAt(pm, pc) != 0) {
+            continue;
+        }
+
+        fetch(pm->cpu);
+        decode(pm->cpu);
+#if 0
+        fprintf(stderr, "/ pid %d: ", getpid());
+        disasm(pm->cpu);
+#endif
+
+        exec(pm->cpu);
+    }
+}
+
+// processes, budget, vtime or profile: retired, and the slow path at the deadline
+static void runCounted(machine_t *pm) {
+    // -P sees each instruction
+    const bool fuse = pm->profile == NULL;
+    while (1) {
+        const uint32_t pc = getPC(pm->cpu);
+        if (pc >= pm->runLimit) {
+            if (!runEvent(pm)) {
+                break;
+            }
+            continue;
+        }
+
+        int n = fuse ? fuseAt(pm, pc) : 0;
+        if (n == 0) {
+            fetch(pm->cpu);
+            decode(pm->cpu);
+            exec(pm->cpu);
+            n = 1;
+        }
+        pm->retired += n;
+        if (pm->retired >= pm->deadline) {
+            runSlow(pm, pc);
+        }
+    }
+}
+
+void runAout(machine_t *pm) {
+    faultMachine = pm;
+    pm->deadline = 0;
+    // the first instruction by runEvent(): the end of this aout, and what came meanwhile
+    pm->runLimit = 0;
+    if (pm->profile != NULL) {
+        profileNext(pm);
+    }
+    // the loop is chosen once, the plain one has no check besides the pc
+    if (pm->procs != NULL || pm->budget != NULL || pm->vtime != NULL || pm->profile != NULL) {
+        runCounted(pm);
+    } else {
+        runPlain(pm);
+    }
+}
+int preloadAout(machine_t *pm, const char *src) {
+    int ret = load(pm, src);
+    if (ret != 0) {
+        return ret;
+    }
+    layoutAout(pm);
+    relocateAout(pm);
+    aoutCacheStore(pm);
+    limitAout(pm);
+    return 0;
+}
+
+void layoutAout(machine_t *pm) {
+    if (!IS_MAGIC_BE(pm->aout.headerBE[0])) {
+        // PDP-11 V6
+        pm->textEnd = pm->textStart + pm->aout.header[1];
+        pm->dataStart = pm->textEnd;
+        if (pm->aout.header[0] == 0x0108) {
+            // 8KB alignment, load() put data there
+            pm->dataStart = (pm->dataStart + 0x1fff) & ~0x1fff;
+        }
+        pm->dataEnd = pm->dataStart + pm->aout.header[2];
+        pm->bssStart = pm->dataEnd;
+        pm->bssEnd = pm->bssStart + pm->aout.header[3];
+        pm->brk = pm->bssEnd;
+    } else {
+        // m68k Minix
+        pm->textEnd = pm->textStart + pm->aout.headerBE[2];
+        if (IS_SEPARATE(pm->aout.headerBE[0])) {
+            pm->dataStart = pm->textEnd;
+            pm->dataEnd = pm->dataStart + pm->aout.headerBE[3];
+        } else {
+            // treat text as data
+            pm->dataStart = pm->textStart;
+            pm->dataEnd = pm->textEnd + pm->aout.headerBE[3];
+        }
+        pm->bssStart = pm->dataEnd;
+        pm->bssEnd = pm->bssStart + pm->aout.headerBE[4];
+        pm->brk = pm->bssEnd;
+    }
+}
+
+void relocateAout(machine_t *pm) {
+    // m68k Minix only, and a cached or prelinked image is relocated already
+    if (!IS_MAGIC_BE(pm->aout.headerBE[0]) || pm->relocated) {
+        return;
+    }
+
+    // load() put the table at the end of data
+    // (it is read ahead of the fixups, which are below dataEnd)
+    const int32_t entry = pm->aout.headerBE[5];
+    const int32_t offset = pm->textStart;
+    uint8_t *paddrs = &pm->virtualMemory[pm->bssStart];
+    int32_t addr = read32(paddrs);
+    paddrs += 4;
+    if (offset != entry && addr != 0) {
+        addr += offset;
+
+        while (1) {
+            assert(addr <= pm->sizeOfVM - 4);
+            assert(addr < pm->dataEnd);
+
+            guestStore32BE(pm, addr, guestLoad32BE(pm, addr) + offset);
+
+            uint8_t B;
+            while((B = *paddrs++) == 1) {
+                addr += 254;
+            }
+            if (B == 0) {
+                break;
+            }
+            assert((B & 1) == 0);
+            addr += B;
+        }
+    }
 }
 
 uint16_t pushArgs16(machine_t *pm, uint16_t stackAddr) {
@@ -225,38 +912,25 @@ uint16_t pushArgs16(machine_t *pm, uint16_t stackAddr) {
     write16(rsp, na);
     rsp += 2;
 
-    const uint8_t *pa = pm->args;
-    uint16_t vaddr = mmuR2V(pm, pbuf);
+    // buf (already aligned)
+    memcpy(pbuf, pm->args, pm->argsbytes);
 
-    // argv & buf
+    // argv
+    const char *pa = (const char *)pm->args;
+    uint16_t vaddr = mmuR2V(pm, pbuf);
     for (int i = 0; i < na; i++) {
         write16(rsp, vaddr);
         rsp += 2;
-        do {
-            *pbuf++ = *pa;
-        } while (*pa++ != '\0');
-        vaddr = mmuR2V(pm, pbuf);
+        size_t len = strlen(pa) + 1;
+        pa += len;
+        vaddr += len;
     }
     // -1
     write16(rsp, 0xffff);
-    rsp += 2;
-
-    // alignment
-    if (vaddr & 1) {
-        *pbuf++ = *pa++;
-        vaddr = mmuR2V(pm, pbuf);
-    }
-    if (vaddr & 2) {
-        *pbuf++ = *pa++;
-        vaddr = mmuR2V(pm, pbuf);
-        *pbuf++ = *pa++;
-        vaddr = mmuR2V(pm, pbuf);
-    }
 
     return vsp;
 }
 
-// TODO: virtual memory page をまたぐと動かない
 uint32_t pushArgs(machine_t *pm, uint32_t stackAddr) {
     // argc, argv[0]...argv[na-1], NULL, envp[0]...envp[ne-1], NULL, buf
     const uint32_t na = pm->argc;
@@ -269,54 +943,108 @@ uint32_t pushArgs(machine_t *pm, uint32_t stackAddr) {
     write32(rsp, na);
     rsp += 4;
 
-    const uint8_t *pa = pm->args;
+    // buf (already aligned)
+    memcpy(pbuf, pm->args, pm->argsbytes);
+
+    const char *pa = (const char *)pm->args;
     uint32_t vaddr = mmuR2V(pm, pbuf);
 
-    // argv & buf
+    // argv
     for (int i = 0; i < na; i++) {
         write32(rsp, vaddr);
         rsp += 4;
-        do {
-            *pbuf++ = *pa;
-        } while (*pa++ != '\0');
-        vaddr = mmuR2V(pm, pbuf);
+        size_t len = strlen(pa) + 1;
+        pa += len;
+        vaddr += len;
     }
     // NULL
     write32(rsp, (uintptr_t)NULL);
     rsp += 4;
 
-    // envp & buf
+    // envp
     for (int i = 0; i < ne; i++) {
         write32(rsp, vaddr);
         rsp += 4;
-        do {
-            *pbuf++ = *pa;
-        } while (*pa++ != '\0');
-        vaddr = mmuR2V(pm, pbuf);
+        size_t len = strlen(pa) + 1;
+        pa += len;
+        vaddr += len;
     }
     // NULL
     write32(rsp, (uintptr_t)NULL);
-    rsp += 4;
 
-    // alignment
-    if (vaddr & 1) {
-        *pbuf++ = *pa++;
-        vaddr = mmuR2V(pm, pbuf);
+    return vsp;
+}
+
+
+// bounded guest memory access
+ssize_t guestStrnlen(machine_t *pm, uint32_t vaddr, size_t max) {
+    if (vaddr >= pm->sizeOfVM) {
+        return -1;
     }
-    if (vaddr & 2) {
-        *pbuf++ = *pa++;
-        vaddr = mmuR2V(pm, pbuf);
-        *pbuf++ = *pa++;
-        vaddr = mmuR2V(pm, pbuf);
+    const size_t avail = pm->sizeOfVM - vaddr;
+    const size_t n = (max < avail) ? max : avail;
+    const uint8_t *p = &pm->virtualMemory[vaddr];
+    const uint8_t *z = memchr(p, '\0', n);
+    if (z != NULL) {
+        return z - p;
     }
+    // no '\0' before the end of the guest
+    return (n == max) ? (ssize_t)max : -1;
+}
 
-    return vsp;
+int guestCopyIn(machine_t *pm, void *dst, uint32_t vaddr, size_t n) {
+    const uint8_t *src = guestSpan(pm, vaddr, n);
+    if (src == NULL) {
+        return EFAULT;
+    }
+    memcpy(dst, src, n);
+    return 0;
+}
+
+int guestCopyOut(machine_t *pm, uint32_t vaddr, const void *src, size_t n) {
+    uint8_t *dst = guestSpan(pm, vaddr, n);
+    if (dst == NULL) {
+        return EFAULT;
+    }
+    guestWillWrite(pm, vaddr, n);
+    memcpy(dst, src, n);
+    return 0;
+}
+
+int guestStrCopyIn(machine_t *pm, char *dst, size_t size, uint32_t vaddr) {
+    ssize_t len = guestStrnlen(pm, vaddr, size);
+    if (len < 0) {
+        return EFAULT;
+    }
+    if ((size_t)len >= size) {
+        return ENAMETOOLONG;
+    }
+    memcpy(dst, mmuV2R(pm, vaddr), len + 1);
+    return 0;
+}
+
+int addrootVirt(machine_t *pm, char *path, size_t len, uint32_t vaddr) {
+    ssize_t n = guestStrnlen(pm, vaddr, len);
+    if (n < 0) {
+        return EFAULT;
+    }
+    const char *src = (const char *)mmuV2R(pm, vaddr);
+    size_t rootlen = 0;
+    if (src[0] == '/') {
+        rootlen = strlen(pm->rootdir);
+    }
+    if (rootlen + n >= len) {
+        return ENAMETOOLONG;
+    }
+    memcpy(path, pm->rootdir, rootlen);
+    memcpy(path + rootlen, src, n + 1);
+    return 0;
 }
 
 
 // for debug
 void coreDump(machine_t *pm, const char *path) {
     FILE *fp = fopen(path, "wb");
-    fwrite(pm->virtualMemory, 1, sizeof(pm->virtualMemory), fp);
+    fwrite(pm->virtualMemory, 1, pm->sizeOfVM, fp);
     fclose(fp);
 }
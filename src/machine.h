@@ -3,9 +3,26 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
 #include <dirent.h>
 #include <arpa/inet.h>
 #include <assert.h>
+#include <signal.h>
+
+#include "replay.h"
+#include "memo.h"
+#include "v6fs.h"
+#include "proc.h"
+#include "aoutcache.h"
+#include "checkpoint.h"
+#include "uuinterp.h"
+#include "profile.h"
+#include "native.h"
+#include "guestsig.h"
+#include "dirty.h"
+#include "vtime.h"
+#include "budget.h"
 
 // for PATH_MAX
 #ifdef __linux__
@@ -22,10 +39,21 @@ typedef struct cpu_tag cpu_t;
 #endif
 
 // aout
+#define MAGIC_PRELINK "UUPL"
 #define MAGIC_BE 0x04000301
 #define IS_MAGIC_BE(X) ((ntohl(X) & 0xff0fffff) == MAGIC_BE)
 #define IS_SEPARATE(X) (     ((X) & 0x00200000) ? 0x20 : 0)
 
+// guest memory at the bottom of the address space, the rest of it and a page on each end are guard pages
+// pages take host memory on the first touch, so the address space is contiguous
+#ifdef UU_M68K_MINIX
+#define GUEST_MEMORY_SIZE 0x1000000
+#define GUEST_ADDRESS_SPACE 0x1000000 // 24-bit address bus
+#else
+#define GUEST_MEMORY_SIZE 0x10000
+#define GUEST_ADDRESS_SPACE 0x10000
+#endif
+
 struct machine_tag {
     // emulate syscall opendir, closedir and readdir
     int dirfd;
@@ -45,9 +73,11 @@ struct machine_tag {
         uint32_t headerBE[8];
     } aout;
 
-    // memory
-    uint8_t virtualMemory[1024 * 1024];
+    // memory: GUEST_MEMORY_SIZE bytes by guestMap(), sizeOfVM by load(),
+    // [mapped, GUEST_ADDRESS_SPACE) faults
+    uint8_t *virtualMemory;
     size_t sizeOfVM;
+    size_t mapped;
     uint32_t textStart;
     uint32_t textEnd;
     uint32_t dataStart;
@@ -55,9 +85,65 @@ struct machine_tag {
     uint32_t bssStart;
     uint32_t bssEnd;
     uint32_t brk;
+    // the image of load() needs no relocation
+    bool relocated;
 
     // cpu
     cpu_t *cpu;
+
+    // syscall record/replay
+    replay_t *replay;
+
+    // result cache of guest runs
+    memo_t *memo;
+
+    // root file system in a disk image, NULL for rootdir
+    v6fs_t *v6fs;
+
+    // guest processes in this host process, NULL for host fork()
+    procs_t *procs;
+
+    // relocated images of exec()
+    aoutcache_t *aoutcache;
+
+    // checkpoint on SIGUSR1, or the one resumed
+    checkpoint_t *checkpoint;
+
+    // instruction sequence counts, NULL if not profiled
+    profile_t *profile;
+
+    // aouts run by the host, NULL for none
+    native_t *native;
+
+    // callbacks of libuuinterp, NULL in uuinterp: exit() of the guest ends runAout() with exitStatus
+    const uu_io_t *io;
+    bool exited;
+    int exitStatus;
+
+    // handlers of guest signals, NULL until signal() of the guest
+    guestsig_t *sigs;
+
+    // instructions retired by this machine, and the time of the guest from them (NULL: host time)
+    uint64_t retired;
+    vtime_t *vtime;
+
+    // retired at which the counted loop of runAout() takes its slow path: the quantum of
+    // the processes, 0 for the next instruction (resched)
+    uint64_t deadline;
+
+    // the pc at or above which runAout() leaves its loop: the end of the memory, 0 for the
+    // next instruction (set by host signals and by a new image with interrupted or exited)
+    volatile uint32_t runLimit;
+
+    // limits of instructions, break() and fork() depth, NULL for none
+    budget_t *budget;
+
+    // the generation of the last write of each page, NULL if not tracked
+    dirty_t *dirty;
+
+    // why runLimit was cleared: set by host signals and by the end of the guest outside
+    // exit() (limits, the last process)
+    volatile sig_atomic_t interrupted;
 };
 #ifndef _MACHINE_T_
 #define _MACHINE_T_
@@ -65,48 +151,210 @@ typedef struct machine_tag machine_t;
 #endif
 
 bool serializeArgvReal(machine_t *pm, int argc, char *argv[]);
-int serializeArgvVirt16(machine_t *pm, uint8_t *argv);
+int serializeArgvVirt16(machine_t *pm, uint16_t vargv);
 int serializeArgvVirt(machine_t *pm, uint32_t vaddr);
 
+// map the guest memory, faults on the guard pages end the run with the guest pc
+int guestMap(machine_t *pm);
+void guestUnmap(machine_t *pm);
+
+// another memory for a process of the guest: [0, brk) and [sp, sizeOfVM) of the current
+// one, zero between, the same pages accessible; NULL and errno on error
+uint8_t *guestClone(machine_t *pm, uint32_t sp);
+// a memory of guestClone() that is not pm->virtualMemory
+void guestRelease(uint8_t *mem);
+
+// the end of the memory (and the stack) of the aout
+size_t guestSize(machine_t *pm);
+
+// [0, size) of the memory accessible, pages above it fault and are dropped
+int guestLimit(machine_t *pm, size_t size);
+
+// zero [vaddr, vaddr+n), whole pages are dropped and zero-filled on the next touch
+void guestZero(machine_t *pm, uint32_t vaddr, size_t n);
+
+// [vaddr, vaddr+size) from the host file at offset, pages shared with the file if aligned
+int guestMapFile(machine_t *pm, int fd, uint32_t vaddr, size_t size, off_t offset);
+
 int load(machine_t *pm, const char *src);
 
+// after load(): text, data, bss and brk, then the relocation for textStart
+void layoutAout(machine_t *pm);
+void relocateAout(machine_t *pm);
+
+// load(), layout and relocation, kept in the aout cache: the next load() of src is a hit
+int preloadAout(machine_t *pm, const char *src);
+
+// after load(): the image ready to run, returns the initial sp
+uint32_t startAout(machine_t *pm);
+
+// after init() of the cpu: until exec() (pc at the end of the memory) or the exit of the guest
+void runAout(machine_t *pm);
+
 uint16_t pushArgs16(machine_t *pm, uint16_t stackAddr);
 uint32_t pushArgs(machine_t *pm, uint32_t stackAddr);
 
+// bounded guest memory access, returns errno (or -1 for guestStrnlen) if it leaves the guest
+ssize_t guestStrnlen(machine_t *pm, uint32_t vaddr, size_t max);
+int guestCopyIn(machine_t *pm, void *dst, uint32_t vaddr, size_t n);
+int guestCopyOut(machine_t *pm, uint32_t vaddr, const void *src, size_t n);
+int guestStrCopyIn(machine_t *pm, char *dst, size_t size, uint32_t vaddr);
+int addrootVirt(machine_t *pm, char *path, size_t len, uint32_t vaddr);
+
 
-// MMU
+// MMU: out of range accesses fault on the guard pages
 static inline uint8_t *mmuV2R(machine_t *pm, uint32_t vaddr) {
-    assert(vaddr <= sizeof(pm->virtualMemory));
+#ifdef UU_M68K_MINIX
+    vaddr &= GUEST_ADDRESS_SPACE - 1;
+#endif
     return &pm->virtualMemory[vaddr];
 }
 static inline uint32_t mmuR2V(machine_t *pm, uint8_t *raddr) {
     ptrdiff_t vaddr = raddr - pm->virtualMemory;
-    assert(vaddr <= sizeof(pm->virtualMemory));
+    assert(vaddr <= GUEST_MEMORY_SIZE);
     return vaddr;
 }
 
+// host span of [vaddr, vaddr+len), NULL if it leaves the guest
+static inline uint8_t *guestSpan(machine_t *pm, uint32_t vaddr, size_t len) {
+    if (vaddr > pm->sizeOfVM || len > pm->sizeOfVM - vaddr) {
+        return NULL;
+    }
+    return &pm->virtualMemory[vaddr];
+}
+
+// host code is about to store into [vaddr, vaddr+n) of the guest
+static inline void guestWillWrite(machine_t *pm, uint32_t vaddr, size_t n) {
+    if (pm->replay != NULL) {
+        replayWillWrite(pm->replay, vaddr, n);
+    }
+    if (pm->dirty != NULL) {
+        dirtyWillWrite(pm, vaddr, n);
+    }
+}
+
+// host byte order: one load and a swap if needed, any alignment
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_LE16(X) __builtin_bswap16(X)
+#define HOST_BE16(X) (X)
+#define HOST_BE32(X) (X)
+#else
+#define HOST_LE16(X) (X)
+#define HOST_BE16(X) __builtin_bswap16(X)
+#define HOST_BE32(X) __builtin_bswap32(X)
+#endif
+
 // 16-bit LE
 static inline uint16_t read16(const uint8_t *p) {
-    return p[0] | (p[1] << 8);
+    uint16_t data;
+    memcpy(&data, p, 2);
+    return HOST_LE16(data);
 }
 static inline void write16(uint8_t *p, uint16_t data) {
-    p[0] = data & 0xff;
-    p[1] = data >> 8;
+    data = HOST_LE16(data);
+    memcpy(p, &data, 2);
 }
 
-// TODO: virtual memory page をまたぐと動かない
+// 16-bit BE
+static inline uint16_t read16BE(const uint8_t *p) {
+    uint16_t data;
+    memcpy(&data, p, 2);
+    return HOST_BE16(data);
+}
+static inline void write16BE(uint8_t *p, uint16_t data) {
+    data = HOST_BE16(data);
+    memcpy(p, &data, 2);
+}
 
 // 32-bit BE
-static inline uint32_t read32(uint8_t *p) {
-    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t data;
+    memcpy(&data, p, 4);
+    return HOST_BE32(data);
 }
 static inline void write32(uint8_t *p, uint32_t data) {
-    p[0] = data >> 24;
-    p[1] = (data >> 16) & 0xff;
-    p[2] = (data >> 8) & 0xff;
-    p[3] = data & 0xff;
+    data = HOST_BE32(data);
+    memcpy(p, &data, 4);
+}
+
+// fields of widths[i] bytes (1, 2 or 4) from values[i], one after another, as a struct of the guest
+static inline void packLE(uint8_t *p, const uint8_t *widths, const uint32_t *values, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (widths[i] == 1) {
+            p[0] = values[i] & 0xff;
+        } else if (widths[i] == 2) {
+            write16(p, values[i] & 0xffff);
+        } else {
+            // PDP-11 long: the high word first
+            write16(p, values[i] >> 16);
+            write16(p + 2, values[i] & 0xffff);
+        }
+        p += widths[i];
+    }
+}
+static inline void packBE(uint8_t *p, const uint8_t *widths, const uint32_t *values, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (widths[i] == 1) {
+            p[0] = values[i] & 0xff;
+        } else if (widths[i] == 2) {
+            write16BE(p, values[i] & 0xffff);
+        } else {
+            write32(p, values[i]);
+        }
+        p += widths[i];
+    }
 }
 
+// typed guest access at vaddr, as mmuV2R(): stores after guestWillWrite() of the caller.
+// An access over the top of the address space wraps byte by byte, as the bus of the cpu.
+static inline bool guestWraps(uint32_t vaddr, size_t n) {
+    return (vaddr & (GUEST_ADDRESS_SPACE - 1)) > GUEST_ADDRESS_SPACE - n;
+}
+static inline uint8_t *guestByte(machine_t *pm, uint32_t vaddr) {
+    return &pm->virtualMemory[vaddr & (GUEST_ADDRESS_SPACE - 1)];
+}
+static inline uint16_t guestLoad16LE(machine_t *pm, uint32_t vaddr) {
+    if (guestWraps(vaddr, 2)) {
+        return *guestByte(pm, vaddr) | (*guestByte(pm, vaddr + 1) << 8);
+    }
+    return read16(mmuV2R(pm, vaddr));
+}
+static inline void guestStore16LE(machine_t *pm, uint32_t vaddr, uint16_t data) {
+    if (guestWraps(vaddr, 2)) {
+        *guestByte(pm, vaddr) = data & 0xff;
+        *guestByte(pm, vaddr + 1) = data >> 8;
+        return;
+    }
+    write16(mmuV2R(pm, vaddr), data);
+}
+static inline uint16_t guestLoad16BE(machine_t *pm, uint32_t vaddr) {
+    if (guestWraps(vaddr, 2)) {
+        return (*guestByte(pm, vaddr) << 8) | *guestByte(pm, vaddr + 1);
+    }
+    return read16BE(mmuV2R(pm, vaddr));
+}
+static inline void guestStore16BE(machine_t *pm, uint32_t vaddr, uint16_t data) {
+    if (guestWraps(vaddr, 2)) {
+        *guestByte(pm, vaddr) = data >> 8;
+        *guestByte(pm, vaddr + 1) = data & 0xff;
+        return;
+    }
+    write16BE(mmuV2R(pm, vaddr), data);
+}
+static inline uint32_t guestLoad32BE(machine_t *pm, uint32_t vaddr) {
+    if (guestWraps(vaddr, 4)) {
+        return ((uint32_t)guestLoad16BE(pm, vaddr) << 16) | guestLoad16BE(pm, (vaddr + 2) & (GUEST_ADDRESS_SPACE - 1));
+    }
+    return read32(mmuV2R(pm, vaddr));
+}
+static inline void guestStore32BE(machine_t *pm, uint32_t vaddr, uint32_t data) {
+    if (guestWraps(vaddr, 4)) {
+        guestStore16BE(pm, vaddr, data >> 16);
+        guestStore16BE(pm, (vaddr + 2) & (GUEST_ADDRESS_SPACE - 1), data & 0xffff);
+        return;
+    }
+    write32(mmuV2R(pm, vaddr), data);
+}
 
 // for debug
 void coreDump(machine_t *pm, const char *path);
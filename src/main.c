@@ -9,6 +9,16 @@
 #define DEBUG_LOG 0
 
 #include "machine.h"
+#include "replay.h"
+#include "memo.h"
+#include "v6fs.h"
+#include "proc.h"
+#include "aoutcache.h"
+#include "prelink.h"
+#include "checkpoint.h"
+#include "zygote.h"
+#include "batch.h"
+#include "multiarch.h"
 #ifdef UU_M68K_MINIX
 #include "../m68k/src/cpu.h"
 #include "syscall.h"
@@ -17,26 +27,177 @@
 #include "syscall.h"
 #endif
 
+#ifdef UU_MULTIARCH
+// main() of multiarch.c picks the arch
+#ifdef UU_M68K_MINIX
+#define main uuMainM68k
+#else
+#define main uuMainPdp11
+#endif
+#endif
+
+static void usage(void) {
+    fprintf(stderr, "Usage: uuinterp [-s] [-P file] [-N file] [-T hz[,epoch]] [-L limits] [-r logdir | -p logdir | -c cachedir] rootdir aout args...\n");
+    fprintf(stderr, "       uuinterp [-r logdir | -p logdir] -i|-I image aout args...\n");
+    fprintf(stderr, "       uuinterp -x out rootdir aout\n");
+    fprintf(stderr, "       uuinterp -k file rootdir aout args...\n");
+    fprintf(stderr, "       uuinterp [-k file] -R file\n");
+    fprintf(stderr, "       uuinterp -Z socket rootdir [aout...]\n");
+    fprintf(stderr, "       uuinterp -z socket aout args...\n");
+    fprintf(stderr, "       uuinterp -b jobs\n");
+    fprintf(stderr, "  -r logdir  record syscalls of the process tree\n");
+    fprintf(stderr, "  -p logdir  replay recorded syscalls without the host\n");
+    fprintf(stderr, "  -c cachedir  reuse the results of identical guest runs\n");
+    fprintf(stderr, "  -i image  V6 disk image as the root, written copy-on-write\n");
+    fprintf(stderr, "  -I image  V6 disk image as the root, read-only\n");
+    fprintf(stderr, "  -s  run guest processes inside this host process\n");
+    fprintf(stderr, "  -P file  add the counts of instruction pairs and triples to file (PDP-11)\n");
+    fprintf(stderr, "  -N file  run cmp, cat and cp by the host for the aouts listed by hash in file\n");
+    fprintf(stderr, "  -T hz[,epoch]  time of the guest from instructions, hz a second, the date from epoch\n");
+    fprintf(stderr, "  -L insn=N,tree=N,brk=N,depth=N  end the guest with 124 over N instructions of a process\n");
+    fprintf(stderr, "        or of the tree, N bytes of break() over the bss, or N nested fork()s, any of them\n");
+    fprintf(stderr, "  -x out  write aout prelinked (relocated, ready to map) to out\n");
+    fprintf(stderr, "  -k file  write a checkpoint of the guest to file on SIGUSR1 (PDP-11)\n");
+    fprintf(stderr, "  -R file  resume the guest from a checkpoint (PDP-11)\n");
+    fprintf(stderr, "  -Z socket  serve runs on socket, each forked from a server with aouts loaded\n");
+    fprintf(stderr, "  -z socket  run on the server at socket with this cwd and stdio\n");
+    fprintf(stderr, "  -b jobs  run the jobs (root cwd expect aout args...) on a worker per core, results as JSON\n");
+}
+
 int main(int argc, char *argv[]) {
     //////////////////////////
     // usage
     //////////////////////////
-    if (argc < 3) {
-        fprintf(stderr, "Usage: uuinterp rootdir aout args...\n");
+    const char *recordDir = NULL;
+    const char *replayDir = NULL;
+    const char *cacheDir = NULL;
+    const char *image = NULL;
+    bool cow = false;
+    bool inProcess = false;
+    const char *prelinkOut = NULL;
+    const char *checkpointOut = NULL;
+    const char *resumeFile = NULL;
+    const char *zygoteServer = NULL;
+    const char *zygoteClient = NULL;
+    const char *batchJobs = NULL;
+    const char *profileFile = NULL;
+    const char *nativeFile = NULL;
+    const char *vtimeSpec = NULL;
+    const char *budgetSpec = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, UU_OPTIONS)) != -1) {
+        switch (opt) {
+        case 'r':
+            recordDir = optarg;
+            break;
+        case 'p':
+            replayDir = optarg;
+            break;
+        case 'c':
+            cacheDir = optarg;
+            break;
+        case 'i':
+        case 'I':
+            image = optarg;
+            cow = (opt == 'i');
+            break;
+        case 's':
+            inProcess = true;
+            break;
+        case 'x':
+            prelinkOut = optarg;
+            break;
+        case 'k':
+            checkpointOut = optarg;
+            break;
+        case 'R':
+            resumeFile = optarg;
+            break;
+        case 'Z':
+            zygoteServer = optarg;
+            break;
+        case 'z':
+            zygoteClient = optarg;
+            break;
+        case 'b':
+            batchJobs = optarg;
+            break;
+        case 'P':
+            profileFile = optarg;
+            break;
+        case 'N':
+            nativeFile = optarg;
+            break;
+        case 'T':
+            vtimeSpec = optarg;
+            break;
+        case 'L':
+            budgetSpec = optarg;
+            break;
+        default:
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    const bool alone = (recordDir != NULL || replayDir != NULL || cacheDir != NULL || image != NULL || inProcess);
+    const int minArgs = (image != NULL || zygoteServer != NULL || zygoteClient != NULL) ? 1 : 2;
+    if ((resumeFile == NULL && batchJobs == NULL && argc - optind < minArgs)
+        || ((resumeFile != NULL || batchJobs != NULL) && argc - optind != 0)
+        || (recordDir != NULL) + (replayDir != NULL) + (cacheDir != NULL) > 1
+        || (image != NULL && cacheDir != NULL)
+        || (inProcess && (recordDir != NULL || replayDir != NULL || cacheDir != NULL || image != NULL))
+        || (prelinkOut != NULL && (alone || checkpointOut != NULL || resumeFile != NULL))
+        || ((checkpointOut != NULL || resumeFile != NULL) && alone)
+        || ((zygoteServer != NULL || zygoteClient != NULL)
+            && (alone || prelinkOut != NULL || checkpointOut != NULL || resumeFile != NULL))
+        || (zygoteServer != NULL && zygoteClient != NULL)
+        || (batchJobs != NULL && (alone || prelinkOut != NULL || checkpointOut != NULL || resumeFile != NULL
+            || zygoteServer != NULL || zygoteClient != NULL))) {
+        usage();
         return EXIT_FAILURE;
     }
+#ifdef UU_M68K_MINIX
+    if (checkpointOut != NULL || resumeFile != NULL) {
+        fprintf(stderr, "/ [ERR] Checkpoints need the PDP-11 build\n");
+        return EXIT_FAILURE;
+    }
+#endif
+    if (zygoteClient != NULL) {
+        int status = zygoteRequest(zygoteClient, argc - optind, argv + optind);
+        return (status < 0) ? EXIT_FAILURE : status;
+    }
 
     machine_t machine;
+    machine.cpu = NULL;
     machine.dirfd = -1;
     machine.dirp = NULL;
     machine.textStart = SIZE_OF_VECTORS;
+    machine.replay = NULL;
+    machine.memo = NULL;
+    machine.v6fs = NULL;
+    machine.procs = NULL;
+    machine.aoutcache = NULL;
+    machine.relocated = false;
+    machine.checkpoint = NULL;
+    machine.io = NULL;
+    machine.profile = NULL;
+    machine.native = NULL;
+    machine.exited = false;
+    machine.sigs = NULL;
+    machine.dirty = NULL;
+    machine.retired = 0;
+    machine.deadline = 0;
+    machine.runLimit = 0;
+    machine.vtime = NULL;
+    machine.budget = NULL;
+    machine.interrupted = 0;
 
     //////////////////////////
     // env
     //////////////////////////
-    // skip vm cmd
-    argv++;
-    argc--;
+    // skip vm cmd and options
+    argv += optind;
+    argc -= optind;
     // cur dir
     {
         char *p = getcwd(machine.curdir, sizeof(machine.curdir));
@@ -45,8 +206,23 @@ int main(int argc, char *argv[]) {
             return EXIT_FAILURE;
         }
     }
-    // root dir
-    {
+    if (resumeFile != NULL) {
+        // root and cwd from the checkpoint
+    } else if (batchJobs != NULL) {
+        // root and cwd by job
+    } else if (image != NULL) {
+        // root in the disk image
+#ifdef UU_M68K_MINIX
+        fprintf(stderr, "/ [ERR] V6 disk image needs the PDP-11 build\n");
+        return EXIT_FAILURE;
+#endif
+        int ret = v6fsMount(&machine, image, cow);
+        if (ret != 0) {
+            fprintf(stderr, "/ [ERR] Can't mount image \"%s\": %s\n", image, strerror(ret));
+            return EXIT_FAILURE;
+        }
+    } else {
+        // root dir
         int ret = chdir(*argv);
         if (ret != 0) {
             fprintf(stderr, "%s: %s\n", strerror(errno), *argv);
@@ -57,167 +233,125 @@ int main(int argc, char *argv[]) {
             fprintf(stderr, "%s\n", strerror(errno));
             return EXIT_FAILURE;
         }
+        // return to cur dir
+        ret = chdir(machine.curdir);
+        if (ret != 0) {
+            fprintf(stderr, "%s: %s\n", strerror(errno), machine.curdir);
+            return EXIT_FAILURE;
+        }
+        argv++;
+        argc--;
     }
-    // return to cur dir
+    // memory
     {
-        int ret = chdir(machine.curdir);
+        int ret = guestMap(&machine);
         if (ret != 0) {
-            fprintf(stderr, "%s: %s\n", strerror(errno), machine.curdir);
+            fprintf(stderr, "/ [ERR] Can't map guest memory: %s\n", strerror(ret));
+            return EXIT_FAILURE;
+        }
+        ret = aoutCacheInit(&machine);
+        if (ret != 0) {
+            fprintf(stderr, "/ [ERR] Can't init aout cache: %s\n", strerror(ret));
             return EXIT_FAILURE;
         }
     }
-    argv++;
-    argc--;
+    int ret;
+    uint32_t sp;
+    if (checkpointOut != NULL && (ret = checkpointArm(&machine, checkpointOut))) {
+        fprintf(stderr, "/ [ERR] Can't checkpoint: %s\n", strerror(ret));
+        return EXIT_FAILURE;
+    }
+    if (profileFile != NULL && (ret = profileOpen(&machine, profileFile))) {
+        fprintf(stderr, "/ [ERR] Can't profile to \"%s\": %s\n", profileFile, strerror(ret));
+        return EXIT_FAILURE;
+    }
+    if (nativeFile != NULL && (ret = nativeOpen(&machine, nativeFile))) {
+        fprintf(stderr, "/ [ERR] Can't read \"%s\": %s\n", nativeFile, strerror(ret));
+        return EXIT_FAILURE;
+    }
+    if (vtimeSpec != NULL && (ret = vtimeOpen(&machine, vtimeSpec))) {
+        fprintf(stderr, "/ [ERR] Bad virtual time \"%s\": %s\n", vtimeSpec, strerror(ret));
+        return EXIT_FAILURE;
+    }
+    if (budgetSpec != NULL && (ret = budgetOpen(&machine, budgetSpec))) {
+        fprintf(stderr, "/ [ERR] Bad limits \"%s\": %s\n", budgetSpec, strerror(ret));
+        return EXIT_FAILURE;
+    }
+    if (resumeFile != NULL) {
+        if ((ret = checkpointLoad(&machine, resumeFile))) {
+            fprintf(stderr, "/ [ERR] Can't resume \"%s\": %s\n", resumeFile, strerror(ret));
+            return EXIT_FAILURE;
+        }
+        // registers by checkpointCpu()
+        sp = 0;
+        goto resumed;
+    }
     // aout
-    if (!serializeArgvReal(&machine, argc, argv)) {
+    if (batchJobs != NULL) {
+        // returns in the run of a job
+        if ((ret = batchRun(&machine, batchJobs))) {
+            fprintf(stderr, "/ [ERR] Can't run jobs \"%s\": %s\n", batchJobs, strerror(ret));
+            return EXIT_FAILURE;
+        }
+    } else if (zygoteServer != NULL) {
+        // returns in a forked run, with the args of the request
+        if ((ret = zygoteServe(&machine, zygoteServer, argc, argv))) {
+            fprintf(stderr, "/ [ERR] Can't serve on \"%s\": %s\n", zygoteServer, strerror(ret));
+            return EXIT_FAILURE;
+        }
+    } else if (!serializeArgvReal(&machine, argc, argv)) {
         fprintf(stderr, "/ [ERR] Too big argv\n");
         return EXIT_FAILURE;
     }
-    int ret;
-    if ((ret = load(&machine, (const char *)machine.args))) {
+    if (cacheDir != NULL && (ret = memoOpen(&machine, cacheDir))) {
+        fprintf(stderr, "/ [ERR] Can't open cache \"%s\": %s\n", cacheDir, strerror(ret));
+        return EXIT_FAILURE;
+    }
+    if (recordDir != NULL || replayDir != NULL) {
+        const char *dir = (recordDir != NULL) ? recordDir : replayDir;
+        if ((ret = replayOpen(&machine, dir, recordDir != NULL))) {
+            fprintf(stderr, "/ [ERR] Can't open log \"%s\": %s\n", dir, strerror(ret));
+            return EXIT_FAILURE;
+        }
+        ret = replayLoad(&machine, (const char *)machine.args);
+    } else {
+        nativeExec(&machine, (const char *)machine.args);
+        ret = load(&machine, (const char *)machine.args);
+    }
+    if (ret) {
         fprintf(stderr, "/ [ERR] Can't load file \"%s\": %s\n", (const char *)machine.args, strerror(ret));
         return EXIT_FAILURE;
     }
+    if (inProcess && (ret = procInit(&machine))) {
+        fprintf(stderr, "/ [ERR] Can't run processes in process: %s\n", strerror(ret));
+        return EXIT_FAILURE;
+    }
 
     //////////////////////////
     // memory
     //////////////////////////
-    uint32_t sp;
     reloaded:
-    if (!IS_MAGIC_BE(machine.aout.headerBE[0])) {
-        // PDP-11 V6
-        machine.sizeOfVM = (sizeof(machine.virtualMemory) < 0x10000) ? sizeof(machine.virtualMemory) : 0x10000;
-
-        assert(machine.textStart == 0); // vectors not implemented
-        machine.textEnd = machine.textStart + machine.aout.header[1];
-        machine.dataStart = machine.textEnd;
-        if (machine.aout.header[0] == 0x0108) {
-            // 8KB alignment
-            machine.dataStart = (machine.dataStart + 0x1fff) & ~0x1fff;
-            memmove(&machine.virtualMemory[machine.dataStart], &machine.virtualMemory[machine.textEnd], machine.sizeOfVM-machine.dataStart);
-        }
-        machine.dataEnd = machine.dataStart + machine.aout.header[2];
-        machine.bssStart = machine.dataEnd;
-        machine.bssEnd = machine.bssStart + machine.aout.header[3];
-        machine.brk = machine.bssEnd;
-
-        assert(machine.aout.header[0] == 0x0107 || machine.aout.header[0] == 0x0108);
-        assert(machine.aout.header[1] > 0);
-        assert(machine.bssEnd <= machine.sizeOfVM - 2);
-        // TODO: validate other fields
-
-#if DEBUG_LOG
-        fprintf(stderr, "/ pid %d: ready\n", getpid());
-        fprintf(stderr, "/ load: %s (root: %s)\n", (const char *)machine.args, machine.rootdir);
-        fprintf(stderr, "/ aout header (PDP-11 V6)\n");
-        fprintf(stderr, "/\n");
-        fprintf(stderr, "/ magic:     0x%04x\n", machine.aout.header[0]);
-        fprintf(stderr, "/ text size: 0x%04x\n", machine.aout.header[1]);
-        fprintf(stderr, "/ data size: 0x%04x\n", machine.aout.header[2]);
-        fprintf(stderr, "/ bss  size: 0x%04x\n", machine.aout.header[3]);
-        fprintf(stderr, "/ symbol:    0x%04x\n", machine.aout.header[4]);
-        fprintf(stderr, "/ entry:     0x%04x\n", machine.aout.header[5]);
-        fprintf(stderr, "/ unused:    0x%04x\n", machine.aout.header[6]);
-        fprintf(stderr, "/ flag:      0x%04x\n", machine.aout.header[7]);
-        fprintf(stderr, "\n");
-#endif
-
-        // bss
-        memset(&machine.virtualMemory[machine.bssStart], 0, machine.aout.header[3]);
-
-        // stack
-        sp = pushArgs16(&machine, 0);
-    } else {
-        // m68k Minix
-        machine.sizeOfVM = sizeof(machine.virtualMemory);
-
-        if (machine.textStart != 0) {
-            // clear vectors
-            memset(&machine.virtualMemory[0], 0, machine.textStart);
-        }
-        machine.textEnd = machine.textStart + machine.aout.headerBE[2];
-        if (IS_SEPARATE(machine.aout.headerBE[0])) {
-            machine.dataStart = machine.textEnd;
-            machine.dataEnd = machine.dataStart + machine.aout.headerBE[3];
-        } else {
-            // treat text as data
-            machine.dataStart = machine.textStart;
-            machine.dataEnd = machine.textEnd + machine.aout.headerBE[3];
-        }
-        machine.bssStart = machine.dataEnd;
-        machine.bssEnd = machine.bssStart + machine.aout.headerBE[4];
-        machine.brk = machine.bssEnd;
-
-        assert(machine.aout.headerBE[1] == 32);
-        assert(machine.aout.headerBE[2] > 0);
-        assert(machine.bssEnd <= machine.sizeOfVM - 2);
-        assert((machine.brk & 1) == 0);
-        // TODO: validate other fields
-
-#if DEBUG_LOG
-        fprintf(stderr, "/ pid %d: ready\n", getpid());
-        fprintf(stderr, "/ load: %s (root: %s)\n", (const char *)machine.args, machine.rootdir);
-        fprintf(stderr, "/ aout header (m68k Minix)\n");
-        fprintf(stderr, "/\n");
-        fprintf(stderr, "/ magic:     0x%08x\n", ntohl(machine.aout.headerBE[0]));
-        fprintf(stderr, "/ header len:0x%08x\n", machine.aout.headerBE[1]);
-        fprintf(stderr, "/ text size: 0x%08x\n", machine.aout.headerBE[2]);
-        fprintf(stderr, "/ data size: 0x%08x\n", machine.aout.headerBE[3]);
-        fprintf(stderr, "/ bss  size: 0x%08x\n", machine.aout.headerBE[4]);
-        fprintf(stderr, "/ entry:     0x%08x\n", machine.aout.headerBE[5]);
-        fprintf(stderr, "/ total:     0x%08x\n", machine.aout.headerBE[6]);
-        fprintf(stderr, "/ symbol:    0x%08x\n", machine.aout.headerBE[7]);
-        fprintf(stderr, "/\n");
-        fprintf(stderr, "/ text: 0x%08x-0x%08x\n", machine.textStart, machine.textEnd);
-        fprintf(stderr, "/ data: 0x%08x-0x%08x\n", machine.dataStart, machine.dataEnd);
-        fprintf(stderr, "/ bss : 0x%08x-0x%08x\n", machine.bssStart, machine.bssEnd);
-        fprintf(stderr, "/ brk : 0x%08x-\n",       machine.brk);
-        fprintf(stderr, "\n");
-#endif
-
-        // skip symbol table and move relocate table
-        size_t relocSize = machine.sizeOfVM - (machine.bssStart + machine.aout.headerBE[7]);
-        size_t dstSize = machine.sizeOfVM - machine.brk;
-        relocSize = (dstSize < relocSize) ? dstSize : relocSize;
-        memmove(&machine.virtualMemory[machine.brk], &machine.virtualMemory[machine.bssStart + machine.aout.headerBE[7]], relocSize);
-        // bss
-        memset(&machine.virtualMemory[machine.bssStart], 0, machine.aout.headerBE[4]);
-
-        // relocate
-        const int32_t entry = machine.aout.headerBE[5];
-        const int32_t offset = machine.textStart;
-        uint8_t *paddrs = &machine.virtualMemory[machine.brk];
-        int32_t addr = ntohl(*(uint32_t *)paddrs);
-        paddrs += 4;
-        if (offset != entry && addr != 0) {
-            addr += offset;
+    sp = startAout(&machine);
 
-            while (1) {
-                assert(addr <= machine.sizeOfVM - 4);
-                assert(addr < machine.dataEnd);
-
-                int32_t opland = ntohl(*(int32_t *)&machine.virtualMemory[addr]);
-                *(int32_t *)&machine.virtualMemory[addr] = htonl(opland + offset);
-
-                uint8_t B;
-                while((B = *paddrs++) == 1) {
-                    addr += 254;
-                }
-                if (B == 0) {
-                    break;
-                }
-                assert((B & 1) == 0);
-                addr += B;
-            }
+    // converter: the image is ready to map
+    if (prelinkOut != NULL) {
+        int ret = prelinkWrite(&machine, (const char *)machine.args, prelinkOut);
+        if (ret != 0) {
+            fprintf(stderr, "/ [ERR] Can't write \"%s\": %s\n", prelinkOut, strerror(ret));
+            return EXIT_FAILURE;
         }
+        return EXIT_SUCCESS;
+    }
 
-        // stack
-        sp = pushArgs(&machine, machine.sizeOfVM);
+    // a cached run of the same image ends here
+    if (machine.memo != NULL) {
+        memoStart(&machine);
     }
 
     //////////////////////////
     // cpu
     //////////////////////////
+    resumed:;
     cpu_t cpu;
     machine.cpu = &cpu;
 
@@ -229,8 +363,11 @@ int main(int argc, char *argv[]) {
         &machine,
         (mmu_v2r_t)mmuV2R,
         (mmu_r2v_t)mmuR2V,
-        (syscall_t)mysyscall16,
+        (syscall_t)((machine.replay != NULL) ? replaySyscall : mysyscall16),
         sp, machine.textStart);
+    if (machine.checkpoint != NULL) {
+        checkpointCpu(&machine);
+    }
 #if DEBUG_LOG
     {
 #if 0
@@ -293,27 +430,7 @@ int main(int argc, char *argv[]) {
     }
 #endif
 
-    const uint32_t eom = machine.sizeOfVM - 1;
-    while (1) {
-        const uint32_t pc = getPC(&cpu);
-        // TODO: debug
-        //assert(pc < machine.textEnd);
-        if (pc >= eom) {
-#if DEBUG_LOG
-            fprintf(stderr, "/ pid %d: pc:%08x >= eom:%08x\n", getpid(), pc, eom);
-#endif
-            break;
-        }
-
-        fetch(&cpu);
-        decode(&cpu);
-#if 0
-        fprintf(stderr, "/ pid %d: ", getpid());
-        disasm(&cpu);
-#endif
-
-        exec(&cpu);
-    }
+    runAout(&machine);
     goto reloaded;
 
     // never reach
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// RFC 1321, to compare with md5sum
+typedef struct {
+    uint32_t state[4];
+    uint64_t bytes;
+    uint8_t block[64];
+} md5_t;
+
+void md5Init(md5_t *pc);
+void md5Update(md5_t *pc, const void *src, size_t len);
+void md5Final(md5_t *pc, uint8_t digest[16]);
@@ -0,0 +1,534 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <inttypes.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define DEBUG_LOG 0
+
+#include "memo.h"
+#include "machine.h"
+#include "util.h"
+
+/* cache dir:
+  <key>     manifest, appended by each stored run of the image:
+              R <result> <ninputs>
+              I <hash or -> <path>
+              ...
+  <result>  status, then the outputs of the run:
+              'o' fd len bytes          stdout/stderr
+              'f' pathlen path mode len bytes
+              'u' pathlen path          removed
+*/
+
+#define MEMO_MAX_FDS 32
+
+typedef struct {
+    char *path;
+    uint64_t hash;
+    bool exists;
+} memo_input_t;
+
+struct memo_tag {
+    char dir[PATH_MAX - 64]; // room for "/<hash>.r.<pid>"
+
+    // the image being tracked
+    bool active;
+    uint64_t key;
+    uint32_t fds;  // opened by the image
+    uint32_t wfds; // opened by the image for writing
+
+    memo_input_t *inputs;
+    int ninputs;
+    char **outputs;
+    int noutputs;
+
+    // stdout and stderr
+    uint8_t *out;
+    size_t outLen;
+    size_t outSize;
+};
+
+static void *xrealloc(void *p, size_t size) {
+    p = realloc(p, size);
+    assert(p != NULL);
+    return p;
+}
+
+static void reset(memo_t *pc) {
+    for (int i = 0; i < pc->ninputs; i++) {
+        free(pc->inputs[i].path);
+    }
+    for (int i = 0; i < pc->noutputs; i++) {
+        free(pc->outputs[i]);
+    }
+    pc->ninputs = 0;
+    pc->noutputs = 0;
+    pc->outLen = 0;
+    pc->fds = 0;
+    pc->wfds = 0;
+    pc->active = false;
+}
+
+// hash of the host file, false if it doesn't exist
+static bool hashFile(const char *path, uint64_t *phash) {
+    struct stat s;
+    if (stat(path, &s) != 0) {
+        return false;
+    }
+    uint64_t h = HASH64_INIT;
+    if (!S_ISREG(s.st_mode)) {
+        *phash = hash64(h, &s.st_mode, sizeof(s.st_mode));
+        return true;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    uint8_t buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        h = hash64(h, buf, n);
+    }
+    close(fd);
+    *phash = h;
+    return true;
+}
+
+static bool isOutput(memo_t *pc, const char *path) {
+    for (int i = 0; i < pc->noutputs; i++) {
+        if (strcmp(pc->outputs[i], path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void addInput(machine_t *pm, const char *path) {
+    memo_t *pc = pm->memo;
+    // written by the image itself, or already known
+    if (isOutput(pc, path)) {
+        return;
+    }
+    for (int i = 0; i < pc->ninputs; i++) {
+        if (strcmp(pc->inputs[i].path, path) == 0) {
+            return;
+        }
+    }
+
+    char name[PATH_MAX];
+    if (!addroot(name, sizeof(name), path, pm->rootdir)) {
+        memoTaint(pm, "path");
+        return;
+    }
+    pc->inputs = xrealloc(pc->inputs, (pc->ninputs + 1) * sizeof(memo_input_t));
+    memo_input_t *pi = &pc->inputs[pc->ninputs++];
+    pi->path = strdup(path);
+    pi->hash = 0;
+    pi->exists = hashFile(name, &pi->hash);
+}
+
+int memoOpen(machine_t *pm, const char *dir) {
+    memo_t *pc = calloc(1, sizeof(memo_t));
+    if (pc == NULL) {
+        return ENOMEM;
+    }
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        int e = errno;
+        free(pc);
+        return e;
+    }
+    // absolute, the guest may chdir
+    int n = (dir[0] == '/')
+        ? snprintf(pc->dir, sizeof(pc->dir), "%s", dir)
+        : snprintf(pc->dir, sizeof(pc->dir), "%s/%s", pm->curdir, dir);
+    if (n < 0 || n >= sizeof(pc->dir)) {
+        free(pc);
+        return ENAMETOOLONG;
+    }
+    pm->memo = pc;
+    return 0;
+}
+
+
+//////////////////////////
+// hit
+//////////////////////////
+// replay the outputs of the result, false if it's broken
+static bool replayResult(machine_t *pm, const char *result, int *pstatus) {
+    int fd = open(result, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat s;
+    uint8_t *blob = NULL;
+    if (fstat(fd, &s) != 0 || (blob = malloc(s.st_size + 1)) == NULL || !readAll(fd, blob, s.st_size)) {
+        free(blob);
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    // validate all before touching anything
+    const uint8_t *end = blob + s.st_size;
+    for (int pass = 0; pass < 2; pass++) {
+        const uint8_t *p = blob;
+        int32_t status;
+        if (end - p < sizeof(status)) {
+            free(blob);
+            return false;
+        }
+        memcpy(&status, p, sizeof(status));
+        p += sizeof(status);
+        while (p < end) {
+            uint8_t type = *p++;
+            uint16_t pathlen = 0;
+            uint32_t mode = 0, len = 0;
+            char path[PATH_MAX], name[PATH_MAX];
+            if (type == 'o') {
+                if (end - p < 1 + sizeof(len)) break;
+                uint8_t ofd = *p++;
+                memcpy(&len, p, sizeof(len));
+                p += sizeof(len);
+                if (end - p < len) break;
+                if (pass == 1) writeAll(ofd, p, len);
+                p += len;
+                continue;
+            }
+            if (end - p < sizeof(pathlen)) break;
+            memcpy(&pathlen, p, sizeof(pathlen));
+            p += sizeof(pathlen);
+            if (pathlen >= sizeof(path) || end - p < pathlen) break;
+            memcpy(path, p, pathlen);
+            path[pathlen] = '\0';
+            p += pathlen;
+            if (!addroot(name, sizeof(name), path, pm->rootdir)) break;
+            if (type == 'u') {
+                if (pass == 1) unlink(name);
+                continue;
+            }
+            if (type != 'f' || end - p < sizeof(mode) + sizeof(len)) break;
+            memcpy(&mode, p, sizeof(mode));
+            p += sizeof(mode);
+            memcpy(&len, p, sizeof(len));
+            p += sizeof(len);
+            if (end - p < len) break;
+            if (pass == 1) {
+                int ofd = open(name, O_WRONLY | O_CREAT | O_TRUNC, mode);
+                if (ofd >= 0) {
+                    writeAll(ofd, p, len);
+                    fchmod(ofd, mode);
+                    close(ofd);
+                }
+            }
+            p += len;
+        }
+        if (p != end) {
+            free(blob);
+            return false;
+        }
+        *pstatus = status;
+    }
+    free(blob);
+    return true;
+}
+
+void memoStart(machine_t *pm) {
+    memo_t *pc = pm->memo;
+    if (pc == NULL) {
+        return;
+    }
+    reset(pc);
+
+    // key: image, args and cwd
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        return;
+    }
+    uint64_t h = HASH64_INIT;
+    h = hash64(h, &pm->aout, sizeof(pm->aout));
+    h = hash64(h, mmuV2R(pm, pm->textStart), pm->dataEnd - pm->textStart);
+    h = hash64(h, &pm->argc, sizeof(pm->argc));
+    h = hash64(h, &pm->envc, sizeof(pm->envc));
+    h = hash64(h, pm->args, pm->argsbytes);
+    h = hash64(h, cwd, strlen(cwd));
+    pc->key = h;
+    pc->active = true;
+
+    char manifest[PATH_MAX];
+    snprintf(manifest, sizeof(manifest), "%s/%016" PRIx64, pc->dir, pc->key);
+    FILE *fp = fopen(manifest, "r");
+    if (fp == NULL) {
+        return;
+    }
+
+    // the first entry whose inputs are all unchanged
+    char line[PATH_MAX + 32];
+    char result[32];
+    int remaining = 0;
+    bool match = false;
+    bool found = false;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == 'R') {
+            if (match && remaining == 0) {
+                found = true;
+                break;
+            }
+            match = (sscanf(line, "R %31s %d", result, &remaining) == 2);
+        } else if (line[0] == 'I' && match && remaining > 0) {
+            char hex[32];
+            int off = 0;
+            if (sscanf(line, "I %31s %n", hex, &off) != 1 || off == 0) {
+                match = false;
+                continue;
+            }
+            char name[PATH_MAX];
+            if (!addroot(name, sizeof(name), &line[off], pm->rootdir)) {
+                match = false;
+                continue;
+            }
+            uint64_t hash;
+            bool exists = hashFile(name, &hash);
+            if (strcmp(hex, "-") == 0) {
+                match = !exists;
+            } else {
+                match = exists && (strtoull(hex, NULL, 16) == hash);
+            }
+            remaining--;
+        }
+    }
+    fclose(fp);
+    if (!found && !(match && remaining == 0)) {
+        return;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", pc->dir, result);
+    int status;
+    if (replayResult(pm, path, &status)) {
+#if DEBUG_LOG
+        fprintf(stderr, "/ [DBG] memo hit: %s -> %s\n", manifest, result);
+#endif
+        _exit(status);
+    }
+}
+
+
+//////////////////////////
+// track
+//////////////////////////
+void memoTaint(machine_t *pm, const char *why) {
+    memo_t *pc = pm->memo;
+    if (pc == NULL || !pc->active) {
+        return;
+    }
+#if DEBUG_LOG
+    fprintf(stderr, "/ [DBG] memo: not cacheable: %s\n", why);
+#endif
+    reset(pc);
+}
+
+void memoInput(machine_t *pm, const char *path, int flags, int fd) {
+    memo_t *pc = pm->memo;
+    if (pc == NULL || !pc->active) {
+        return;
+    }
+    if (fd >= MEMO_MAX_FDS) {
+        memoTaint(pm, "too many fds");
+        return;
+    }
+    if ((flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_TRUNC))) {
+        if (!(flags & O_TRUNC)) {
+            // the old contents may still be seen
+            addInput(pm, path);
+        }
+        memoOutput(pm, path);
+        if (fd >= 0) {
+            pc->fds |= 1u << fd;
+            pc->wfds |= 1u << fd;
+        }
+        return;
+    }
+    if (fd >= 0) {
+        struct stat s;
+        if (fstat(fd, &s) == 0 && S_ISDIR(s.st_mode)) {
+            memoTaint(pm, "directory");
+            return;
+        }
+        pc->fds |= 1u << fd;
+    }
+    addInput(pm, path);
+}
+
+void memoLookup(machine_t *pm, const char *path) {
+    memo_t *pc = pm->memo;
+    if (pc == NULL || !pc->active) {
+        return;
+    }
+    addInput(pm, path);
+}
+
+void memoOutput(machine_t *pm, const char *path) {
+    memo_t *pc = pm->memo;
+    if (pc == NULL || !pc->active || isOutput(pc, path)) {
+        return;
+    }
+    pc->outputs = xrealloc(pc->outputs, (pc->noutputs + 1) * sizeof(char *));
+    pc->outputs[pc->noutputs++] = strdup(path);
+}
+
+void memoRead(machine_t *pm, int fd) {
+    memo_t *pc = pm->memo;
+    if (pc == NULL || !pc->active) {
+        return;
+    }
+    if (fd < 0 || fd >= MEMO_MAX_FDS || !(pc->fds & (1u << fd))) {
+        memoTaint(pm, "read from an inherited fd");
+    }
+}
+
+void memoWrite(machine_t *pm, int fd, const void *buf, ssize_t n) {
+    memo_t *pc = pm->memo;
+    if (pc == NULL || !pc->active || n <= 0) {
+        return;
+    }
+    if (fd >= 0 && fd < MEMO_MAX_FDS && (pc->wfds & (1u << fd))) {
+        // the file is stored at exit
+        return;
+    }
+    if (fd != STDOUT_FILENO && fd != STDERR_FILENO) {
+        memoTaint(pm, "write to an inherited fd");
+        return;
+    }
+
+    uint32_t len = n;
+    size_t need = pc->outLen + 2 + sizeof(len) + len;
+    if (need > pc->outSize) {
+        pc->outSize = (need < 4096) ? 4096 : need * 2;
+        pc->out = xrealloc(pc->out, pc->outSize);
+    }
+    uint8_t *p = pc->out + pc->outLen;
+    *p++ = 'o';
+    *p++ = fd;
+    memcpy(p, &len, sizeof(len));
+    p += sizeof(len);
+    memcpy(p, buf, len);
+    pc->outLen = need;
+}
+
+void memoClose(machine_t *pm, int fd) {
+    memo_t *pc = pm->memo;
+    if (pc == NULL || !pc->active || fd < 0 || fd >= MEMO_MAX_FDS) {
+        return;
+    }
+    pc->fds &= ~(1u << fd);
+    pc->wfds &= ~(1u << fd);
+}
+
+
+//////////////////////////
+// store
+//////////////////////////
+static bool appendFile(FILE *fp, const char *path, const char *name) {
+    uint16_t pathlen = strlen(path);
+    struct stat s;
+    if (stat(name, &s) != 0) {
+        fputc('u', fp);
+        fwrite(&pathlen, sizeof(pathlen), 1, fp);
+        fwrite(path, 1, pathlen, fp);
+        return true;
+    }
+    if (!S_ISREG(s.st_mode)) {
+        return false;
+    }
+    FILE *in = fopen(name, "rb");
+    if (in == NULL) {
+        return false;
+    }
+    uint32_t mode = s.st_mode & 07777;
+    uint32_t len = s.st_size;
+    fputc('f', fp);
+    fwrite(&pathlen, sizeof(pathlen), 1, fp);
+    fwrite(path, 1, pathlen, fp);
+    fwrite(&mode, sizeof(mode), 1, fp);
+    fwrite(&len, sizeof(len), 1, fp);
+    uint8_t buf[65536];
+    size_t n, total = 0;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        fwrite(buf, 1, n, fp);
+        total += n;
+    }
+    fclose(in);
+    return total == len;
+}
+
+void memoExit(machine_t *pm, int status) {
+    memo_t *pc = pm->memo;
+    if (pc == NULL || !pc->active) {
+        return;
+    }
+
+    // result: key and inputs
+    uint64_t h = pc->key;
+    for (int i = 0; i < pc->ninputs; i++) {
+        h = hash64(h, pc->inputs[i].path, strlen(pc->inputs[i].path) + 1);
+        h = hash64(h, &pc->inputs[i].hash, sizeof(pc->inputs[i].hash));
+        h = hash64(h, &pc->inputs[i].exists, sizeof(pc->inputs[i].exists));
+    }
+    char result[PATH_MAX], tmp[PATH_MAX];
+    snprintf(result, sizeof(result), "%s/%016" PRIx64 ".r", pc->dir, h);
+    snprintf(tmp, sizeof(tmp), "%s/%016" PRIx64 ".r.%d", pc->dir, h, (int)getpid());
+
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        return;
+    }
+    int32_t status32 = status;
+    fwrite(&status32, sizeof(status32), 1, fp);
+    fwrite(pc->out, 1, pc->outLen, fp);
+    bool ok = true;
+    for (int i = 0; i < pc->noutputs && ok; i++) {
+        char name[PATH_MAX];
+        ok = addroot(name, sizeof(name), pc->outputs[i], pm->rootdir) && appendFile(fp, pc->outputs[i], name);
+    }
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok || rename(tmp, result) != 0) {
+        unlink(tmp);
+        return;
+    }
+
+    // manifest, one write per entry
+    size_t size = 64;
+    for (int i = 0; i < pc->ninputs; i++) {
+        size += strlen(pc->inputs[i].path) + 24;
+    }
+    char *entry = malloc(size);
+    if (entry == NULL) {
+        return;
+    }
+    size_t n = snprintf(entry, size, "R %016" PRIx64 ".r %d\n", h, pc->ninputs);
+    for (int i = 0; i < pc->ninputs; i++) {
+        if (pc->inputs[i].exists) {
+            n += snprintf(entry + n, size - n, "I %016" PRIx64 " %s\n", pc->inputs[i].hash, pc->inputs[i].path);
+        } else {
+            n += snprintf(entry + n, size - n, "I - %s\n", pc->inputs[i].path);
+        }
+    }
+    char manifest[PATH_MAX];
+    snprintf(manifest, sizeof(manifest), "%s/%016" PRIx64, pc->dir, pc->key);
+    int fd = open(manifest, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd >= 0) {
+        writeAll(fd, (const uint8_t *)entry, n);
+        close(fd);
+    }
+    free(entry);
+    reset(pc);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+struct memo_tag;
+#ifndef _MEMO_T_
+#define _MEMO_T_
+typedef struct memo_tag memo_t;
+#endif
+
+// result cache of whole guest runs, from exec to exit
+int memoOpen(machine_t *pm, const char *dir);
+
+// the new image is ready to run: replay the cached result (never returns) or start to track it
+void memoStart(machine_t *pm);
+
+// what the image does, in guest paths and guest fds
+void memoInput(machine_t *pm, const char *path, int flags, int fd);
+void memoLookup(machine_t *pm, const char *path);
+void memoOutput(machine_t *pm, const char *path);
+void memoRead(machine_t *pm, int fd);
+void memoWrite(machine_t *pm, int fd, const void *buf, ssize_t n);
+void memoClose(machine_t *pm, int fd);
+void memoTaint(machine_t *pm, const char *why);
+
+// store the result of the run
+void memoExit(machine_t *pm, int status);
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#define DEBUG_LOG 0
+
+#include "multiarch.h"
+#include "machine.h"
+#include "prelink.h"
+#include "checkpoint.h"
+
+// main() of uuinterp for both archs (make multi): the arch by the aout, the checkpoint or
+// the first job, then main() of the arch with the same args. exec() of the guest stays
+// in the arch of the run.
+
+typedef int (*arch_main_t)(int argc, char *argv[]);
+
+// by the header of an aout, a prelinked aout or a checkpoint; NULL if it can't be read
+static arch_main_t archOfFile(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    union {
+        uint32_t headerBE[8];
+        prelink_header_t prelink;
+        checkpoint_header_t checkpoint;
+    } h;
+    ssize_t n = read(fd, &h, sizeof(h));
+    close(fd);
+    if (n >= (ssize_t)sizeof(h.prelink) && memcmp(h.prelink.magic, MAGIC_PRELINK, 4) == 0) {
+        return (h.prelink.arch == PRELINK_M68K_MINIX) ? uuMainM68k : uuMainPdp11;
+    }
+    if (n >= (ssize_t)sizeof(h.checkpoint) && memcmp(h.checkpoint.magic, MAGIC_CHECKPOINT, 4) == 0) {
+        return IS_MAGIC_BE(h.checkpoint.aout[0]) ? uuMainM68k : uuMainPdp11;
+    }
+    if (n >= (ssize_t)sizeof(h.headerBE[0]) && IS_MAGIC_BE(h.headerBE[0])) {
+        return uuMainM68k;
+    }
+    return (n >= 2) ? uuMainPdp11 : NULL;
+}
+
+// the aout of the guest (from the root if absolute, else from cwd)
+static arch_main_t archOfAout(const char *root, const char *cwd, const char *aout) {
+    char path[PATH_MAX * 2];
+    int n = (aout[0] == '/')
+        ? snprintf(path, sizeof(path), "%s%s", root, aout)
+        : snprintf(path, sizeof(path), "%s/%s", cwd, aout);
+    if (n < 0 || n >= sizeof(path)) {
+        return NULL;
+    }
+#if DEBUG_LOG
+    fprintf(stderr, "/ [DBG] multiarch: %s\n", path);
+#endif
+    return archOfFile(path);
+}
+
+// the first job of the list (root cwd expect aout args...), a batch is of an arch
+static arch_main_t archOfJobs(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+    arch_main_t archMain = NULL;
+    char buf[4096];
+    while (archMain == NULL && fgets(buf, sizeof(buf), fp) != NULL) {
+        char *fields[4];
+        int n = 0;
+        for (char *p = strtok(buf, " \t\r\n"); p != NULL && p[0] != '#' && n < 4; p = strtok(NULL, " \t\r\n")) {
+            fields[n++] = p;
+        }
+        if (n == 0) {
+            continue;
+        }
+        if (n < 4) {
+            break;
+        }
+        archMain = archOfAout(fields[0], fields[1], fields[3]);
+        break;
+    }
+    fclose(fp);
+    return archMain;
+}
+
+int main(int argc, char *argv[]) {
+    const char *resumeFile = NULL;
+    const char *batchJobs = NULL;
+    bool v6 = false;
+    int opt;
+    // errors of the options by main() of the arch
+    opterr = 0;
+    while ((opt = getopt(argc, argv, UU_OPTIONS)) != -1) {
+        switch (opt) {
+        case 'R':
+            resumeFile = optarg;
+            break;
+        case 'b':
+            batchJobs = optarg;
+            break;
+        case 'i':
+        case 'I':
+            // V6 disk image
+        case 'z':
+            // the client runs no aout
+            v6 = true;
+            break;
+        }
+    }
+
+    arch_main_t archMain = NULL;
+    if (resumeFile != NULL) {
+        archMain = archOfFile(resumeFile);
+    } else if (batchJobs != NULL) {
+        archMain = archOfJobs(batchJobs);
+    } else if (!v6 && argc - optind >= 2) {
+        // rootdir aout args..., the first preloaded aout for -Z
+        archMain = archOfAout(argv[optind], ".", argv[optind + 1]);
+    }
+    opterr = 1;
+    optind = 1;
+    return ((archMain != NULL) ? archMain : uuMainPdp11)(argc, argv);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// options of uuinterp, also scanned by main() of multiarch.c for the aout
+#define UU_OPTIONS "+r:p:c:i:I:sx:k:R:Z:z:b:P:N:T:L:"
+
+// uuinterp for both archs (make multi): main() of each arch under its own name, the
+// rest of each arch local to its object, so the loop and the syscalls stay per arch
+int uuMainPdp11(int argc, char *argv[]);
+int uuMainM68k(int argc, char *argv[]);
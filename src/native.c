@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define DEBUG_LOG 0
+
+#include "native.h"
+#include "machine.h"
+#include "util.h"
+
+/* the aouts run by the host, a line each:
+  tool hash
+tool is one of cmp, cat and cp, hash is the FNV-1a 64 of the whole aout (16 hex digits).
+A modified aout has another hash and runs in the guest. Empty lines and lines from '#'
+are skipped.
+
+The host only takes the runs whose result is the same for any cmp, cat and cp: the
+same files for cmp, files to stdout for cat, a file to a new or regular file for cp.
+Any other run (options, errors, a difference) runs the aout in the guest.
+*/
+#define NATIVE_MAX 32
+#define NATIVE_HASHES 16
+
+// false if the run is left to the guest, nothing done then
+typedef bool (*tool_t)(machine_t *pm, int argc, char *argv[], int *pstatus);
+
+typedef struct {
+    char name[8];
+    uint64_t hash;
+} entry_t;
+
+// hash of an aout by the file, exec() of the same aout reads it once
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    uint64_t hash;
+} hashed_t;
+
+struct native_tag {
+    int n;
+    entry_t entries[NATIVE_MAX];
+    int nhashed;
+    hashed_t hashed[NATIVE_HASHES];
+};
+
+static bool isOption(const char *arg) {
+    return arg[0] == '-';
+}
+
+static bool copyFd(int in, int out) {
+    uint8_t buf[65536];
+    ssize_t n;
+    while ((n = read(in, buf, sizeof(buf))) != 0) {
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return false;
+        }
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t w = write(out, buf + off, n - off);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w <= 0) {
+                return false;
+            }
+            off += w;
+        }
+    }
+    return true;
+}
+
+// cmp file1 file2: the same files, else the guest prints the difference
+static bool cmp(machine_t *pm, int argc, char *argv[], int *pstatus) {
+    char name1[PATH_MAX], name2[PATH_MAX];
+    struct stat s1, s2;
+    if (argc != 3 || isOption(argv[1]) || isOption(argv[2])
+        || !addroot(name1, sizeof(name1), argv[1], pm->rootdir) || !addroot(name2, sizeof(name2), argv[2], pm->rootdir)
+        || stat(name1, &s1) != 0 || stat(name2, &s2) != 0
+        || !S_ISREG(s1.st_mode) || !S_ISREG(s2.st_mode) || s1.st_size != s2.st_size) {
+        return false;
+    }
+    int fd1 = open(name1, O_RDONLY);
+    int fd2 = open(name2, O_RDONLY);
+    bool same = (fd1 >= 0 && fd2 >= 0);
+    uint8_t buf1[16384], buf2[16384];
+    while (same) {
+        ssize_t n1 = read(fd1, buf1, sizeof(buf1));
+        if (n1 <= 0) {
+            same = (n1 == 0 && read(fd2, buf2, 1) == 0);
+            break;
+        }
+        ssize_t n2 = 0;
+        while (n2 < n1) {
+            ssize_t n = read(fd2, buf2 + n2, n1 - n2);
+            if (n <= 0) {
+                break;
+            }
+            n2 += n;
+        }
+        same = (n2 == n1 && memcmp(buf1, buf2, n1) == 0);
+        if (!same) {
+            break;
+        }
+    }
+    if (fd1 >= 0) {
+        close(fd1);
+    }
+    if (fd2 >= 0) {
+        close(fd2);
+    }
+    *pstatus = 0;
+    return same;
+}
+
+// cat file...: readable regular files, or stdin without args
+static bool cat(machine_t *pm, int argc, char *argv[], int *pstatus) {
+    struct stat out;
+    bool hasOut = (fstat(STDOUT_FILENO, &out) == 0);
+    for (int i = 1; i < argc; i++) {
+        char name[PATH_MAX];
+        struct stat s;
+        if (isOption(argv[i]) || !addroot(name, sizeof(name), argv[i], pm->rootdir)
+            || stat(name, &s) != 0 || !S_ISREG(s.st_mode) || access(name, R_OK) != 0) {
+            return false;
+        }
+        if (hasOut && s.st_dev == out.st_dev && s.st_ino == out.st_ino) {
+            // cat x >>x
+            return false;
+        }
+    }
+    if (argc == 1) {
+        *pstatus = copyFd(STDIN_FILENO, STDOUT_FILENO) ? 0 : 1;
+        return true;
+    }
+    *pstatus = 0;
+    for (int i = 1; i < argc; i++) {
+        char name[PATH_MAX];
+        addroot(name, sizeof(name), argv[i], pm->rootdir);
+        int fd = open(name, O_RDONLY);
+        if (fd < 0 || !copyFd(fd, STDOUT_FILENO)) {
+            *pstatus = 1;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    return true;
+}
+
+// cp from to: a regular file to a new or regular file, to a directory in the guest
+static bool cp(machine_t *pm, int argc, char *argv[], int *pstatus) {
+    char from[PATH_MAX], to[PATH_MAX];
+    struct stat s, t;
+    if (argc != 3 || isOption(argv[1]) || isOption(argv[2])
+        || !addroot(from, sizeof(from), argv[1], pm->rootdir) || !addroot(to, sizeof(to), argv[2], pm->rootdir)
+        || stat(from, &s) != 0 || !S_ISREG(s.st_mode)) {
+        return false;
+    }
+    if (stat(to, &t) == 0 && (!S_ISREG(t.st_mode) || (t.st_dev == s.st_dev && t.st_ino == s.st_ino))) {
+        return false;
+    }
+    int in = open(from, O_RDONLY);
+    if (in < 0) {
+        return false;
+    }
+    // creat(): the mode of from for a new file, the mode of to is kept
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, s.st_mode & 07777);
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+    bool ok = copyFd(in, out);
+    close(in);
+    ok = (close(out) == 0) && ok;
+    *pstatus = ok ? 0 : 1;
+    return true;
+}
+
+static const struct {
+    const char *name;
+    tool_t run;
+} tools[] = {
+    { "cmp", cmp },
+    { "cat", cat },
+    { "cp", cp },
+};
+#define NTOOLS (sizeof(tools) / sizeof(tools[0]))
+
+int nativeOpen(machine_t *pm, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return errno;
+    }
+    native_t *pn = calloc(1, sizeof(native_t));
+    if (pn == NULL) {
+        fclose(fp);
+        return ENOMEM;
+    }
+    char buf[256];
+    for (int line = 1; fgets(buf, sizeof(buf), fp) != NULL; line++) {
+        char name[8];
+        char hex[17];
+        char extra;
+        int n = sscanf(buf, " %7s %16s %c", name, hex, &extra);
+        if (n <= 0 || name[0] == '#') {
+            continue;
+        }
+        char *end;
+        bool known = false;
+        for (size_t i = 0; i < NTOOLS; i++) {
+            known = known || strcmp(name, tools[i].name) == 0;
+        }
+        uint64_t hash = (n == 2) ? strtoull(hex, &end, 16) : 0;
+        if (n != 2 || !known || strlen(hex) != 16 || *end != '\0' || pn->n == NATIVE_MAX) {
+            fprintf(stderr, "/ [ERR] %s:%d: cmp|cat|cp hash\n", path, line);
+            fclose(fp);
+            free(pn);
+            return EINVAL;
+        }
+        entry_t *pe = &pn->entries[pn->n++];
+        strcpy(pe->name, name);
+        pe->hash = hash;
+    }
+    fclose(fp);
+    pm->native = pn;
+    return 0;
+}
+
+// the hash of the aout, false if it's not a regular file
+static bool hashAout(native_t *pn, const char *name, uint64_t *phash) {
+    struct stat s;
+    if (stat(name, &s) != 0 || !S_ISREG(s.st_mode)) {
+        return false;
+    }
+    for (int i = 0; i < pn->nhashed && i < NATIVE_HASHES; i++) {
+        hashed_t *ph = &pn->hashed[i];
+        if (ph->dev == s.st_dev && ph->ino == s.st_ino && ph->size == s.st_size && ph->mtime == s.st_mtime) {
+            *phash = ph->hash;
+            return true;
+        }
+    }
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    uint64_t h = HASH64_INIT;
+    uint8_t buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        h = hash64(h, buf, n);
+    }
+    close(fd);
+    if (n < 0) {
+        return false;
+    }
+    hashed_t *ph = &pn->hashed[pn->nhashed++ % NATIVE_HASHES];
+    ph->dev = s.st_dev;
+    ph->ino = s.st_ino;
+    ph->size = s.st_size;
+    ph->mtime = s.st_mtime;
+    ph->hash = h;
+    *phash = h;
+    return true;
+}
+
+void nativeExec(machine_t *pm, const char *src) {
+    native_t *pn = pm->native;
+    // the exit of the tool is _exit() of the host process
+    if (pn == NULL || pm->procs != NULL || pm->io != NULL || pm->replay != NULL
+        || pm->memo != NULL || pm->v6fs != NULL) {
+        return;
+    }
+    char name[PATH_MAX];
+    uint64_t hash;
+    if (!addroot(name, sizeof(name), src, pm->rootdir) || !hashAout(pn, name, &hash)) {
+        return;
+    }
+    const char *base = strrchr(src, '/');
+    base = (base != NULL) ? base + 1 : src;
+
+    const entry_t *pe = NULL;
+    for (int i = 0; i < pn->n; i++) {
+        if (pn->entries[i].hash == hash) {
+            pe = &pn->entries[i];
+            break;
+        }
+        if (strcmp(pn->entries[i].name, base) == 0) {
+            pe = &pn->entries[i];
+        }
+    }
+    if (pe == NULL) {
+        return;
+    }
+    if (pe->hash != hash) {
+        fprintf(stderr, "/ [WRN] native: %s is %016llx, runs in the guest\n", src, (unsigned long long)hash);
+        return;
+    }
+
+    // argv of exec()
+    char *argv[sizeof(pm->args) / 2 + 1];
+    char *p = (char *)pm->args;
+    for (int i = 0; i < pm->argc; i++) {
+        argv[i] = p;
+        p += strlen(p) + 1;
+    }
+    argv[pm->argc] = NULL;
+    if (pm->argc < 1) {
+        return;
+    }
+    for (size_t i = 0; i < NTOOLS; i++) {
+        int status;
+        if (strcmp(pe->name, tools[i].name) != 0 || !tools[i].run(pm, pm->argc, argv, &status)) {
+            continue;
+        }
+#if DEBUG_LOG
+        fprintf(stderr, "/ [DBG] native: %s as %s: %d\n", src, pe->name, status);
+#endif
+        // as exit() of the guest
+        profileExit(pm);
+        vtimeExit(pm);
+        budgetExit(pm);
+        _exit(status);
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+struct native_tag;
+#ifndef _NATIVE_T_
+#define _NATIVE_T_
+typedef struct native_tag native_t;
+#endif
+
+// host versions of cmp, cat and cp for the aouts listed in the file by content hash
+int nativeOpen(machine_t *pm, const char *path);
+
+// before load() of exec(): returns if the aout runs in the guest, else the process exits
+void nativeExec(machine_t *pm, const char *src);
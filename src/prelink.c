@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define DEBUG_LOG 0
+
+#include "prelink.h"
+#include "machine.h"
+#include "util.h"
+
+// the symbol table in the aout file: offset and size
+static void symbolTable(machine_t *pm, long *poffset, uint32_t *psize) {
+    if (!IS_MAGIC_BE(pm->aout.headerBE[0])) {
+        // PDP-11 V6: header, text, data, relocation unless suppressed, symbols
+        const uint16_t *h = pm->aout.header;
+        long reloc = (h[7] == 0) ? h[1] + h[2] : 0;
+        *poffset = 16 + h[1] + h[2] + reloc;
+        *psize = h[4];
+    } else {
+        // m68k Minix: header, text, data, symbols, relocation
+        const uint32_t *h = pm->aout.headerBE;
+        *poffset = h[1] + h[2] + h[3];
+        *psize = h[7];
+    }
+}
+
+static bool copySymbols(FILE *dst, FILE *src, long offset, uint32_t size) {
+    if (fseek(src, offset, SEEK_SET) != 0) {
+        return false;
+    }
+    uint8_t buf[4096];
+    while (size > 0) {
+        size_t n = (size < sizeof(buf)) ? size : sizeof(buf);
+        if (fread(buf, 1, n, src) != n || fwrite(buf, 1, n, dst) != n) {
+            return false;
+        }
+        size -= n;
+    }
+    return true;
+}
+
+int prelinkWrite(machine_t *pm, const char *src, const char *dst) {
+    prelink_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MAGIC_PRELINK, sizeof(h.magic));
+    h.version = PRELINK_VERSION;
+    h.arch = IS_MAGIC_BE(pm->aout.headerBE[0]) ? PRELINK_M68K_MINIX : PRELINK_PDP11_V6;
+    h.textStart = pm->textStart;
+    h.textEnd = pm->textEnd;
+    h.dataStart = pm->dataStart;
+    h.dataEnd = pm->dataEnd;
+    h.bssStart = pm->bssStart;
+    h.bssEnd = pm->bssEnd;
+    h.brk = pm->brk;
+    // mappable at textStart
+    h.imageOffset = PRELINK_ALIGN + (pm->textStart & (PRELINK_ALIGN - 1));
+    h.symOffset = h.imageOffset + (pm->dataEnd - pm->textStart);
+    memcpy(h.aout, &pm->aout, sizeof(h.aout));
+
+    // a prelinked src has no aout symbol table to copy
+    long symOffset = 0;
+    FILE *in = NULL;
+    if (!pm->relocated) {
+        char name[PATH_MAX];
+        addroot(name, sizeof(name), src, pm->rootdir);
+        in = fopen(name, "rb");
+        if (in == NULL) {
+            return errno;
+        }
+        symbolTable(pm, &symOffset, &h.symSize);
+    }
+
+    FILE *fp = fopen(dst, "wb");
+    if (fp == NULL) {
+        int e = errno;
+        if (in != NULL) {
+            fclose(in);
+        }
+        return e;
+    }
+    static const uint8_t zero[PRELINK_ALIGN];
+    bool ok = fwrite(&h, 1, sizeof(h), fp) == sizeof(h)
+        && fwrite(zero, 1, h.imageOffset - sizeof(h), fp) == h.imageOffset - sizeof(h)
+        && fwrite(&pm->virtualMemory[pm->textStart], 1, h.symOffset - h.imageOffset, fp) == h.symOffset - h.imageOffset
+        && (in == NULL || copySymbols(fp, in, symOffset, h.symSize));
+    int e = errno;
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (fclose(fp) != 0 && ok) {
+        return errno;
+    }
+    if (!ok) {
+        remove(dst);
+        return (e != 0) ? e : EIO;
+    }
+    return 0;
+}
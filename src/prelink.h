@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+/* prelinked aout, in host byte order:
+  prelink_header_t
+  padding
+  image:   [textStart, dataEnd) relocated, at imageOffset (= textStart mod PRELINK_ALIGN)
+  symbols: the symbol table of the aout as is, at symOffset
+*/
+#define PRELINK_VERSION 1
+#define PRELINK_ALIGN 4096
+
+#define PRELINK_PDP11_V6  1
+#define PRELINK_M68K_MINIX 2
+
+typedef struct {
+    char magic[4];      // MAGIC_PRELINK
+    uint32_t version;
+    uint32_t arch;
+    // layout for textStart, by main()
+    uint32_t textStart;
+    uint32_t textEnd;
+    uint32_t dataStart;
+    uint32_t dataEnd;
+    uint32_t bssStart;
+    uint32_t bssEnd;
+    uint32_t brk;
+    uint32_t imageOffset;
+    uint32_t symOffset;
+    uint32_t symSize;
+    uint32_t aout[8];   // machine_t.aout
+} prelink_header_t;
+
+// the image of the aout src, loaded and relocated, to dst
+int prelinkWrite(machine_t *pm, const char *src, const char *dst);
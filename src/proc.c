@@ -0,0 +1,545 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "proc.h"
+#include "machine.h"
+#ifdef UU_M68K_MINIX
+#include "../m68k/src/cpu.h"
+#else
+#include "../pdp11/src/cpu.h"
+#endif
+
+#define PROC_MAX 64
+#define PROC_NOFILE 20          // guest fds per process
+#define PROC_MAX_HOSTFD 256
+#define PROC_QUANTUM 100000     // instructions
+
+enum {
+    PROC_FREE = 0,
+    PROC_RUN,
+    PROC_BLOCKED,   // on hfd
+    PROC_WAITING,   // for a child
+    PROC_ZOMBIE,
+};
+
+typedef struct {
+    int state;
+    int pid;
+    int ppid;
+    int status;     // of a zombie, for wait()
+
+    int hfd;
+    short events;
+
+    int cwdfd;
+    int fds[PROC_NOFILE];
+
+    // the machine while the process isn't running
+    cpu_t cpu;
+    uint32_t aout[8];
+    uint32_t textStart;
+    uint32_t textEnd;
+    uint32_t dataStart;
+    uint32_t dataEnd;
+    uint32_t bssStart;
+    uint32_t bssEnd;
+    uint32_t brk;
+    int dirfd;
+    DIR *dirp;
+    // its own memory by guestClone(), pm->virtualMemory while it runs (NULL here then)
+    uint8_t *mem;
+    size_t mapped;
+} proc_t;
+
+struct procs_tag {
+    proc_t proc[PROC_MAX];
+    proc_t *cur;
+    int firstPid;
+    int lastPid;
+    int exitStatus; // of the first process, ours at the end
+
+    uint64_t quantumEnd;    // pm->retired at the next switch
+    bool resched;
+    bool rewind;    // the syscall of cur runs again when it's resumed
+    proc_t *forked; // made from cur at the end of the syscall
+
+    uint16_t refs[PROC_MAX_HOSTFD]; // guest fds of all processes
+};
+
+#ifndef UU_M68K_MINIX
+// the child returns 0 from the syscall, without the skip of the parent
+static void forkReturn(cpu_t *pc) {
+    pc->pc -= 2;
+    pc->r0 = 0;
+    clearC(pc);
+}
+
+static void rewindTo(cpu_t *pc, uint32_t trapPC) {
+    pc->pc = trapPC;
+}
+#else
+static void forkReturn(cpu_t *pc) {
+    assert(0);
+}
+
+static void rewindTo(cpu_t *pc, uint32_t trapPC) {
+    assert(0);
+}
+#endif
+
+
+//////////////////////////
+// context
+//////////////////////////
+// the context of the machine, not the memory
+static void save(machine_t *pm, proc_t *p) {
+    p->cpu = *pm->cpu;
+    memcpy(p->aout, &pm->aout, sizeof(p->aout));
+    p->textStart = pm->textStart;
+    p->textEnd = pm->textEnd;
+    p->dataStart = pm->dataStart;
+    p->dataEnd = pm->dataEnd;
+    p->bssStart = pm->bssStart;
+    p->bssEnd = pm->bssEnd;
+    p->brk = pm->brk;
+    p->dirfd = pm->dirfd;
+    p->dirp = pm->dirp;
+}
+
+static void restore(machine_t *pm, proc_t *p) {
+    *pm->cpu = p->cpu;
+    memcpy(&pm->aout, p->aout, sizeof(p->aout));
+    pm->textStart = p->textStart;
+    pm->textEnd = p->textEnd;
+    pm->dataStart = p->dataStart;
+    pm->dataEnd = p->dataEnd;
+    pm->bssStart = p->bssStart;
+    pm->bssEnd = p->bssEnd;
+    pm->brk = p->brk;
+    pm->dirfd = p->dirfd;
+    pm->dirp = p->dirp;
+
+    // no copy: the memory of the process is the memory of the machine
+    pm->virtualMemory = p->mem;
+    pm->mapped = p->mapped;
+    p->mem = NULL;
+}
+
+static proc_t *findProc(procs_t *ps, int pid) {
+    for (int i = 0; i < PROC_MAX; i++) {
+        if (ps->proc[i].state != PROC_FREE && ps->proc[i].pid == pid) {
+            return &ps->proc[i];
+        }
+    }
+    return NULL;
+}
+
+// blocked processes whose fds are ready can run
+static void wake(procs_t *ps, int timeout) {
+    struct pollfd pfds[PROC_MAX];
+    proc_t *who[PROC_MAX];
+    int n = 0;
+    for (int i = 0; i < PROC_MAX; i++) {
+        if (ps->proc[i].state == PROC_BLOCKED) {
+            pfds[n].fd = ps->proc[i].hfd;
+            pfds[n].events = ps->proc[i].events;
+            pfds[n].revents = 0;
+            who[n++] = &ps->proc[i];
+        }
+    }
+    if (n == 0 || poll(pfds, n, timeout) <= 0) {
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        if (pfds[i].revents != 0) {
+            who[i]->state = PROC_RUN;
+        }
+    }
+}
+
+// round robin, NULL if nothing can run any more
+static proc_t *pick(procs_t *ps) {
+    int cur = ps->cur - ps->proc;
+    int timeout = 0;
+    for (;;) {
+        wake(ps, timeout);
+        bool blocked = false;
+        for (int i = 1; i <= PROC_MAX; i++) {
+            proc_t *p = &ps->proc[(cur + i) % PROC_MAX];
+            if (p->state == PROC_RUN) {
+                return p;
+            }
+            blocked |= (p->state == PROC_BLOCKED);
+        }
+        if (!blocked) {
+            return NULL;
+        }
+        timeout = -1;
+    }
+}
+
+static int release(machine_t *pm, int hfd) {
+    procs_t *ps = pm->procs;
+    if (--ps->refs[hfd] > 0) {
+        return 0;
+    }
+    if (hfd == pm->dirfd && pm->dirp != NULL) {
+        DIR *dirp = pm->dirp;
+        pm->dirfd = -1;
+        pm->dirp = NULL;
+        return closedir(dirp);
+    }
+    if (pm->io != NULL && hfd <= STDERR_FILENO) {
+        // stdio of the program of libuuinterp
+        return 0;
+    }
+    return close(hfd);
+}
+
+
+//////////////////////////
+// api
+//////////////////////////
+int procInit(machine_t *pm) {
+#ifdef UU_M68K_MINIX
+    // one cpu context per host process
+    return ENOTSUP;
+#else
+    procs_t *ps = calloc(1, sizeof(procs_t));
+    if (ps == NULL) {
+        return ENOMEM;
+    }
+    proc_t *p = &ps->proc[0];
+    p->cwdfd = open(".", O_RDONLY);
+    if (p->cwdfd < 0) {
+        int e = errno;
+        free(ps);
+        return e;
+    }
+    p->state = PROC_RUN;
+    p->pid = getpid() & 0x7fff;
+    p->ppid = 0;
+    // in libuuinterp, the other fds are of the program
+    const int nfds = (pm->io != NULL) ? STDERR_FILENO + 1 : PROC_NOFILE;
+    for (int fd = 0; fd < PROC_NOFILE; fd++) {
+        p->fds[fd] = -1;
+        if (fd < nfds && fd != p->cwdfd && fcntl(fd, F_GETFD) != -1) {
+            p->fds[fd] = fd;
+            ps->refs[fd]++;
+        }
+    }
+    ps->firstPid = ps->lastPid = p->pid;
+    ps->cur = p;
+    ps->quantumEnd = pm->retired + PROC_QUANTUM;
+    pm->procs = ps;
+    return 0;
+#endif
+}
+
+void procFree(machine_t *pm) {
+    procs_t *ps = pm->procs;
+    if (ps == NULL) {
+        return;
+    }
+    for (int i = 0; i < PROC_MAX; i++) {
+        proc_t *p = &ps->proc[i];
+        if (p->state != PROC_FREE) {
+            close(p->cwdfd);
+        }
+        if (p->mem != NULL) {
+            guestRelease(p->mem);
+        }
+    }
+    for (int hfd = 0; hfd < PROC_MAX_HOSTFD; hfd++) {
+        if (ps->refs[hfd] > 0) {
+            ps->refs[hfd] = 1;
+            release(pm, hfd);
+        }
+    }
+    free(ps);
+    pm->procs = NULL;
+}
+
+uint64_t procStep(machine_t *pm, uint32_t trapPC) {
+    procs_t *ps = pm->procs;
+    if (!ps->resched && pm->retired < ps->quantumEnd) {
+        return ps->quantumEnd;
+    }
+    // not between exec() and the layout of the new image
+    if (getPC(pm->cpu) >= pm->sizeOfVM - 1) {
+        return 0;
+    }
+    ps->quantumEnd = pm->retired + PROC_QUANTUM;
+    ps->resched = false;
+
+    proc_t *cur = ps->cur;
+    if (ps->forked != NULL) {
+        proc_t *child = ps->forked;
+        ps->forked = NULL;
+        save(pm, child);
+        forkReturn(&child->cpu);
+        // readdir() stays with the parent
+        child->dirfd = -1;
+        child->dirp = NULL;
+        child->state = PROC_RUN;
+    }
+    if (ps->rewind) {
+        ps->rewind = false;
+        rewindTo(pm->cpu, trapPC);
+    }
+
+    proc_t *next = pick(ps);
+    if (next == NULL) {
+        // all exited
+        profileExit(pm);
+        if (pm->io != NULL) {
+            pm->exited = true;
+            pm->exitStatus = ps->exitStatus;
+            pm->interrupted = 1;
+            pm->runLimit = 0;
+            return 0;
+        }
+        _exit(ps->exitStatus);
+    }
+    if (next == cur) {
+        return ps->quantumEnd;
+    }
+    if (cur->state != PROC_ZOMBIE && cur->state != PROC_FREE) {
+        save(pm, cur);
+        cur->mem = pm->virtualMemory;
+        cur->mapped = pm->mapped;
+    } else {
+        // exited, nothing keeps its memory
+        guestRelease(pm->virtualMemory);
+    }
+    restore(pm, next);
+    if (fchdir(next->cwdfd) != 0) {
+        fprintf(stderr, "/ [ERR] pid %d: Can't restore cwd: %s\n", next->pid, strerror(errno));
+    }
+    ps->cur = next;
+    return ps->quantumEnd;
+}
+
+int procHostFd(machine_t *pm, int fd) {
+    procs_t *ps = pm->procs;
+    if (ps == NULL) {
+        return fd;
+    }
+    if (fd < 0 || fd >= PROC_NOFILE || ps->cur->fds[fd] < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    return ps->cur->fds[fd];
+}
+
+int procNewFd(machine_t *pm, int hfd) {
+    procs_t *ps = pm->procs;
+    if (ps == NULL || hfd < 0) {
+        return hfd;
+    }
+    int fd;
+    for (fd = 0; fd < PROC_NOFILE && ps->cur->fds[fd] >= 0; fd++);
+    if (fd == PROC_NOFILE || hfd >= PROC_MAX_HOSTFD) {
+        close(hfd);
+        errno = EMFILE;
+        return -1;
+    }
+    ps->cur->fds[fd] = hfd;
+    ps->refs[hfd]++;
+    return fd;
+}
+
+int procDup(machine_t *pm, int fd) {
+    procs_t *ps = pm->procs;
+    if (ps == NULL) {
+        return dup(fd);
+    }
+    int hfd = procHostFd(pm, fd);
+    if (hfd < 0) {
+        return -1;
+    }
+    for (fd = 0; fd < PROC_NOFILE && ps->cur->fds[fd] >= 0; fd++);
+    if (fd == PROC_NOFILE) {
+        errno = EMFILE;
+        return -1;
+    }
+    ps->cur->fds[fd] = hfd;
+    ps->refs[hfd]++;
+    return fd;
+}
+
+int procClose(machine_t *pm, int fd) {
+    procs_t *ps = pm->procs;
+    if (ps == NULL) {
+        return close(fd);
+    }
+    int hfd = procHostFd(pm, fd);
+    if (hfd < 0) {
+        return -1;
+    }
+    ps->cur->fds[fd] = -1;
+    return release(pm, hfd);
+}
+
+bool procWouldBlock(machine_t *pm, int hfd, short events) {
+    procs_t *ps = pm->procs;
+    if (ps == NULL || hfd < 0) {
+        return false;
+    }
+    struct pollfd pfd = { hfd, events, 0 };
+    if (poll(&pfd, 1, 0) != 0) {
+        // ready, or the syscall gets the error
+        return false;
+    }
+    ps->cur->state = PROC_BLOCKED;
+    ps->cur->hfd = hfd;
+    ps->cur->events = events;
+    ps->rewind = true;
+    ps->resched = true;
+    pm->deadline = 0;
+    return true;
+}
+
+int procFork(machine_t *pm) {
+    procs_t *ps = pm->procs;
+    if (ps == NULL) {
+        return fork();
+    }
+    proc_t *child = NULL;
+    for (int i = 0; i < PROC_MAX && child == NULL; i++) {
+        if (ps->proc[i].state == PROC_FREE) {
+            child = &ps->proc[i];
+        }
+    }
+    if (child == NULL) {
+        errno = EAGAIN;
+        return -1;
+    }
+    int cwdfd = dup(ps->cur->cwdfd);
+    if (cwdfd < 0) {
+        return -1;
+    }
+    // the live ranges, the break grows over zeros as after a host fork()
+    uint8_t *mem = guestClone(pm, getSP(pm->cpu));
+    if (mem == NULL) {
+        int e = errno;
+        close(cwdfd);
+        errno = (e == ENOMEM) ? EAGAIN : e;
+        return -1;
+    }
+    do {
+        ps->lastPid = ps->lastPid % 0x7fff + 1;
+    } while (findProc(ps, ps->lastPid) != NULL);
+
+    memset(child, 0, sizeof(*child));
+    child->mem = mem;
+    child->mapped = pm->mapped;
+    child->state = PROC_RUN;
+    child->pid = ps->lastPid;
+    child->ppid = ps->cur->pid;
+    child->cwdfd = cwdfd;
+    for (int fd = 0; fd < PROC_NOFILE; fd++) {
+        child->fds[fd] = ps->cur->fds[fd];
+        if (child->fds[fd] >= 0) {
+            ps->refs[child->fds[fd]]++;
+        }
+    }
+    ps->forked = child;
+    ps->resched = true;
+    pm->deadline = 0;
+    return child->pid;
+}
+
+void procExit(machine_t *pm, int status) {
+    procs_t *ps = pm->procs;
+    proc_t *cur = ps->cur;
+    for (int fd = 0; fd < PROC_NOFILE; fd++) {
+        if (cur->fds[fd] >= 0) {
+            release(pm, cur->fds[fd]);
+            cur->fds[fd] = -1;
+        }
+    }
+    close(cur->cwdfd);
+    cur->cwdfd = -1;
+    cur->status = (status & 0xff) << 8;
+    if (cur->pid == ps->firstPid) {
+        ps->exitStatus = status & 0xff;
+    }
+
+    // orphans are not waited for
+    for (int i = 0; i < PROC_MAX; i++) {
+        proc_t *p = &ps->proc[i];
+        if (p->state != PROC_FREE && p->ppid == cur->pid) {
+            p->ppid = 0;
+            if (p->state == PROC_ZOMBIE) {
+                p->state = PROC_FREE;
+            }
+        }
+    }
+    proc_t *parent = (cur->ppid != 0) ? findProc(ps, cur->ppid) : NULL;
+    if (parent == NULL) {
+        cur->state = PROC_FREE;
+    } else {
+        cur->state = PROC_ZOMBIE;
+        if (parent->state == PROC_WAITING) {
+            parent->state = PROC_RUN;
+        }
+    }
+    ps->resched = true;
+    pm->deadline = 0;
+}
+
+int procWait(machine_t *pm, int *pstatus) {
+    procs_t *ps = pm->procs;
+    if (ps == NULL) {
+        return wait(pstatus);
+    }
+    bool children = false;
+    for (int i = 0; i < PROC_MAX; i++) {
+        proc_t *p = &ps->proc[i];
+        if (p->state == PROC_FREE || p->ppid != ps->cur->pid) {
+            continue;
+        }
+        if (p->state == PROC_ZOMBIE) {
+            *pstatus = p->status;
+            p->state = PROC_FREE;
+            return p->pid;
+        }
+        children = true;
+    }
+    if (!children) {
+        errno = ECHILD;
+        return -1;
+    }
+    ps->cur->state = PROC_WAITING;
+    ps->rewind = true;
+    ps->resched = true;
+    pm->deadline = 0;
+    return 0;
+}
+
+int procGetpid(machine_t *pm) {
+    return (pm->procs != NULL) ? pm->procs->cur->pid : getpid();
+}
+
+void procChdir(machine_t *pm) {
+    procs_t *ps = pm->procs;
+    if (ps == NULL) {
+        return;
+    }
+    int cwdfd = open(".", O_RDONLY);
+    if (cwdfd >= 0) {
+        close(ps->cur->cwdfd);
+        ps->cur->cwdfd = cwdfd;
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+struct procs_tag;
+#ifndef _PROCS_T_
+#define _PROCS_T_
+typedef struct procs_tag procs_t;
+#endif
+
+// guest processes inside this host process, switched at syscalls
+int procInit(machine_t *pm);
+void procFree(machine_t *pm);
+
+// by runAout() at pm->deadline, after the instruction at trapPC: switches the process at
+// the end of its quantum or at resched, returns pm->retired of the next switch
+uint64_t procStep(machine_t *pm, uint32_t trapPC);
+
+// guest fds: without procInit(), the host fds themselves
+int procHostFd(machine_t *pm, int fd);
+int procNewFd(machine_t *pm, int hfd);
+int procDup(machine_t *pm, int fd);
+int procClose(machine_t *pm, int fd);
+
+// true if the syscall has to wait for the host fd, then it runs again later
+bool procWouldBlock(machine_t *pm, int hfd, short events);
+
+// same as the host calls; procWait() returns 0 if the syscall runs again later
+int procFork(machine_t *pm);
+void procExit(machine_t *pm, int status);
+int procWait(machine_t *pm, int *pstatus);
+int procGetpid(machine_t *pm);
+void procChdir(machine_t *pm);
@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <inttypes.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#define DEBUG_LOG 0
+
+#include "profile.h"
+#include "machine.h"
+
+/* file: the counts of all processes, merged at each exit, most frequent first
+  # comment
+  <n> <count> <word> <word> [<word>]    ; <disassembly>
+n is 2 or 3, words are the instructions in octal with the registers r0-r5 as r0
+and the offsets of branches as 0, so that the same idiom on any register counts once
+*/
+#define PROFILE_INITIAL 4096    // slots, grows at half full
+
+typedef struct {
+    uint64_t key;   // n << 48 | words, 0 for a free slot
+    uint64_t count;
+} profile_entry_t;
+
+struct profile_tag {
+    char path[PATH_MAX * 2];
+    uint16_t norm[0x10000];
+    profile_entry_t *slots;
+    size_t size;
+    size_t used;
+    // the last instructions
+    uint16_t prev[2];
+    int nprev;
+};
+
+#ifndef UU_M68K_MINIX
+static uint16_t normReg(uint16_t r) {
+    return (r >= 6) ? r : 0;
+}
+
+// mode and register of an operand
+static uint16_t normOperand(uint16_t dd) {
+    return (dd & 070) | normReg(dd & 07);
+}
+
+static uint16_t normalize(uint16_t w) {
+    const uint16_t top = w >> 12;
+    if (top == 007) {
+        // mul, div, ash, ashc, xor, sob
+        if ((w & 0177000) == 077000) {
+            return (w & 0177000) | (normReg((w >> 6) & 07) << 6);
+        }
+        return (w & 0177000) | (normReg((w >> 6) & 07) << 6) | normOperand(w & 077);
+    }
+    if (top == 017) {
+        // floating point
+        return (w & 0177700) | normOperand(w & 077);
+    }
+    if ((top & 07) != 0) {
+        // double operand
+        return (w & 0170000) | (normOperand((w >> 6) & 077) << 6) | normOperand(w & 077);
+    }
+    const uint16_t hi = w >> 8;
+    if ((hi >= 01 && hi <= 07) || (hi >= 0200 && hi <= 0211)) {
+        // branches, emt and sys
+        return w & 0177400;
+    }
+    if ((w & 0177000) == 004000) {
+        // jsr
+        return 004000 | (normReg((w >> 6) & 07) << 6) | normOperand(w & 077);
+    }
+    if ((w & 0177770) == 000200) {
+        // rts
+        return 000200 | normReg(w & 07);
+    }
+    if ((w & 0177700) == 000100 || (w & 0177700) == 000300
+        || (hi >= 012 && hi <= 015) || (hi >= 0212 && hi <= 0215)) {
+        // jmp, swab, single operand
+        return (w & 0177700) | normOperand(w & 077);
+    }
+    return w;
+}
+
+static const char *regName(uint16_t r) {
+    return (r == 6) ? "sp" : (r == 7) ? "pc" : "r";
+}
+
+static int printOperand(char *s, size_t len, uint16_t dd) {
+    const uint16_t mode = (dd >> 3) & 07;
+    const char *r = regName(dd & 07);
+    if ((dd & 07) == 7) {
+        switch (mode) {
+        case 2: return snprintf(s, len, "#n");
+        case 3: return snprintf(s, len, "@#a");
+        case 6: return snprintf(s, len, "a");
+        case 7: return snprintf(s, len, "@a");
+        }
+    }
+    switch (mode) {
+    case 0: return snprintf(s, len, "%s", r);
+    case 1: return snprintf(s, len, "(%s)", r);
+    case 2: return snprintf(s, len, "(%s)+", r);
+    case 3: return snprintf(s, len, "@(%s)+", r);
+    case 4: return snprintf(s, len, "-(%s)", r);
+    case 5: return snprintf(s, len, "@-(%s)", r);
+    case 6: return snprintf(s, len, "x(%s)", r);
+    default: return snprintf(s, len, "@x(%s)", r);
+    }
+}
+
+// a normalized instruction as text
+static void disasm16(char *s, size_t len, uint16_t w) {
+    static const char *const doubles[16] = {
+        NULL, "mov", "cmp", "bit", "bic", "bis", "add", NULL,
+        NULL, "movb", "cmpb", "bitb", "bicb", "bisb", "sub", NULL,
+    };
+    static const char *const singles[16] = {
+        "clr", "com", "inc", "dec", "neg", "adc", "sbc", "tst",
+        "ror", "rol", "asr", "asl", "mark", "mfpi", "mtpi", "sxt",
+    };
+    static const char *const branches[] = {
+        NULL, "br", "bne", "beq", "bge", "blt", "bgt", "ble",
+    };
+    static const char *const branches2[] = {
+        "bpl", "bmi", "bhi", "blos", "bvc", "bvs", "bcc", "bcs", "emt", "sys",
+    };
+    static const char *const regsrc[8] = {
+        "mul", "div", "ash", "ashc", "xor", NULL, NULL, "sob",
+    };
+    const uint16_t top = w >> 12;
+    const uint16_t hi = w >> 8;
+    int n;
+    if (doubles[top] != NULL) {
+        n = snprintf(s, len, "%s ", doubles[top]);
+        n += printOperand(s + n, len - n, (w >> 6) & 077);
+        n += snprintf(s + n, len - n, ",");
+        printOperand(s + n, len - n, w & 077);
+    } else if (top == 007 && regsrc[(w >> 9) & 07] != NULL) {
+        n = snprintf(s, len, "%s %s", regsrc[(w >> 9) & 07], regName((w >> 6) & 07));
+        if ((w & 0177000) != 077000) {
+            n += snprintf(s + n, len - n, ",");
+            printOperand(s + n, len - n, w & 077);
+        }
+    } else if (hi >= 01 && hi <= 07) {
+        snprintf(s, len, "%s", branches[hi]);
+    } else if (hi >= 0200 && hi <= 0211) {
+        snprintf(s, len, "%s", branches2[hi - 0200]);
+    } else if ((w & 0177000) == 004000) {
+        n = snprintf(s, len, "jsr %s,", regName((w >> 6) & 07));
+        printOperand(s + n, len - n, w & 077);
+    } else if ((w & 0177770) == 000200) {
+        snprintf(s, len, "rts %s", regName(w & 07));
+    } else if ((w & 0177700) == 000100 || (w & 0177700) == 000300) {
+        n = snprintf(s, len, "%s ", ((w & 0177700) == 000100) ? "jmp" : "swab");
+        printOperand(s + n, len - n, w & 077);
+    } else if ((hi & 0177) >= 012 && (hi & 0177) <= 015) {
+        n = snprintf(s, len, "%s%s ", singles[((w >> 6) & 077) - 050], (w & 0100000) ? "b" : "");
+        printOperand(s + n, len - n, w & 077);
+    } else {
+        snprintf(s, len, "%06o", w);
+    }
+}
+#endif
+
+static size_t slotOf(const profile_t *pp, uint64_t key) {
+    size_t i = (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (pp->size - 1);
+    while (pp->slots[i].key != 0 && pp->slots[i].key != key) {
+        i = (i + 1) & (pp->size - 1);
+    }
+    return i;
+}
+
+static void add(profile_t *pp, uint64_t key, uint64_t count) {
+    if ((pp->used + 1) * 2 > pp->size) {
+        profile_entry_t *old = pp->slots;
+        size_t oldSize = pp->size;
+        profile_entry_t *p = calloc(oldSize * 2, sizeof(profile_entry_t));
+        if (p == NULL) {
+            // the counts so far are still right
+            return;
+        }
+        pp->slots = p;
+        pp->size = oldSize * 2;
+        for (size_t i = 0; i < oldSize; i++) {
+            if (old[i].key != 0) {
+                pp->slots[slotOf(pp, old[i].key)] = old[i];
+            }
+        }
+        free(old);
+    }
+    size_t i = slotOf(pp, key);
+    if (pp->slots[i].key == 0) {
+        pp->slots[i].key = key;
+        pp->used++;
+    }
+    pp->slots[i].count += count;
+}
+
+static uint64_t pairKey(uint16_t w1, uint16_t w2) {
+    return (2ULL << 48) | ((uint64_t)w1 << 16) | w2;
+}
+
+static uint64_t tripleKey(uint16_t w1, uint16_t w2, uint16_t w3) {
+    return (3ULL << 48) | ((uint64_t)w1 << 32) | ((uint64_t)w2 << 16) | w3;
+}
+
+int profileOpen(machine_t *pm, const char *path) {
+#ifdef UU_M68K_MINIX
+    // the normalization is of PDP-11 instructions
+    return ENOTSUP;
+#else
+    profile_t *pp = calloc(1, sizeof(profile_t));
+    if (pp == NULL) {
+        return ENOMEM;
+    }
+    pp->size = PROFILE_INITIAL;
+    pp->slots = calloc(pp->size, sizeof(profile_entry_t));
+    if (pp->slots == NULL) {
+        free(pp);
+        return ENOMEM;
+    }
+    // absolute, the guest may chdir
+    int n = (path[0] == '/')
+        ? snprintf(pp->path, sizeof(pp->path), "%s", path)
+        : snprintf(pp->path, sizeof(pp->path), "%s/%s", pm->curdir, path);
+    if (n < 0 || n >= sizeof(pp->path)) {
+        free(pp->slots);
+        free(pp);
+        return ENAMETOOLONG;
+    }
+    for (uint32_t w = 0; w < 0x10000; w++) {
+        pp->norm[w] = normalize(w);
+    }
+    pm->profile = pp;
+    return 0;
+#endif
+}
+
+void profileStep(machine_t *pm, uint32_t pc) {
+    profile_t *pp = pm->profile;
+    const uint16_t w = pp->norm[guestLoad16LE(pm, pc)];
+    if (pp->nprev >= 1) {
+        add(pp, pairKey(pp->prev[1], w), 1);
+    }
+    if (pp->nprev >= 2) {
+        add(pp, tripleKey(pp->prev[0], pp->prev[1], w), 1);
+    }
+    pp->prev[0] = pp->prev[1];
+    pp->prev[1] = w;
+    if (pp->nprev < 2) {
+        pp->nprev++;
+    }
+}
+
+void profileFork(machine_t *pm) {
+    profile_t *pp = pm->profile;
+    if (pp == NULL) {
+        return;
+    }
+    memset(pp->slots, 0, pp->size * sizeof(profile_entry_t));
+    pp->used = 0;
+}
+
+#ifndef UU_M68K_MINIX
+// the counts in the file, to be written back with ours
+static void merge(profile_t *pp, int fd) {
+    FILE *fp = fdopen(dup(fd), "r");
+    if (fp == NULL) {
+        return;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        int n;
+        uint64_t count;
+        unsigned int w[3] = { 0, 0, 0 };
+        if (line[0] == '#' || sscanf(line, "%d %" SCNu64 " %o %o %o", &n, &count, &w[0], &w[1], &w[2]) < 4) {
+            continue;
+        }
+        if (n == 2) {
+            add(pp, pairKey(w[0], w[1]), count);
+        } else if (n == 3) {
+            add(pp, tripleKey(w[0], w[1], w[2]), count);
+        }
+    }
+    fclose(fp);
+}
+
+static int byCount(const void *a, const void *b) {
+    const profile_entry_t *pa = a;
+    const profile_entry_t *pb = b;
+    if ((pa->key >> 48) != (pb->key >> 48)) {
+        return ((pa->key >> 48) < (pb->key >> 48)) ? -1 : 1;
+    }
+    return (pa->count > pb->count) ? -1 : (pa->count < pb->count) ? 1 : 0;
+}
+#endif
+
+void profileExit(machine_t *pm) {
+#ifndef UU_M68K_MINIX
+    profile_t *pp = pm->profile;
+    if (pp == NULL || pp->used == 0) {
+        return;
+    }
+    // the other processes wait for the merge
+    int fd = open(pp->path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "/ [WRN] profile: %s: %s\n", pp->path, strerror(errno));
+        return;
+    }
+    struct flock lk;
+    memset(&lk, 0, sizeof(lk));
+    lk.l_type = F_WRLCK;
+    lk.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &lk) != 0 && errno == EINTR) {
+    }
+    merge(pp, fd);
+
+    profile_entry_t *sorted = malloc(pp->used * sizeof(profile_entry_t));
+    if (sorted == NULL) {
+        close(fd);
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < pp->size; i++) {
+        if (pp->slots[i].key != 0) {
+            sorted[n++] = pp->slots[i];
+        }
+    }
+    qsort(sorted, n, sizeof(profile_entry_t), byCount);
+
+    FILE *fp = (ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0) ? fdopen(dup(fd), "w") : NULL;
+    if (fp != NULL) {
+        fprintf(fp, "# n count words ; instructions (r: r0-r5, x/a/n: any offset, address or value)\n");
+        for (size_t i = 0; i < n; i++) {
+            const uint64_t key = sorted[i].key;
+            const int len = (int)(key >> 48);
+            uint16_t w[3] = { (key >> 32) & 0xffff, (key >> 16) & 0xffff, key & 0xffff };
+            const uint16_t *pw = (len == 2) ? &w[1] : &w[0];
+            fprintf(fp, "%d %" PRIu64, len, sorted[i].count);
+            for (int j = 0; j < len; j++) {
+                fprintf(fp, " %06o", pw[j]);
+            }
+            fprintf(fp, " ;");
+            for (int j = 0; j < len; j++) {
+                char text[64];
+                disasm16(text, sizeof(text), pw[j]);
+                fprintf(fp, " %s%s", text, (j < len - 1) ? ";" : "");
+            }
+            fprintf(fp, "\n");
+        }
+        fclose(fp);
+    }
+    free(sorted);
+    // the lock ends with the fd
+    close(fd);
+    // counted once
+    profileFork(pm);
+#endif
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+struct profile_tag;
+#ifndef _PROFILE_T_
+#define _PROFILE_T_
+typedef struct profile_tag profile_t;
+#endif
+
+// counts of instruction pairs and triples (PDP-11), added to the file at the exit of each process
+int profileOpen(machine_t *pm, const char *path);
+
+// before each instruction, by the slow path of runAout()
+void profileStep(machine_t *pm, uint32_t pc);
+
+// the child of fork() counts its own instructions
+void profileFork(machine_t *pm);
+
+// the counts to the file
+void profileExit(machine_t *pm);
@@ -0,0 +1,500 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "replay.h"
+#include "machine.h"
+#include "syscall.h"
+#ifdef UU_M68K_MINIX
+#include "../m68k/src/cpu.h"
+#else
+#include "../pdp11/src/cpu.h"
+#endif
+
+/* log record:
+  replay_rec_t
+  write[0]:  vaddr, len, bytes...
+  ...
+  write[nwrites-1]
+  host state (REPLAY_EXEC only): argc, envc, argsbytes, aout, args...
+  the written image is relocated already with REPLAY_RELOCATED
+*/
+typedef struct {
+    uint32_t id;        // syscall number
+    uint32_t pc;        // at the trap
+    uint32_t args[3];   // registers and inline words at the trap
+    uint32_t ret[3];    // registers after the syscall
+    uint32_t brk;
+    uint32_t flags;
+    uint32_t nwrites;
+} replay_rec_t;
+
+#define REPLAY_LOAD   0xffffffff // pseudo syscall: the first load()
+
+#define REPLAY_FAILED 0x0001
+#define REPLAY_C      0x0002 // carry
+#define REPLAY_EXIT   0x0004 // recorded before the call
+#define REPLAY_EXEC   0x0008 // followed by host state
+#define REPLAY_RELOCATED 0x0010
+
+#define REPLAY_MIN_WRITES 8
+
+typedef struct {
+    uint32_t vaddr;
+    uint32_t len;
+} replay_write_t;
+
+struct replay_tag {
+    bool record;
+    char name[PATH_MAX];
+    int forks;
+
+    // record
+    int fd;
+    uint8_t *buf;
+    size_t bufSize;
+    // ranges written by the syscall, grown as needed
+    replay_write_t *writes;
+    int nwrites;
+    int maxWrites;
+
+    // replay
+    uint8_t *log;
+    size_t logSize;
+    size_t pos;
+};
+
+#ifdef UU_M68K_MINIX
+#define SYS_EXIT  1
+#define SYS_FORK  2
+#define SYS_WAIT  7
+#define SYS_EXEC 59
+
+static uint32_t syscallNumber(machine_t *pm) {
+    const uint8_t *msg = guestSpan(pm, getA0(pm->cpu), 24);
+    assert(msg != NULL);
+    return (msg[2] << 8) | msg[3];
+}
+
+static void syscallArgs(machine_t *pm, uint32_t *args) {
+    args[0] = getD0(pm->cpu);
+    args[1] = getD1(pm->cpu);
+    args[2] = getA0(pm->cpu);
+}
+
+static int exitStatus(machine_t *pm) {
+    const uint8_t *msg = mmuV2R(pm, getA0(pm->cpu));
+    return (msg[4] << 8) | msg[5];
+}
+
+static void syscallWrites(machine_t *pm) {
+    // the reply overwrites the message
+    guestWillWrite(pm, getA0(pm->cpu), 24);
+}
+
+static void getResult(machine_t *pm, uint32_t a0, replay_rec_t *rec) {
+    const uint8_t *msg = mmuV2R(pm, a0);
+    rec->ret[0] = getD0(pm->cpu);
+    if ((int16_t)((msg[2] << 8) | msg[3]) < 0) {
+        rec->flags |= REPLAY_FAILED;
+    }
+}
+
+static void setResult(machine_t *pm, const replay_rec_t *rec) {
+    setD0(pm->cpu, rec->ret[0]);
+}
+#else
+#define SYS_EXIT  1
+#define SYS_FORK  2
+#define SYS_WAIT  7
+#define SYS_EXEC 11
+
+static uint32_t syscallNumber(machine_t *pm) {
+    uint32_t id = pm->cpu->syscallID;
+    if (id == 0) {
+        // indir
+        const uint8_t *p = guestSpan(pm, pm->cpu->pc, 2);
+        if (p != NULL && (p = guestSpan(pm, read16(p), 2)) != NULL) {
+            id = read16(p) & 0x3f;
+        }
+    }
+    return id;
+}
+
+static void syscallArgs(machine_t *pm, uint32_t *args) {
+    const uint8_t *p = guestSpan(pm, pm->cpu->pc, 4);
+    args[0] = pm->cpu->r0;
+    args[1] = (p != NULL) ? read16(p) : 0;
+    args[2] = (p != NULL) ? read16(p + 2) : 0;
+}
+
+static int exitStatus(machine_t *pm) {
+    return (int16_t)pm->cpu->r0;
+}
+
+static void syscallWrites(machine_t *pm) {
+    // none: results are in registers
+}
+
+static void getResult(machine_t *pm, uint32_t a0, replay_rec_t *rec) {
+    rec->ret[0] = pm->cpu->r0;
+    rec->ret[1] = pm->cpu->r1;
+    rec->ret[2] = pm->cpu->pc;
+    if (isC(pm->cpu)) {
+        rec->flags |= REPLAY_C | REPLAY_FAILED;
+    }
+}
+
+static void setResult(machine_t *pm, const replay_rec_t *rec) {
+    pm->cpu->r0 = rec->ret[0];
+    pm->cpu->r1 = rec->ret[1];
+    pm->cpu->pc = rec->ret[2];
+    if (rec->flags & REPLAY_C) {
+        setC(pm->cpu);
+    } else {
+        clearC(pm->cpu);
+    }
+}
+#endif
+
+static int openLog(replay_t *pr) {
+    if (pr->record) {
+        pr->fd = open(pr->name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (pr->fd < 0) {
+            return errno;
+        }
+        return 0;
+    }
+
+    int fd = open(pr->name, O_RDONLY);
+    if (fd < 0) {
+        return errno;
+    }
+    struct stat s;
+    if (fstat(fd, &s) != 0) {
+        int e = errno;
+        close(fd);
+        return e;
+    }
+    pr->logSize = s.st_size;
+    pr->pos = 0;
+    pr->log = NULL;
+    if (pr->logSize > 0) {
+        pr->log = mmap(NULL, pr->logSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (pr->log == MAP_FAILED) {
+        pr->log = NULL;
+        return errno;
+    }
+    return 0;
+}
+
+// switch to the log of the n-th child after fork
+static void childLog(replay_t *pr) {
+    char parent[PATH_MAX];
+    strcpy(parent, pr->name);
+    int n = snprintf(pr->name, sizeof(pr->name), "%s.%d", parent, pr->forks);
+    assert(n < sizeof(pr->name));
+    pr->forks = 0;
+
+    if (pr->record) {
+        close(pr->fd);
+    } else if (pr->log != NULL) {
+        munmap(pr->log, pr->logSize);
+    }
+    int e = openLog(pr);
+    if (e != 0) {
+        fprintf(stderr, "/ [ERR] replay: %s: %s\n", pr->name, strerror(e));
+        _exit(EXIT_FAILURE);
+    }
+}
+
+int replayOpen(machine_t *pm, const char *dir, bool record) {
+    replay_t *pr = calloc(1, sizeof(replay_t));
+    if (pr == NULL) {
+        return ENOMEM;
+    }
+    pr->record = record;
+    pr->fd = -1;
+
+    if (record && mkdir(dir, 0777) != 0 && errno != EEXIST) {
+        int e = errno;
+        free(pr);
+        return e;
+    }
+    int n = snprintf(pr->name, sizeof(pr->name), "%s/0", dir);
+    if (n >= sizeof(pr->name)) {
+        free(pr);
+        return ENAMETOOLONG;
+    }
+    pr->writes = malloc(REPLAY_MIN_WRITES * sizeof(replay_write_t));
+    if (pr->writes == NULL) {
+        free(pr);
+        return ENOMEM;
+    }
+    pr->maxWrites = REPLAY_MIN_WRITES;
+    int e = openLog(pr);
+    if (e != 0) {
+        free(pr->writes);
+        free(pr);
+        return e;
+    }
+
+    pm->replay = pr;
+    return 0;
+}
+
+void replayWillWrite(replay_t *pr, uint32_t vaddr, size_t n) {
+    if (!pr->record || n == 0) {
+        return;
+    }
+    if (pr->nwrites == pr->maxWrites) {
+        replay_write_t *p = realloc(pr->writes, 2 * pr->maxWrites * sizeof(replay_write_t));
+        if (p == NULL) {
+            // the last range grows over this one: more bytes of the same memory
+            replay_write_t *pw = &pr->writes[pr->nwrites - 1];
+            const uint32_t start = (vaddr < pw->vaddr) ? vaddr : pw->vaddr;
+            const uint32_t end = (vaddr + n > pw->vaddr + pw->len) ? vaddr + n : pw->vaddr + pw->len;
+            pw->vaddr = start;
+            pw->len = end - start;
+            return;
+        }
+        pr->writes = p;
+        pr->maxWrites *= 2;
+    }
+    pr->writes[pr->nwrites].vaddr = vaddr;
+    pr->writes[pr->nwrites].len = n;
+    pr->nwrites++;
+}
+
+
+//////////////////////////
+// record
+//////////////////////////
+static void append(replay_t *pr, size_t *pn, const void *src, size_t n) {
+    if (*pn + n > pr->bufSize) {
+        size_t size = (pr->bufSize == 0) ? 4096 : pr->bufSize;
+        while (*pn + n > size) {
+            size *= 2;
+        }
+        uint8_t *buf = realloc(pr->buf, size);
+        assert(buf != NULL);
+        pr->buf = buf;
+        pr->bufSize = size;
+    }
+    memcpy(pr->buf + *pn, src, n);
+    *pn += n;
+}
+
+// write the record with the current contents of the written ranges
+static void writeRecord(machine_t *pm, replay_rec_t *rec) {
+    replay_t *pr = pm->replay;
+    size_t n = 0;
+
+    rec->nwrites = pr->nwrites;
+    if ((rec->flags & REPLAY_EXEC) && pm->relocated) {
+        rec->flags |= REPLAY_RELOCATED;
+    }
+    append(pr, &n, rec, sizeof(*rec));
+    for (int i = 0; i < pr->nwrites; i++) {
+        uint32_t vaddr = pr->writes[i].vaddr;
+        uint32_t len = pr->writes[i].len;
+        if (vaddr > GUEST_MEMORY_SIZE) {
+            vaddr = GUEST_MEMORY_SIZE;
+        }
+        if (len > GUEST_MEMORY_SIZE - vaddr) {
+            len = GUEST_MEMORY_SIZE - vaddr;
+        }
+        append(pr, &n, &vaddr, sizeof(vaddr));
+        append(pr, &n, &len, sizeof(len));
+        append(pr, &n, mmuV2R(pm, vaddr), len);
+    }
+    if (rec->flags & REPLAY_EXEC) {
+        uint32_t argc = pm->argc;
+        uint32_t envc = pm->envc;
+        uint32_t argsbytes = pm->argsbytes;
+        append(pr, &n, &argc, sizeof(argc));
+        append(pr, &n, &envc, sizeof(envc));
+        append(pr, &n, &argsbytes, sizeof(argsbytes));
+        append(pr, &n, &pm->aout, sizeof(pm->aout));
+        append(pr, &n, pm->args, argsbytes);
+    }
+    pr->nwrites = 0;
+
+    // one write per record: no buffer is duplicated by fork
+    ssize_t sret = write(pr->fd, pr->buf, n);
+    if (sret != n) {
+        fprintf(stderr, "/ [ERR] replay: %s: %s\n", pr->name, strerror(errno));
+        _exit(EXIT_FAILURE);
+    }
+}
+
+static void recordSyscall(machine_t *pm, replay_rec_t *rec) {
+    replay_t *pr = pm->replay;
+    pr->nwrites = 0;
+
+    if (rec->id == SYS_EXIT) {
+        rec->flags |= REPLAY_EXIT;
+        rec->ret[0] = exitStatus(pm);
+        writeRecord(pm, rec);
+        mysyscall16(pm);
+        // never reach
+        return;
+    }
+    if (rec->id == SYS_EXEC) {
+        rec->flags |= REPLAY_EXEC;
+    }
+
+    const uint32_t a0 = rec->args[2];
+    const pid_t self = getpid();
+    syscallWrites(pm);
+    mysyscall16(pm);
+    if (rec->id == SYS_FORK) {
+        if (getpid() != self) {
+            childLog(pr);
+        } else {
+            pr->forks++;
+        }
+    }
+
+    getResult(pm, a0, rec);
+    rec->brk = pm->brk;
+    writeRecord(pm, rec);
+}
+
+
+//////////////////////////
+// replay
+//////////////////////////
+static const void *consume(replay_t *pr, size_t n) {
+    if (pr->log == NULL || n > pr->logSize - pr->pos) {
+        fprintf(stderr, "/ [ERR] replay: %s: unexpected end of log\n", pr->name);
+        _exit(EXIT_FAILURE);
+    }
+    const void *p = pr->log + pr->pos;
+    pr->pos += n;
+    return p;
+}
+
+static void readRecord(replay_t *pr, replay_rec_t *rec) {
+    memcpy(rec, consume(pr, sizeof(*rec)), sizeof(*rec));
+}
+
+// apply the rest of the record to the machine
+static void applyRecord(machine_t *pm, const replay_rec_t *rec) {
+    replay_t *pr = pm->replay;
+
+    if (rec->flags & REPLAY_EXEC) {
+        // the new image, as load()
+        guestLimit(pm, GUEST_MEMORY_SIZE);
+    }
+    for (uint32_t i = 0; i < rec->nwrites; i++) {
+        uint32_t vaddr, len;
+        memcpy(&vaddr, consume(pr, sizeof(vaddr)), sizeof(vaddr));
+        memcpy(&len, consume(pr, sizeof(len)), sizeof(len));
+        const void *src = consume(pr, len);
+        assert(vaddr <= GUEST_MEMORY_SIZE && len <= GUEST_MEMORY_SIZE - vaddr);
+        memcpy(mmuV2R(pm, vaddr), src, len);
+    }
+    if (rec->flags & REPLAY_EXEC) {
+        uint32_t argc, envc, argsbytes;
+        memcpy(&argc, consume(pr, sizeof(argc)), sizeof(argc));
+        memcpy(&envc, consume(pr, sizeof(envc)), sizeof(envc));
+        memcpy(&argsbytes, consume(pr, sizeof(argsbytes)), sizeof(argsbytes));
+        memcpy(&pm->aout, consume(pr, sizeof(pm->aout)), sizeof(pm->aout));
+        assert(argsbytes <= sizeof(pm->args));
+        memcpy(pm->args, consume(pr, argsbytes), argsbytes);
+        pm->argc = argc;
+        pm->envc = envc;
+        pm->argsbytes = argsbytes;
+        pm->sizeOfVM = guestSize(pm);
+        pm->runLimit = 0;
+        pm->relocated = (rec->flags & REPLAY_RELOCATED) != 0;
+    }
+    if (rec->id != REPLAY_LOAD) {
+        pm->brk = rec->brk;
+        setResult(pm, rec);
+    }
+}
+
+static void replaySyscallFromLog(machine_t *pm, const replay_rec_t *cur) {
+    replay_t *pr = pm->replay;
+    replay_rec_t rec;
+    readRecord(pr, &rec);
+    if (rec.id != cur->id || rec.pc != cur->pc) {
+        fprintf(stderr, "/ [ERR] replay: %s: diverged at syscall %d (pc=%08x), log has %d (pc=%08x)\n",
+            pr->name, cur->id, cur->pc, rec.id, rec.pc);
+        _exit(EXIT_FAILURE);
+    }
+
+    if (rec.flags & REPLAY_EXIT) {
+        _exit(rec.ret[0]);
+    }
+    if (rec.id == SYS_FORK && !(rec.flags & REPLAY_FAILED)) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "/ [ERR] replay: fork: %s\n", strerror(errno));
+            _exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            // the child continues with its own log
+            childLog(pr);
+            readRecord(pr, &rec);
+            assert(rec.id == SYS_FORK);
+        } else {
+            pr->forks++;
+        }
+    } else if (rec.id == SYS_WAIT && !(rec.flags & REPLAY_FAILED)) {
+        // reap the replayed child, the status comes from the log
+        wait(NULL);
+    }
+    applyRecord(pm, &rec);
+}
+
+void replaySyscall(machine_t *pm) {
+    replay_rec_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.id = syscallNumber(pm);
+    rec.pc = getPC(pm->cpu);
+    syscallArgs(pm, rec.args);
+
+    if (pm->replay->record) {
+        recordSyscall(pm, &rec);
+    } else {
+        replaySyscallFromLog(pm, &rec);
+    }
+}
+
+int replayLoad(machine_t *pm, const char *src) {
+    replay_t *pr = pm->replay;
+    replay_rec_t rec;
+
+    if (!pr->record) {
+        readRecord(pr, &rec);
+        if (rec.id != REPLAY_LOAD) {
+            fprintf(stderr, "/ [ERR] replay: %s: no initial load\n", pr->name);
+            _exit(EXIT_FAILURE);
+        }
+        applyRecord(pm, &rec);
+        return rec.ret[0];
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.id = REPLAY_LOAD;
+    rec.flags = REPLAY_EXEC;
+    pr->nwrites = 0;
+    int ret = load(pm, src);
+    rec.ret[0] = ret;
+    writeRecord(pm, &rec);
+    return ret;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+struct replay_tag;
+#ifndef _REPLAY_T_
+#define _REPLAY_T_
+typedef struct replay_tag replay_t;
+#endif
+
+// syscall log, one file per guest process: dir/0, dir/0.0, dir/0.1, ...
+int replayOpen(machine_t *pm, const char *dir, bool record);
+
+// load() of the first aout, recorded or replayed
+int replayLoad(machine_t *pm, const char *src);
+
+// syscall handler in place of mysyscall16()
+void replaySyscall(machine_t *pm);
+
+// host code is about to store into [vaddr, vaddr+n) of the guest
+void replayWillWrite(replay_t *pr, uint32_t vaddr, size_t n);
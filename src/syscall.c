@@ -13,9 +13,15 @@
 #include <sys/wait.h>
 #include <sys/times.h>
 #include <signal.h>
+#include <poll.h>
 
 #include "syscall.h"
 #include "machine.h"
+#include "memo.h"
+#include "v6fs.h"
+#include "proc.h"
+#include "checkpoint.h"
+#include "profile.h"
 #ifdef UU_M68K_MINIX
 #include "../m68k/src/cpu.h"
 #else
@@ -26,6 +32,48 @@
 // for debug
 #define MY_STRACE 0
 
+// host calls, or the callbacks of libuuinterp
+static ssize_t hostRead(machine_t *pm, int fd, void *buf, size_t n) {
+    if (pm->io != NULL && pm->io->read != NULL && fd >= 0 && fd <= STDERR_FILENO) {
+        return pm->io->read(pm->io->ctx, fd, buf, n);
+    }
+    return read(fd, buf, n);
+}
+
+static ssize_t hostWrite(machine_t *pm, int fd, const void *buf, size_t n) {
+    if (pm->io != NULL && pm->io->write != NULL && fd >= 0 && fd <= STDERR_FILENO) {
+        return pm->io->write(pm->io->ctx, fd, buf, n);
+    }
+    return write(fd, buf, n);
+}
+
+static int hostOpen(machine_t *pm, const char *path, int flags, mode_t mode) {
+    if (pm->io != NULL && pm->io->open != NULL) {
+        return pm->io->open(pm->io->ctx, path, flags, mode);
+    }
+    return open(path, flags, mode);
+}
+
+// exit() of the guest in libuuinterp: runAout() returns as after exec(), true if so
+static bool embeddedExit(machine_t *pm, int status) {
+    if (pm->io == NULL) {
+        return false;
+    }
+    pm->exited = true;
+    pm->exitStatus = status;
+
+    // goto the end of the memory
+    const uint32_t eom = pm->sizeOfVM - 1;
+#ifdef UU_M68K_MINIX
+    uint32_t isp = getISP(pm->cpu);
+    guestWillWrite(pm, isp+2, 4);
+    guestStore32BE(pm, isp+2, eom);
+#else
+    pm->cpu->pc = eom & 0xffff;
+#endif
+    return true;
+}
+
 #ifdef UU_M68K_MINIX
 static void convstat(uint8_t *pi, const struct stat* ps) {
     /* st_mode:
@@ -40,39 +88,13 @@ static void convstat(uint8_t *pi, const struct stat* ps) {
                             // next is reserved for future use
     #define S_ISVTX   01000 // save swapped text even after use
     */
-    pi[0] = (ps->st_dev >> 8) & 0xff; // pseudo
-    pi[1] = ps->st_dev & 0xff; // pseudo
-    pi[2] = (ps->st_ino >> 8) & 0xff;
-    pi[3] = ps->st_ino & 0xff;
-    pi[4] = (ps->st_mode >> 8) & 0xff;
-    pi[5] = ps->st_mode & 0xff;
-    pi[6] = (ps->st_nlink >>8) & 0xff;
-    pi[7] = ps->st_nlink & 0xff;
-    pi[8] = (ps->st_uid >> 8) & 0xff;
-    pi[9] = ps->st_uid & 0xff;
-    pi[10] = (ps->st_gid >> 8) & 0xff;
-    pi[11] = ps->st_gid & 0xff;
-    pi[12] = (ps->st_rdev >> 8) & 0xff;
-    pi[13] = ps->st_rdev & 0xff;
-    pi[14] = (ps->st_size >> 24) & 0xff;
-    pi[15] = (ps->st_size >> 16) & 0xff;
-    pi[16] = (ps->st_size >> 8) & 0xff;
-    pi[17] = ps->st_size & 0xff;
-    // atime
-    pi[18] = (ps->st_atime >> 24) & 0xff;
-    pi[19] = (ps->st_atime >> 16) & 0xff;
-    pi[20] = (ps->st_atime >> 8) & 0xff;
-    pi[21] = ps->st_atime & 0xff;
-    // mtime
-    pi[22] = (ps->st_mtime >> 24) & 0xff;
-    pi[23] = (ps->st_mtime >> 16) & 0xff;
-    pi[24] = (ps->st_mtime >> 8) & 0xff;
-    pi[25] = ps->st_mtime & 0xff;
-    // ctime
-    pi[26] = (ps->st_ctime >> 24) & 0xff;
-    pi[27] = (ps->st_ctime >> 16) & 0xff;
-    pi[28] = (ps->st_ctime >> 8) & 0xff;
-    pi[29] = ps->st_ctime & 0xff;
+    // dev (pseudo), ino, mode, nlink, uid, gid, rdev; size, atime, mtime, ctime
+    static const uint8_t widths[] = { 2, 2, 2, 2, 2, 2, 2, 4, 4, 4, 4 };
+    const uint32_t values[] = {
+        ps->st_dev, ps->st_ino, ps->st_mode, ps->st_nlink, ps->st_uid, ps->st_gid, ps->st_rdev,
+        ps->st_size, ps->st_atime, ps->st_mtime, ps->st_ctime,
+    };
+    packBE(pi, widths, values, 11);
 }
 
 #define M1                 1
@@ -80,63 +102,76 @@ static void convstat(uint8_t *pi, const struct stat* ps) {
 #define M4                 4
 #define M3_STRING         14
 
-typedef struct {uint16_t m1i1, m1i2, m1i3; uint8_t *m1p1, *m1p2, *m1p3;} mess_1;
-typedef struct {uint16_t m2i1, m2i2, m2i3; uint32_t m2l1, m2l2; uint8_t *m2p1;} mess_2;
-typedef struct {uint16_t m3i1, m3i2; uint8_t *m3p1; char m3ca1[M3_STRING];} mess_3;
-typedef struct {uint32_t m4l1, m4l2, m4l3, m4l4;} mess_4;
-typedef struct {uint8_t m5c1, m5c2; int m5i1, m5i2; uint32_t m5l1, m5l2, m5l3;} mess_5;
-typedef struct {uint16_t m6i1, m6i2, m6i3; uint32_t m6l1; uintptr_t m6f1;} mess_6;
+/* message (big endian) in the guest memory:
+  +0   m_source: who sent the message
+  +2   m_type:   what kind of message is it
+  +4   m_u:      mess_1 ... mess_6
+
+  typedef struct {int m1i1, m1i2, m1i3; char *m1p1, *m1p2, *m1p3;} mess_1;
+  typedef struct {int m2i1, m2i2, m2i3; long m2l1, m2l2; char *m2p1;} mess_2;
+  typedef struct {int m3i1, m3i2; char *m3p1; char m3ca1[M3_STRING];} mess_3;
+  typedef struct {int m6i1, m6i2, m6i3; long m6l1; int (*m6f1)();} mess_6;
 
-typedef struct {
-  uint16_t m_source;                 /* who sent the message */
-  uint16_t m_type;                   /* what kind of message is it */
-  union {
-        mess_1 m_m1;
-        mess_2 m_m2;
-        mess_3 m_m3;
-        mess_4 m_m4;
-        mess_5 m_m5;
-        mess_6 m_m6;
-  } m_u;
-} message;
+  int is 16-bit, long and pointers are 32-bit guest addresses.
+*/
+#define MESSAGE_SIZE      24
 
-#define m1_i1  m_u.m_m1.m1i1
-#define m1_i2  m_u.m_m1.m1i2
-#define m1_i3  m_u.m_m1.m1i3
-#define m1_p1  m_u.m_m1.m1p1
-#define m1_p2  m_u.m_m1.m1p2
-#define m1_p3  m_u.m_m1.m1p3
+#define M_SOURCE           0
+#define M_TYPE             2
 
-#define m2_i1  m_u.m_m2.m2i1
-#define m2_i2  m_u.m_m2.m2i2
-#define m2_i3  m_u.m_m2.m2i3
-#define m2_l1  m_u.m_m2.m2l1
-#define m2_l2  m_u.m_m2.m2l2
-#define m2_p1  m_u.m_m2.m2p1
+#define M1_I1              4
+#define M1_I2              6
+#define M1_I3              8
+#define M1_P1             10
+#define M1_P2             14
+#define M1_P3             18
 
-#define m3_i1  m_u.m_m3.m3i1
-#define m3_i2  m_u.m_m3.m3i2
-#define m3_p1  m_u.m_m3.m3p1
-#define m3_ca1 m_u.m_m3.m3ca1
+#define M2_I1              4
+#define M2_I2              6
+#define M2_I3              8
+#define M2_L1             10
+#define M2_L2             14
+#define M2_P1             18
 
-#define m4_l1  m_u.m_m4.m4l1
-#define m4_l2  m_u.m_m4.m4l2
-#define m4_l3  m_u.m_m4.m4l3
-#define m4_l4  m_u.m_m4.m4l4
+#define M3_I1              4
+#define M3_I2              6
+#define M3_P1              8
+#define M3_CA1            12
+
+#define M6_I1              4
+#define M6_I2              6
+#define M6_I3              8
+#define M6_L1             10
+#define M6_F1             14
+
+// typed views of the message fields, in place
+static inline uint16_t mget16(const uint8_t *m, int off) {
+    return read16BE(&m[off]);
+}
+static inline uint32_t mget32(const uint8_t *m, int off) {
+    return read32(&m[off]);
+}
+static inline void mset16(uint8_t *m, int off, uint16_t data) {
+    write16BE(&m[off], data);
+}
+static inline void mset32(uint8_t *m, int off, uint32_t data) {
+    write32(&m[off], data);
+}
 
-#define m5_c1  m_u.m_m5.m5c1
-#define m5_c2  m_u.m_m5.m5c2
-#define m5_i1  m_u.m_m5.m5i1
-#define m5_i2  m_u.m_m5.m5i2
-#define m5_l1  m_u.m_m5.m5l1
-#define m5_l2  m_u.m_m5.m5l2
-#define m5_l3  m_u.m_m5.m5l3
+// pointer field -> host span of len bytes, NULL if it leaves the guest
+static inline uint8_t *mgetp(machine_t *pm, const uint8_t *m, int off, size_t len) {
+    return guestSpan(pm, mget32(m, off), len);
+}
 
-#define m6_i1  m_u.m_m6.m6i1
-#define m6_i2  m_u.m_m6.m6i2
-#define m6_i3  m_u.m_m6.m6i3
-#define m6_l1  m_u.m_m6.m6l1
-#define m6_f1  m_u.m_m6.m6f1
+// string field, NULL if it isn't terminated inside the guest
+static inline const char *mgets(machine_t *pm, const uint8_t *m, int off) {
+    uint32_t vaddr = mget32(m, off);
+    ssize_t len = guestStrnlen(pm, vaddr, PATH_MAX);
+    if (len < 0 || len >= PATH_MAX) {
+        return NULL;
+    }
+    return (const char *)mmuV2R(pm, vaddr);
+}
 
 
 #define MM                 0
@@ -154,113 +189,7 @@ typedef struct {
 #define TIOCFLUSH (('t'<<8) | 16)
 
 
-void setM1(message *m, uint32_t vraw, machine_t *pm) {
-    uint16_t vaddrH, vaddrL;
-    uint32_t vaddr;
-
-    m->m_source = ntohs(*(uint16_t *)mmuV2R(pm, vraw+0));
-    m->m_type = ntohs(*(uint16_t *)mmuV2R(pm, vraw+2));
-
-    m->m1_i1 = ntohs(*(uint16_t *)mmuV2R(pm, vraw+4));
-    m->m1_i2 = ntohs(*(uint16_t *)mmuV2R(pm, vraw+6));
-    m->m1_i3 = ntohs(*(uint16_t *)mmuV2R(pm, vraw+8));
-
-    vaddrH = ntohs(*(uint16_t *)mmuV2R(pm, vraw+10));
-    vaddrL = ntohs(*(uint16_t *)mmuV2R(pm, vraw+12));
-    vaddr = (vaddrH << 16) | vaddrL;
-    m->m1_p1 = mmuV2R(pm, vaddr);
-
-    vaddrH = ntohs(*(uint16_t *)mmuV2R(pm, vraw+14));
-    vaddrL = ntohs(*(uint16_t *)mmuV2R(pm, vraw+16));
-    vaddr = (vaddrH << 16) | vaddrL;
-    m->m1_p2 = mmuV2R(pm, vaddr);
-
-    vaddrH = ntohs(*(uint16_t *)mmuV2R(pm, vraw+18));
-    vaddrL = ntohs(*(uint16_t *)mmuV2R(pm, vraw+20));
-    vaddr = (vaddrH << 16) | vaddrL;
-    m->m1_p3 = mmuV2R(pm, vaddr);
-
-    return;
-}
-
-void setM2(message *m, uint32_t vraw, machine_t *pm) {
-    uint16_t hi, lo;
-    uint16_t vaddrH, vaddrL;
-    uint32_t vaddr;
-
-    m->m_source = ntohs(*(uint16_t *)mmuV2R(pm, vraw+0));
-    m->m_type = ntohs(*(uint16_t *)mmuV2R(pm, vraw+2));
-
-    m->m2_i1 = ntohs(*(uint16_t *)mmuV2R(pm, vraw+4));
-    m->m2_i2 = ntohs(*(uint16_t *)mmuV2R(pm, vraw+6));
-    m->m2_i3 = ntohs(*(uint16_t *)mmuV2R(pm, vraw+8));
-
-    hi = ntohs(*(uint16_t *)mmuV2R(pm, vraw+10));
-    lo = ntohs(*(uint16_t *)mmuV2R(pm, vraw+12));
-    m->m2_l1 = (hi << 16) | lo;
-
-    hi = ntohs(*(uint16_t *)mmuV2R(pm, vraw+14));
-    lo = ntohs(*(uint16_t *)mmuV2R(pm, vraw+16));
-    m->m2_l2 = (hi << 16) | lo;
-
-    vaddrH = ntohs(*(uint16_t *)mmuV2R(pm, vraw+18));
-    vaddrL = ntohs(*(uint16_t *)mmuV2R(pm, vraw+20));
-    vaddr = (vaddrH << 16) | vaddrL;
-    // TODO: don't touch an uninitialized pointer
-    vaddr = 0;
-    m->m2_p1 = mmuV2R(pm, vaddr);
-
-    return;
-}
-
-void setM3(message *m, uint32_t vraw, machine_t *pm) {
-    uint16_t vaddrH, vaddrL;
-    uint32_t vaddr;
-
-    m->m_source = ntohs(*(uint16_t *)mmuV2R(pm, vraw+0));
-    m->m_type = ntohs(*(uint16_t *)mmuV2R(pm, vraw+2));
-
-    m->m3_i1 = ntohs(*(uint16_t *)mmuV2R(pm, vraw+4));
-    m->m3_i2 = ntohs(*(uint16_t *)mmuV2R(pm, vraw+6));
-
-    vaddrH = ntohs(*(uint16_t *)mmuV2R(pm, vraw+8));
-    vaddrL = ntohs(*(uint16_t *)mmuV2R(pm, vraw+10));
-    vaddr = (vaddrH << 16) | vaddrL;
-    m->m3_p1 = mmuV2R(pm, vaddr);
-
-    const uint8_t *src = mmuV2R(pm, vraw+12);
-    memcpy(m->m3_ca1, src, M3_STRING);
-
-    return;
-}
-
-void setM6(message *m, uint32_t vraw, machine_t *pm) {
-    uint16_t hi, lo;
-    uint16_t vaddrH, vaddrL;
-    uint32_t vaddr;
-
-    m->m_source = ntohs(*(uint16_t *)mmuV2R(pm, vraw+0));
-    m->m_type = ntohs(*(uint16_t *)mmuV2R(pm, vraw+2));
-
-    m->m6_i1 = ntohs(*(uint16_t *)mmuV2R(pm, vraw+4));
-    m->m6_i2 = ntohs(*(uint16_t *)mmuV2R(pm, vraw+6));
-    m->m6_i3 = ntohs(*(uint16_t *)mmuV2R(pm, vraw+8));
-
-    hi = ntohs(*(uint16_t *)mmuV2R(pm, vraw+10));
-    lo = ntohs(*(uint16_t *)mmuV2R(pm, vraw+12));
-    m->m6_l1 = (hi << 16) | lo;
-
-    vaddrH = ntohs(*(uint16_t *)mmuV2R(pm, vraw+14));
-    vaddrL = ntohs(*(uint16_t *)mmuV2R(pm, vraw+16));
-    vaddr = (vaddrH << 16) | vaddrL;
-    m->m6_f1 = vaddr;
-
-    return;
-}
-
 void mysyscall16(machine_t *pm) {
-    message m;
-
     const char *name, *name2;
     char path0[PATH_MAX], path1[PATH_MAX];
     mode_t mode;
@@ -282,18 +211,11 @@ void mysyscall16(machine_t *pm) {
     uint32_t vraw = getA0(pm->cpu);
     assert((vraw & 1) == 0); // alignment
 
-    // reply
-    uint16_t *pBE_reply_type = (uint16_t *)(mmuV2R(pm, vraw+2));
-    // FS
-    uint16_t *pBE_reply_i2 = (uint16_t *)(mmuV2R(pm, vraw+6));
-    uint16_t *pBE_reply_l1_hi = (uint16_t *)(mmuV2R(pm, vraw+10));
-    uint16_t *pBE_reply_l1_lo = (uint16_t *)(mmuV2R(pm, vraw+12));
-    // MM
-    uint16_t *pBE_reply_i1 = (uint16_t *)(mmuV2R(pm, vraw+4));
-    uint16_t *pBE_reply_p1_hi = (uint16_t *)(mmuV2R(pm, vraw+18));
-    uint16_t *pBE_reply_p1_lo = (uint16_t *)(mmuV2R(pm, vraw+20));
+    // request and reply share the message
+    uint8_t *msg = guestSpan(pm, vraw, MESSAGE_SIZE);
+    assert(msg != NULL);
 
-    uint16_t syscallID = ntohs(*pBE_reply_type);
+    uint16_t syscallID = mget16(msg, M_TYPE);
 #if MY_STRACE
     if (syscallID != 4) {
         fprintf(stderr, "/ syscall: %d\n", syscallID);
@@ -303,25 +225,37 @@ void mysyscall16(machine_t *pm) {
     case 1:
         // exit
         assert(mmfs == MM);
-        setM1(&m, vraw, pm);
-        int status = m.m1_i1;
+        {
+            int status = mget16(msg, M1_I1);
 #if MY_STRACE
-        fprintf(stderr, "/ _exit(%d)\n", status);
+            fprintf(stderr, "/ _exit(%d)\n", status);
 #endif
-        _exit(status);
+            memoExit(pm, status);
+            profileExit(pm);
+            vtimeExit(pm);
+            budgetExit(pm);
+            if (embeddedExit(pm, status)) {
+                break;
+            }
+            _exit(status);
+        }
         break;
     case 2:
         // fork
         assert(mmfs == MM);
-        setM1(&m, vraw, pm);
 #if MY_STRACE
         fprintf(stderr, "/ fork()\n");
 #endif
+        memoTaint(pm, "fork");
         pid = fork();
         if (pid < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(pid & 0x7fff); // valid 15-bit only
+            if (pid == 0) {
+                vtimeFork(pm);
+                budgetFork(pm);
+            }
+            mset16(msg, M_TYPE, pid & 0x7fff); // valid 15-bit only
 #if MY_STRACE
             fprintf(stderr, "/ [DBG] fork pid: %5d pid15: %5d (pc: %08x)\n", pid, pid&0x7fff, getPC(pm->cpu));
 #endif
@@ -330,13 +264,18 @@ void mysyscall16(machine_t *pm) {
     case 3:
         // read
         assert(mmfs == FS);
-        setM1(&m, vraw, pm);
-        fd = m.m1_i1;
-        buf = m.m1_p1;
-        nbytes = m.m1_i2;
+        fd = (int16_t)mget16(msg, M1_I1);
+        nbytes = mget16(msg, M1_I2);
+        buf = mgetp(pm, msg, M1_P1, nbytes);
 #if MY_STRACE
-        fprintf(stderr, "/ read(%d, %08x, %ld)\n", fd, mmuR2V(pm, buf), nbytes);
+        fprintf(stderr, "/ read(%d, %08x, %ld)\n", fd, mget32(msg, M1_P1), nbytes);
 #endif
+        if (buf == NULL) {
+            mset16(msg, M_TYPE, -EFAULT & 0xffff);
+            break;
+        }
+        guestWillWrite(pm, mget32(msg, M1_P1), nbytes);
+        memoRead(pm, fd);
         if (pm->dirfd != -1 && pm->dirp != NULL && fd == pm->dirfd) {
             // dir
             assert((nbytes & 0xf) == 0);
@@ -368,58 +307,65 @@ void mysyscall16(machine_t *pm) {
             }
         } else {
             // file
-            sret = read(fd, buf, nbytes);
+            sret = hostRead(pm, fd, buf, nbytes);
         }
         if (sret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(sret & 0xffff);
+            mset16(msg, M_TYPE, sret & 0xffff);
         }
         break;
     case 4:
         // write
         assert(mmfs == FS);
-        setM1(&m, vraw, pm);
-        fd = m.m1_i1;
-        buf = m.m1_p1;
-        nbytes = m.m1_i2;
+        fd = (int16_t)mget16(msg, M1_I1);
+        nbytes = mget16(msg, M1_I2);
+        buf = mgetp(pm, msg, M1_P1, nbytes);
 #if MY_STRACE
         if (fd != STDOUT_FILENO && fd != STDERR_FILENO) {
-            fprintf(stderr, "/ write(%d, %08x, %ld)\n", fd, mmuR2V(pm, buf), nbytes);
+            fprintf(stderr, "/ write(%d, %08x, %ld)\n", fd, mget32(msg, M1_P1), nbytes);
         }
 #endif
-        sret = write(fd, buf, nbytes);
+        if (buf == NULL) {
+            mset16(msg, M_TYPE, -EFAULT & 0xffff);
+            break;
+        }
+        sret = hostWrite(pm, fd, buf, nbytes);
+        memoWrite(pm, fd, buf, sret);
         if (sret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(sret & 0xffff);
+            mset16(msg, M_TYPE, sret & 0xffff);
         }
         break;
     case 5:
         // open
         assert(mmfs == FS);
         // common for M1 and M3
-        flags = ntohs(*pBE_reply_i2);
+        flags = mget16(msg, M1_I2);
         if (flags & O_CREAT) {
-            setM1(&m, vraw, pm);
-            mode = m.m1_i3;
-            name = (const char *)m.m1_p1;
+            mode = mget16(msg, M1_I3);
+            name = mgets(pm, msg, M1_P1);
         } else {
-            setM3(&m, vraw, pm);
             mode = 0;
-            name = (const char *)m.m3_p1;
+            name = mgets(pm, msg, M3_P1);
+        }
+        if (name == NULL) {
+            mset16(msg, M_TYPE, -EFAULT & 0xffff);
+            break;
         }
         addroot(path0, sizeof(path0), name, pm->rootdir);
 #if MY_STRACE
         // common for M1 and M3
-        int len = ntohs(*pBE_reply_i1);
+        int len = mget16(msg, M1_I1);
         fprintf(stderr, "/ open(\"%s\", %d, %06o) // name len=%d, full=%s\n", name, flags, mode, len, path0);
 #endif
-        ret = open(path0, flags, mode);
+        ret = hostOpen(pm, path0, flags, mode);
+        memoInput(pm, name, flags, ret);
         if (ret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(ret & 0xffff);
+            mset16(msg, M_TYPE, ret & 0xffff);
 
             // check file or dir
             fd = ret;
@@ -429,7 +375,7 @@ void mysyscall16(machine_t *pm) {
                 // dir
                 DIR *dirp = fdopendir(fd);
                 if (dirp == NULL) {
-                    *pBE_reply_type = htons(-errno & 0xffff);
+                    mset16(msg, M_TYPE, -errno & 0xffff);
                     close(fd);
                 } else {
                     // TODO: support only one dir per process, currently
@@ -444,8 +390,7 @@ void mysyscall16(machine_t *pm) {
     case 6:
         // close
         assert(mmfs == FS);
-        setM1(&m, vraw, pm);
-        fd = m.m1_i1;
+        fd = (int16_t)mget16(msg, M1_I1);
 #if MY_STRACE
         fprintf(stderr, "/ close(%d)\n", fd);
 #endif
@@ -458,100 +403,111 @@ void mysyscall16(machine_t *pm) {
             // file
             ret = close(fd);
         }
+        memoClose(pm, fd);
         if (ret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(ret & 0xffff);
+            mset16(msg, M_TYPE, ret & 0xffff);
         }
         break;
     case 7:
         // wait
         assert(mmfs == MM);
-        setM1(&m, vraw, pm);
 #if MY_STRACE
         fprintf(stderr, "/ wait(&status)\n");
 #endif
-        int wstatus;
-        pid = wait(&wstatus);
-        if (pid < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
-        } else {
-            *pBE_reply_type = htons(pid & 0x7fff); // valid 15-bit only
-            *pBE_reply_i1 = htons(wstatus & 0xffff);
+        memoTaint(pm, "wait");
+        {
+            int wstatus;
+            pid = wait(&wstatus);
+            if (pid < 0) {
+                mset16(msg, M_TYPE, -errno & 0xffff);
+            } else {
+                vtimeWait(pm, pid);
+                mset16(msg, M_TYPE, pid & 0x7fff); // valid 15-bit only
+                mset16(msg, M2_I1, wstatus & 0xffff);
 #if MY_STRACE
-            fprintf(stderr, "/ [DBG] wait pid: %d pid15: %d status: %04x\n", pid, pid&0x7fff, wstatus);
+                fprintf(stderr, "/ [DBG] wait pid: %d pid15: %d status: %04x\n", pid, pid&0x7fff, wstatus);
 #endif
+            }
         }
         break;
     case 8:
         // creat
         assert(mmfs == FS);
-        setM3(&m, vraw, pm);
-        //size_t len = m.m3_i1;
-        mode = m.m3_i2;
-        name = (const char *)m.m3_p1; // long and short
-        //name = (const char *)&m.m3_ca1[0]; // short only
+        mode = mget16(msg, M3_I2);
+        name = mgets(pm, msg, M3_P1); // long and short
+        if (name == NULL) {
+            mset16(msg, M_TYPE, -EFAULT & 0xffff);
+            break;
+        }
         addroot(path0, sizeof(path0), name, pm->rootdir);
 #if MY_STRACE
-        fprintf(stderr, "/ creat(\"%s\", %06o) // name len=%d, full=%s\n", name, mode, m.m3_i1, path0);
+        fprintf(stderr, "/ creat(\"%s\", %06o) // name len=%d, full=%s\n", name, mode, mget16(msg, M3_I1), path0);
 #endif
-        ret = creat(path0, mode);
+        ret = hostOpen(pm, path0, O_WRONLY | O_CREAT | O_TRUNC, mode);
+        memoInput(pm, name, O_WRONLY | O_CREAT | O_TRUNC, ret);
         if (ret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(ret & 0xffff);
+            mset16(msg, M_TYPE, ret & 0xffff);
         }
         break;
     case 9:
         // link
         assert(mmfs == FS);
-        setM1(&m, vraw, pm);
-        //size_t len = m.m1_i1;
-        //size_t len2 = m.m1_i2;
-        name = (const char *)m.m1_p1;
-        name2 = (const char *)m.m1_p2;
+        name = mgets(pm, msg, M1_P1);
+        name2 = mgets(pm, msg, M1_P2);
+        if (name == NULL || name2 == NULL) {
+            mset16(msg, M_TYPE, -EFAULT & 0xffff);
+            break;
+        }
         addroot(path0, sizeof(path0), name, pm->rootdir);
         addroot(path1, sizeof(path1), name2, pm->rootdir);
 #if MY_STRACE
-        fprintf(stderr, "/ link(\"%s\", \"%s\") // name len=%d, full=%s, len2=%d, full2=%s\n", name, name2, m.m1_i1, path0, m.m1_i2, path1);
+        fprintf(stderr, "/ link(\"%s\", \"%s\") // name len=%d, full=%s, len2=%d, full2=%s\n", name, name2, mget16(msg, M1_I1), path0, mget16(msg, M1_I2), path1);
 #endif
+        memoLookup(pm, name);
+        memoOutput(pm, name2);
         ret = link(path0, path1);
         if (ret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(ret & 0xffff);
+            mset16(msg, M_TYPE, ret & 0xffff);
         }
         break;
     case 10:
         // unlink
         assert(mmfs == FS);
-        setM3(&m, vraw, pm);
-        //size_t len = m.m3_i1;
-        //uint16_t zero = m.m3_i2;
-        name = (const char *)m.m3_p1; // long and short
-        //name = (const char *)&m.m3_ca1[0]; // short only
+        name = mgets(pm, msg, M3_P1); // long and short
+        if (name == NULL) {
+            mset16(msg, M_TYPE, -EFAULT & 0xffff);
+            break;
+        }
         addroot(path0, sizeof(path0), name, pm->rootdir);
 #if MY_STRACE
-        fprintf(stderr, "/ unlink(\"%s\") // name len=%d, full=%s\n", name, m.m3_i1, path0);
+        fprintf(stderr, "/ unlink(\"%s\") // name len=%d, full=%s\n", name, mget16(msg, M3_I1), path0);
 #endif
+        memoOutput(pm, name);
         ret = unlink(path0);
         if (ret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(ret & 0xffff);
+            mset16(msg, M_TYPE, ret & 0xffff);
         }
         break;
     case 12:
         // chdir
         assert(mmfs == FS);
-        setM3(&m, vraw, pm);
-        //size_t len = m.m3_i1;
-        //uint16_t zero = m.m3_i2;
-        name = (const char *)m.m3_p1; // long and short
-        //name = (const char *)&m.m3_ca1[0]; // short only
+        name = mgets(pm, msg, M3_P1); // long and short
+        if (name == NULL) {
+            mset16(msg, M_TYPE, -EFAULT & 0xffff);
+            break;
+        }
 #if MY_STRACE
-        fprintf(stderr, "/ chdir(\"%s\") // name len=%d\n", name, m.m3_i1);
+        fprintf(stderr, "/ chdir(\"%s\") // name len=%d\n", name, mget16(msg, M3_I1));
 #endif
+        memoTaint(pm, "chdir");
         if (name[0] == '.' && name[1] == '.' && name[2] == '\0') {
             // TODO: support
             //  '../foo'
@@ -560,7 +516,7 @@ void mysyscall16(machine_t *pm) {
             char *p = getcwd(path0, sizeof(path0));
             if (p != NULL && strcmp(path0, pm->rootdir) == 0) {
                 // do nothing
-                *pBE_reply_type = 0;
+                mset16(msg, M_TYPE, 0);
                 break;
             }
             ret = chdir("..");
@@ -569,99 +525,99 @@ void mysyscall16(machine_t *pm) {
             ret = chdir(path0);
         }
         if (ret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(ret & 0xffff);
+            mset16(msg, M_TYPE, ret & 0xffff);
         }
         break;
     case 13:
         // time
         assert(mmfs == FS);
-        setM1(&m, vraw, pm);
 #if MY_STRACE
         fprintf(stderr, "/ time()\n");
 #endif
+        memoTaint(pm, "time");
         {
-            time_t t = time(NULL);
+            time_t t = (pm->vtime != NULL) ? vtimeNow(pm) : time(NULL);
             if (t < 0) {
-                *pBE_reply_type = htons(-errno & 0xffff);
-                // -1
-                *pBE_reply_l1_hi = 0xffff;
-                *pBE_reply_l1_lo = 0xffff;
+                mset16(msg, M_TYPE, -errno & 0xffff);
+                mset32(msg, M2_L1, 0xffffffff); // -1
             } else {
-                *pBE_reply_type = 0;
-                *pBE_reply_l1_hi = htons((t>>16) & 0xffff);
-                *pBE_reply_l1_lo = htons(t & 0xffff);
+                mset16(msg, M_TYPE, 0);
+                mset32(msg, M2_L1, t & 0xffffffff);
             }
         }
         break;
     case 15:
         // chmod
         assert(mmfs == FS);
-        setM3(&m, vraw, pm);
-        //size_t len = m.m3_i1;
-        mode = m.m3_i2;
-        name = (const char *)m.m3_p1; // long and short
-        //name = (const char *)&m.m3_ca1[0]; // short only
+        mode = mget16(msg, M3_I2);
+        name = mgets(pm, msg, M3_P1); // long and short
+        if (name == NULL) {
+            mset16(msg, M_TYPE, -EFAULT & 0xffff);
+            break;
+        }
         addroot(path0, sizeof(path0), name, pm->rootdir);
 #if MY_STRACE
-        fprintf(stderr, "/ chmod(\"%s\", %06o) // name len=%d, full=%s\n", name, mode, m.m3_i1, path0);
+        fprintf(stderr, "/ chmod(\"%s\", %06o) // name len=%d, full=%s\n", name, mode, mget16(msg, M3_I1), path0);
 #endif
+        memoOutput(pm, name);
         ret = chmod(path0, mode);
         if (ret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(ret & 0xffff);
+            mset16(msg, M_TYPE, ret & 0xffff);
         }
         break;
     case 17:
         // brk
         assert(mmfs == MM);
-        setM1(&m, vraw, pm);
-        uint32_t addr = mmuR2V(pm, m.m1_p1);
-        uint32_t addr256 = (addr + 255) & ~255;
-#if MY_STRACE
-        fprintf(stderr, "/ brk(%08x)\n", addr);
-        fprintf(stderr, "/   bssEnd: %08x\n", pm->bssEnd);
-        fprintf(stderr, "/   brk:    %08x -> %08x\n", pm->brk, addr256);
-        fprintf(stderr, "/   SP:     %08x\n", getSP(pm->cpu));
-#endif
-        if (addr256 < pm->bssEnd || getSP(pm->cpu) < addr256) {
-            *pBE_reply_type = htons(-ENOMEM & 0xffff);
-            // -1
-            *pBE_reply_p1_hi = 0xffff;
-            *pBE_reply_p1_lo = 0xffff;
-        } else {
-            pm->brk = addr256;
-            *pBE_reply_type = 0;
-            *pBE_reply_p1_hi = htons(addr>>16);
-            *pBE_reply_p1_lo = htons(addr&0xffff);
+        {
+            uint32_t addr = mget32(msg, M1_P1);
+            uint32_t addr256 = (addr + 255) & ~255;
+#if MY_STRACE
+            fprintf(stderr, "/ brk(%08x)\n", addr);
+            fprintf(stderr, "/   bssEnd: %08x\n", pm->bssEnd);
+            fprintf(stderr, "/   brk:    %08x -> %08x\n", pm->brk, addr256);
+            fprintf(stderr, "/   SP:     %08x\n", getSP(pm->cpu));
+#endif
+            if (addr256 < pm->bssEnd || getSP(pm->cpu) < addr256 || !budgetBreak(pm, addr256)) {
+                mset16(msg, M_TYPE, -ENOMEM & 0xffff);
+                mset32(msg, M2_P1, 0xffffffff); // -1
+            } else {
+                pm->brk = addr256;
+                mset16(msg, M_TYPE, 0);
+                mset32(msg, M2_P1, addr);
+            }
         }
         break;
     case 18:
         // stat
         assert(mmfs == FS);
-        setM1(&m, vraw, pm);
-        //size_t len = m.m1_i1;
-        name = (const char *)m.m1_p1;
-        buf = m.m1_p2;
+        name = mgets(pm, msg, M1_P1);
+        buf = mgetp(pm, msg, M1_P2, 30);
+        if (name == NULL || buf == NULL) {
+            mset16(msg, M_TYPE, -EFAULT & 0xffff);
+            break;
+        }
         addroot(path0, sizeof(path0), name, pm->rootdir);
 #if MY_STRACE
-        fprintf(stderr, "/ stat(\"%s\", %08x) // name len=%d, full=%s\n", name, mmuR2V(pm, buf), m.m1_i1, path0);
+        fprintf(stderr, "/ stat(\"%s\", %08x) // name len=%d, full=%s\n", name, mget32(msg, M1_P2), mget16(msg, M1_I1), path0);
 #endif
         {
+            memoLookup(pm, name);
             struct stat s;
             ret = stat(path0, &s);
             if (ret < 0) {
-                *pBE_reply_type = htons(-errno & 0xffff);
+                mset16(msg, M_TYPE, -errno & 0xffff);
             } else {
-                *pBE_reply_type = htons(ret & 0xffff);
-                uint8_t *pi = buf;
-                convstat(pi, &s);
+                mset16(msg, M_TYPE, ret & 0xffff);
+                guestWillWrite(pm, mmuR2V(pm, buf), 30);
+                convstat(buf, &s);
 #if MY_STRACE
                 fprintf(stderr, "/ [DBG] inode=%016lx\n", s.st_ino);
                 fprintf(stderr, "/ [DBG] stat src: %06o\n", s.st_mode);
-                fprintf(stderr, "/ [DBG] stat dst: %06o\n", ntohs(*(uint16_t *)(pi + 4)));
+                fprintf(stderr, "/ [DBG] stat dst: %06o\n", mget16(buf, 4));
 #endif
             }
         }
@@ -669,10 +625,9 @@ void mysyscall16(machine_t *pm) {
     case 19:
         // lseek
         assert(mmfs == FS);
-        setM2(&m, vraw, pm);
-        fd = m.m2_i1;
-        off_t offset = m.m2_l1;
-        int whence = m.m2_i2;
+        fd = (int16_t)mget16(msg, M2_I1);
+        off_t offset = (int32_t)mget32(msg, M2_L1);
+        int whence = mget16(msg, M2_I2);
 #if MY_STRACE
         fprintf(stderr, "/ lseek(%d, %ld, %d)\n", fd, offset, whence);
 #endif
@@ -683,11 +638,10 @@ void mysyscall16(machine_t *pm) {
         }
         offset = lseek(fd, offset, whence);
         if (offset < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = 0;
-            *pBE_reply_l1_hi = htons((offset>>16) & 0xffff);
-            *pBE_reply_l1_lo = htons(offset & 0xffff);
+            mset16(msg, M_TYPE, 0);
+            mset32(msg, M2_L1, offset & 0xffffffff);
         }
         break;
     case 20:
@@ -696,8 +650,9 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ getpid()\n");
 #endif
+        memoTaint(pm, "getpid");
         pid = getpid();
-        *pBE_reply_type = htons(pid & 0x7fff); // valid 15-bit only
+        mset16(msg, M_TYPE, pid & 0x7fff); // valid 15-bit only
         break;
     case 24:
         // getuid
@@ -705,33 +660,38 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ getuid(),geteuid()\n");
 #endif
-        uid_t uid = getuid();
-        uid_t euid = geteuid();
-        *pBE_reply_type = htons(uid & 0xffff);
-        *pBE_reply_i1 = htons(euid & 0xffff);
+        {
+            uid_t uid = getuid();
+            uid_t euid = geteuid();
+            mset16(msg, M_TYPE, uid & 0xffff);
+            mset16(msg, M2_I1, euid & 0xffff);
+        }
         break;
     case 28:
         // fstat
         assert(mmfs == FS);
-        setM1(&m, vraw, pm);
-        fd = m.m1_i1;
-        buf = m.m1_p1;
+        fd = (int16_t)mget16(msg, M1_I1);
+        buf = mgetp(pm, msg, M1_P1, 30);
 #if MY_STRACE
-        fprintf(stderr, "/ fstat(%d, %08x)\n", fd, mmuR2V(pm, buf));
+        fprintf(stderr, "/ fstat(%d, %08x)\n", fd, mget32(msg, M1_P1));
 #endif
+        if (buf == NULL) {
+            mset16(msg, M_TYPE, -EFAULT & 0xffff);
+            break;
+        }
         {
             struct stat s;
             ret = fstat(fd, &s);
             if (ret < 0) {
-                *pBE_reply_type = htons(-errno & 0xffff);
+                mset16(msg, M_TYPE, -errno & 0xffff);
             } else {
-                *pBE_reply_type = htons(ret & 0xffff);
-                uint8_t *pi = buf;
-                convstat(pi, &s);
+                mset16(msg, M_TYPE, ret & 0xffff);
+                guestWillWrite(pm, mmuR2V(pm, buf), 30);
+                convstat(buf, &s);
 #if MY_STRACE
                 fprintf(stderr, "/ [DBG] inode=%016lx\n", s.st_ino);
                 fprintf(stderr, "/ [DBG] fstat src: %06o\n", s.st_mode);
-                fprintf(stderr, "/ [DBG] fstat dst: %06o\n", ntohs(*(uint16_t *)(pi + 4)));
+                fprintf(stderr, "/ [DBG] fstat dst: %06o\n", mget16(buf, 4));
 #endif
             }
         }
@@ -739,88 +699,97 @@ void mysyscall16(machine_t *pm) {
     case 33:
         // access
         assert(mmfs == FS);
-        setM3(&m, vraw, pm);
-        //size_t len = m.m3_i1;
-        int fmode = m.m3_i2;
-        name = (const char *)m.m3_p1; // long and short
-        //name = (const char *)&m.m3_ca1[0]; // short only
-        addroot(path0, sizeof(path0), name, pm->rootdir);
+        {
+            int fmode = mget16(msg, M3_I2);
+            name = mgets(pm, msg, M3_P1); // long and short
+            if (name == NULL) {
+                mset16(msg, M_TYPE, -EFAULT & 0xffff);
+                break;
+            }
+            addroot(path0, sizeof(path0), name, pm->rootdir);
 #if MY_STRACE
-        fprintf(stderr, "/ access(\"%s\", %d) // name len=%d, full=%s\n", name, fmode, m.m3_i1, path0);
+            fprintf(stderr, "/ access(\"%s\", %d) // name len=%d, full=%s\n", name, fmode, mget16(msg, M3_I1), path0);
 #endif
-        ret = access(path0, fmode);
+            memoLookup(pm, name);
+            ret = access(path0, fmode);
+        }
         if (ret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(ret & 0xffff);
+            mset16(msg, M_TYPE, ret & 0xffff);
         }
         break;
     case 37:
         // kill
         assert(mmfs == MM);
-        setM1(&m, vraw, pm);
-        pid = m.m1_i1;
-        sig = m.m1_i2;
+        pid = (int16_t)mget16(msg, M1_I1);
+        sig = mget16(msg, M1_I2);
 #if MY_STRACE
         fprintf(stderr, "/ kill(%d, %d)\n", pid, sig);
 #endif
+        memoTaint(pm, "kill");
         ret = kill(pid, sig);
         if (ret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(ret & 0xffff);
+            mset16(msg, M_TYPE, ret & 0xffff);
         }
         break;
     case 39:
         // mkdir
         assert(mmfs == FS);
-        setM1(&m, vraw, pm);
-        //size_t len = m.m1_i1;
-        mode = m.m1_i2;
-        name = (const char *)m.m1_p1;
+        mode = mget16(msg, M1_I2);
+        name = mgets(pm, msg, M1_P1);
+        if (name == NULL) {
+            mset16(msg, M_TYPE, -EFAULT & 0xffff);
+            break;
+        }
         addroot(path0, sizeof(path0), name, pm->rootdir);
 #if MY_STRACE
-        fprintf(stderr, "/ mkdir(\"%s\", %06o) // name len=%d, full=%s\n", name, mode, m.m1_i1, path0);
+        fprintf(stderr, "/ mkdir(\"%s\", %06o) // name len=%d, full=%s\n", name, mode, mget16(msg, M1_I1), path0);
 #endif
+        memoTaint(pm, "mkdir");
         ret = mkdir(name, mode);
         if (ret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(ret & 0xffff);
+            mset16(msg, M_TYPE, ret & 0xffff);
         }
         break;
     case 41:
         // dup, dup2
         assert(mmfs == FS);
-        setM1(&m, vraw, pm);
-        fd = m.m1_i1;
-        int rfd = fd & ~(0100); // mask to distinguish dup2 from dup
-        int fd2 = m.m1_i2;
-        if (fd == rfd) {
+        {
+            fd = (int16_t)mget16(msg, M1_I1);
+            memoTaint(pm, "dup");
+            int rfd = fd & ~(0100); // mask to distinguish dup2 from dup
+            int fd2 = (int16_t)mget16(msg, M1_I2);
+            if (fd == rfd) {
 #if MY_STRACE
-            fprintf(stderr, "/ dup(%d)\n", fd);
+                fprintf(stderr, "/ dup(%d)\n", fd);
 #endif
-            ret = dup(fd);
-        } else {
+                ret = dup(fd);
+            } else {
 #if MY_STRACE
-            fprintf(stderr, "/ dup2(%d, %d)\n", rfd, fd2);
+                fprintf(stderr, "/ dup2(%d, %d)\n", rfd, fd2);
 #endif
-            ret = dup2(rfd, fd2);
+                ret = dup2(rfd, fd2);
+            }
         }
         if (ret < 0) {
-            *pBE_reply_type = htons(-errno & 0xffff);
+            mset16(msg, M_TYPE, -errno & 0xffff);
         } else {
-            *pBE_reply_type = htons(ret & 0xffff);
+            mset16(msg, M_TYPE, ret & 0xffff);
         }
         break;
     case 42:
         // pipe
         assert(mmfs == FS);
-        setM1(&m, vraw, pm);
         {
 #if MY_STRACE
             fprintf(stderr, "/ pipe()\n");
 #endif
+            memoTaint(pm, "pipe");
             int pipefd[2];
             ret = pipe(pipefd);
             e = errno;
@@ -828,11 +797,11 @@ void mysyscall16(machine_t *pm) {
             fprintf(stderr, "/ [DBG] ret=%d, fd0=%d, fd1=%d\n", ret, pipefd[0], pipefd[1]);
 #endif
             if (ret < 0) {
-                *pBE_reply_type = htons(-e & 0xffff);
+                mset16(msg, M_TYPE, -e & 0xffff);
             } else {
-                *pBE_reply_type = 0;
-                *pBE_reply_i1 = htons(pipefd[0] & 0xffff);
-                *pBE_reply_i2 = htons(pipefd[1] & 0xffff);
+                mset16(msg, M_TYPE, 0);
+                mset16(msg, M1_I1, pipefd[0] & 0xffff);
+                mset16(msg, M1_I2, pipefd[1] & 0xffff);
             }
         }
         break;
@@ -842,47 +811,49 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ getgid(),getegid()\n");
 #endif
-        uid_t gid = getgid();
-        uid_t egid = getegid();
-        *pBE_reply_type = htons(gid & 0xffff);
-        *pBE_reply_i1 = htons(egid & 0xffff);
+        {
+            gid_t gid = getgid();
+            gid_t egid = getegid();
+            mset16(msg, M_TYPE, gid & 0xffff);
+            mset16(msg, M2_I1, egid & 0xffff);
+        }
         break;
     case 48:
         // signal
         assert(mmfs == MM);
-        setM6(&m, vraw, pm);
-        sig = m.m6_i1;
-        uintptr_t func = m.m6_f1;
-        if (func == (uintptr_t)SIG_DFL/* 0 */ || func == (uintptr_t)SIG_IGN/* 1 */) {
+        {
+            sig = mget16(msg, M6_I1);
+            uint32_t func = mget32(msg, M6_F1);
+            if (func == (uintptr_t)SIG_DFL/* 0 */ || func == (uintptr_t)SIG_IGN/* 1 */) {
 #if MY_STRACE
-            fprintf(stderr, "/ signal(%d, %08lx)\n", sig, func);
+                fprintf(stderr, "/ signal(%d, %08x)\n", sig, func);
 #endif
-            func = (uintptr_t)signal(sig, (void (*)(int))func);
-            e = errno;
+                void (*old)(int) = signal(sig, (func == 0) ? SIG_DFL : SIG_IGN);
+                e = errno;
 #if MY_STRACE
-            fprintf(stderr, "/ [DBG] ret=%08lx\n", func);
+                fprintf(stderr, "/ [DBG] ret=%p\n", (void *)(uintptr_t)old);
 #endif
-            if (func == (uintptr_t)SIG_ERR) {
-                *pBE_reply_type = htons(-e & 0xffff);
+                if (old == SIG_ERR) {
+                    mset16(msg, M_TYPE, -e & 0xffff);
+                } else {
+                    mset16(msg, M_TYPE, (old == SIG_IGN) ? 1 : 0);
+                }
             } else {
-                *pBE_reply_type = htons(func & 0xffff);
+                fprintf(stderr, "/ [WRN] ignore signal(%d, %08x)\n", sig, func);
+                mset16(msg, M_TYPE, -EINVAL & 0xffff);
             }
-        } else {
-            fprintf(stderr, "/ [WRN] ignore signal(%d, %08lx)\n", sig, func);
-            *pBE_reply_type = htons(-EINVAL & 0xffff);
         }
         break;
     case 54:
         // ioctl
         assert(mmfs == FS);
-        setM2(&m, vraw, pm);
-        fd = m.m2_i1;
-        int request = m.m2_i3;
-        //uint32_t spek = m.m2_l1;
-        //flags = m.m2_l2;
+        fd = (int16_t)mget16(msg, M2_I1);
+        int request = mget16(msg, M2_I3);
+        //uint32_t spek = mget32(msg, M2_L1);
+        //flags = mget32(msg, M2_L2);
         // support only isatty()
         if (request != TIOCGETP) {
-            *pBE_reply_type = htons(-EBADF & 0xffff);
+            mset16(msg, M_TYPE, -EBADF & 0xffff);
             break;
         }
 #if MY_STRACE
@@ -894,73 +865,81 @@ void mysyscall16(machine_t *pm) {
         fprintf(stderr, "/ [DBG] ret=%d\n", ret);
 #endif
         if (ret == 0) {
-            *pBE_reply_type = htons(-e & 0xffff);
+            mset16(msg, M_TYPE, -e & 0xffff);
         } else {
-            *pBE_reply_type = htons(ret & 0xffff);
+            mset16(msg, M_TYPE, ret & 0xffff);
         }
         break;
     case 59:
         // exec
         assert(mmfs == MM);
-        setM1(&m, vraw, pm);
-        const char *exec_name = (const char *)m.m1_p1;
-        uint8_t *stack_ptr = m.m1_p2;
-#if MY_STRACE
-        size_t exec_len = m.m1_i1;
-        size_t stack_bytes = m.m1_i2;
-        fprintf(stderr, "/ exec(\"%s\"(%ld), %08x[%ld])\n", exec_name, exec_len, mmuR2V(pm, stack_ptr), stack_bytes);
-        fprintf(stderr, "/ [DBG] reply vaddr: %08x\n", vraw+2);
-        for (size_t i = 0; i < stack_bytes; i += 16) {
-            fprintf(stderr, "/ [DBG] %08x:", mmuR2V(pm, stack_ptr+i));
-            for (size_t j = 0; j < 16; ++j) {
-                if (i + j < stack_bytes) {
-                    if (j == 8) fprintf(stderr, " ");
-                    fprintf(stderr, " %02x", stack_ptr[i + j]);
+        {
+            const char *exec_name = mgets(pm, msg, M1_P1);
+            uint32_t stack_ptr = mget32(msg, M1_P2);
+            size_t stack_bytes = mget16(msg, M1_I2);
+            if (exec_name == NULL || mgetp(pm, msg, M1_P2, stack_bytes) == NULL) {
+                mset16(msg, M_TYPE, -EFAULT & 0xffff);
+                break;
+            }
+#if MY_STRACE
+            size_t exec_len = mget16(msg, M1_I1);
+            fprintf(stderr, "/ exec(\"%s\"(%ld), %08x[%ld])\n", exec_name, exec_len, stack_ptr, stack_bytes);
+            fprintf(stderr, "/ [DBG] reply vaddr: %08x\n", vraw+2);
+            for (size_t i = 0; i < stack_bytes; i += 16) {
+                fprintf(stderr, "/ [DBG] %08lx:", stack_ptr+i);
+                for (size_t j = 0; j < 16; ++j) {
+                    if (i + j < stack_bytes) {
+                        if (j == 8) fprintf(stderr, " ");
+                        fprintf(stderr, " %02x", *mmuV2R(pm, stack_ptr+i+j));
+                    }
                 }
+                fprintf(stderr, "\n");
             }
-            fprintf(stderr, "\n");
-        }
 #endif
-        // calc size of args & copy args
-        ret = serializeArgvVirt(pm, mmuR2V(pm, stack_ptr));
-        if (ret < 0) {
-            pm->argc = 0;
-            pm->argsbytes = 0;
-            *pBE_reply_type = htons(-E2BIG & 0xffff);
-        } else {
-            ret = load(pm, exec_name);
-            if (ret != 0) {
+            memoTaint(pm, "exec");
+            // calc size of args & copy args
+            ret = serializeArgvVirt(pm, stack_ptr);
+            if (ret < 0) {
+                pm->argc = 0;
+                pm->argsbytes = 0;
+                mset16(msg, M_TYPE, -E2BIG & 0xffff);
+            } else {
+                nativeExec(pm, exec_name);
+                ret = load(pm, exec_name);
+                if (ret != 0) {
 #if MY_STRACE
-                fprintf(stderr, "/ [DBG] load(\"%s\"): %s\n", exec_name, strerror(ret));
+                    fprintf(stderr, "/ [DBG] load(\"%s\"): %s\n", exec_name, strerror(ret));
 #endif
-                *pBE_reply_type = htons(-ret & 0xffff);
-            } else {
-                // Do NOT reply if succeeded! (*pBE_reply_type = 0)
-                // It may cause damage to the aout that is loaded just now.
+                    mset16(msg, M_TYPE, -ret & 0xffff);
+                } else {
+                    // Do NOT reply if succeeded! (M_TYPE = 0)
+                    // It may cause damage to the aout that is loaded just now.
 
-                // goto the end of the memory, then run the new text
-                uint32_t isp = getISP(pm->cpu);
-                assert((isp & 1) == 0); // isp is word-aligned.
-                uint32_t eom = pm->sizeOfVM - 1;
+                    // goto the end of the memory, then run the new text
+                    uint32_t isp = getISP(pm->cpu);
+                    assert((isp & 1) == 0); // isp is word-aligned.
+                    uint32_t eom = pm->sizeOfVM - 1;
 #if MY_STRACE
-                fprintf(stderr, "/ [DBG] new ppc: %08x\n", eom-2);
-                fprintf(stderr, "/ [DBG] new pc:  %08x\n", eom);
+                    fprintf(stderr, "/ [DBG] new ppc: %08x\n", eom-2);
+                    fprintf(stderr, "/ [DBG] new pc:  %08x\n", eom);
 #endif
-                *(uint16_t *)(mmuV2R(pm, isp+2)) = htons((eom >> 16) & 0xffff);
-                *(uint16_t *)(mmuV2R(pm, isp+4)) = htons(eom & 0xffff);
+                    guestWillWrite(pm, isp+2, 4);
+                    guestStore32BE(pm, isp+2, eom);
+                }
             }
         }
         break;
     case 60:
         // umask
         assert(mmfs == FS);
-        setM1(&m, vraw, pm);
-        mode_t mask = m.m1_i1;
+        {
+            mode_t mask = mget16(msg, M1_I1);
 #if MY_STRACE
-        fprintf(stderr, "/ umask(%#03o)\n", mask);
+            fprintf(stderr, "/ umask(%#03o)\n", mask);
 #endif
-        ret = umask(mask);
-        *pBE_reply_type = htons(ret & 0xffff);
+            ret = umask(mask);
+            mset16(msg, M_TYPE, ret & 0xffff);
+        }
         break;
     default:
         // TODO: not implemented
@@ -1002,18 +981,13 @@ static void convstat16(uint8_t *pi, const struct stat* ps) {
     000070   read, write, execute (group)
     000007   read, write, execute (others)
     */
-    pi[0] = ps->st_dev & 0xff; // pseudo
-    pi[1] = (ps->st_dev >> 8) & 0xff; // pseudo
-    pi[2] = ps->st_ino & 0xff;
-    pi[3] = (ps->st_ino >> 8) & 0xff;
-    pi[4] = ps->st_mode & 0xff;
-    pi[5] = (ps->st_mode >> 8) & 0xff;
-    pi[6] = ps->st_nlink & 0xff;
-    pi[7] = ps->st_uid & 0xff;
-    pi[8] = ps->st_gid & 0xff;
-    pi[9] = (ps->st_size >> 16) & 0xff;
-    pi[10] = ps->st_size & 0xff;
-    pi[11] = (ps->st_size >> 8) & 0xff;
+    // dev (pseudo), inumber, flags, nlinks, uid, gid, size0, size1
+    static const uint8_t widths[] = { 2, 2, 2, 1, 1, 1, 1, 2 };
+    const uint32_t values[] = {
+        ps->st_dev, ps->st_ino, ps->st_mode, ps->st_nlink, ps->st_uid, ps->st_gid,
+        ps->st_size >> 16, ps->st_size & 0xffff,
+    };
+    packLE(pi, widths, values, 8);
     // addr
     //pi[12];
     // actime
@@ -1035,9 +1009,11 @@ void mysyscall16(machine_t *pm) {
     uint16_t word1 = 0;
     char path0[PATH_MAX];
     char path1[PATH_MAX];
+    uint8_t *buf;
     ssize_t sret;
     int ret;
     int e;
+    int fd;
 
 #if MY_STRACE
     if (pm->cpu->syscallID != 4 && pm->cpu->syscallID != 0) {
@@ -1057,15 +1033,11 @@ void mysyscall16(machine_t *pm) {
             assert(pm->cpu->bin - pm->cpu->syscallID == 0104400);
             mysyscall16(pm);
         }
-        // syscall exec(11) overwrites pc!
-        if (pm->cpu->syscallID == 11) {
-            uint16_t eom16 = (pm->sizeOfVM - 1) & 0xffff;
-            if (pm->cpu->pc != eom16) {
-                pm->cpu->pc = oldpc;
-                assert(isC(pm->cpu));
-            }
-        } else {
+        // syscall exec(11) and exit(1) of libuuinterp overwrite pc!
+        uint16_t eom16 = (pm->sizeOfVM - 1) & 0xffff;
+        if (pm->cpu->pc != eom16) {
             pm->cpu->pc = oldpc;
+            assert(pm->cpu->syscallID != 11 || isC(pm->cpu));
         }
         // TODO: In syscall fork(2) parent overwrites pc!
         assert(pm->cpu->syscallID != 2);
@@ -1075,6 +1047,20 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ _exit(%d)\n", (int16_t)pm->cpu->r0);
 #endif
+        if (pm->procs != NULL) {
+            procExit(pm, (int16_t)pm->cpu->r0);
+            break;
+        }
+        memoExit(pm, (int16_t)pm->cpu->r0);
+        profileExit(pm);
+        vtimeExit(pm);
+        budgetExit(pm);
+        if (pm->v6fs != NULL) {
+            v6fsRelease(pm->v6fs);
+        }
+        if (embeddedExit(pm, (int16_t)pm->cpu->r0)) {
+            break;
+        }
         _exit((int16_t)pm->cpu->r0);
         break;
     case 2:
@@ -1082,14 +1068,24 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ fork()\n");
 #endif
-        ret = fork();
+        memoTaint(pm, "fork");
+        if (pm->v6fs != NULL) {
+            v6fsRetain(pm->v6fs);
+        }
+        ret = procFork(pm);
         if (ret < 0) {
-            pm->cpu->r0 = errno & 0xffff;
+            e = errno;
+            if (pm->v6fs != NULL) {
+                v6fsRelease(pm->v6fs);
+            }
+            pm->cpu->r0 = e & 0xffff;
             setC(pm->cpu); // error bit
         } else {
             if (ret == 0) {
                 // child
-                // nothing to do
+                profileFork(pm);
+                vtimeFork(pm);
+                budgetFork(pm);
             } else {
                 // parent
                 pm->cpu->pc += 2;
@@ -1108,7 +1104,19 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ read(%d, %04x, %d)\n", (int16_t)pm->cpu->r0, word0, word1);
 #endif
-        if (pm->dirfd != -1 && pm->dirp != NULL && (int16_t)pm->cpu->r0 == pm->dirfd) {
+        buf = guestSpan(pm, word0, word1);
+        if (buf == NULL) {
+            pm->cpu->r0 = EFAULT;
+            setC(pm->cpu); // error bit
+            break;
+        }
+        fd = procHostFd(pm, (int16_t)pm->cpu->r0);
+        if (procWouldBlock(pm, fd, POLLIN)) {
+            break;
+        }
+        guestWillWrite(pm, word0, word1);
+        memoRead(pm, fd);
+        if (pm->dirfd != -1 && pm->dirp != NULL && fd == pm->dirfd) {
             // dir
             struct dirent *ent;
             ent = readdir(pm->dirp);
@@ -1122,7 +1130,7 @@ void mysyscall16(machine_t *pm) {
                 }
             } else {
                 assert(word1 == 16);
-                uint8_t *p = &pm->virtualMemory[word0];
+                uint8_t *p = buf;
                 // ino
                 p[0] = ent->d_ino & 0xff;
                 p[1] = (ent->d_ino >> 8) & 0xff;
@@ -1135,7 +1143,9 @@ void mysyscall16(machine_t *pm) {
             }
         } else {
             // file
-            sret = read((int16_t)pm->cpu->r0, &pm->virtualMemory[word0], word1);
+            sret = (pm->v6fs != NULL)
+                ? v6fsRead(pm->v6fs, fd, buf, word1)
+                : hostRead(pm, fd, buf, word1);
         }
         if (sret < 0) {
             pm->cpu->r0 = errno & 0xffff;
@@ -1154,7 +1164,20 @@ void mysyscall16(machine_t *pm) {
             fprintf(stderr, "/ write(%d, %04x, %d)\n", (int16_t)pm->cpu->r0, word0, word1);
         }
 #endif
-        sret = write((int16_t)pm->cpu->r0, &pm->virtualMemory[word0], word1);
+        buf = guestSpan(pm, word0, word1);
+        if (buf == NULL) {
+            pm->cpu->r0 = EFAULT;
+            setC(pm->cpu); // error bit
+            break;
+        }
+        fd = procHostFd(pm, (int16_t)pm->cpu->r0);
+        if (procWouldBlock(pm, fd, POLLOUT)) {
+            break;
+        }
+        sret = (pm->v6fs != NULL)
+            ? v6fsWrite(pm->v6fs, fd, buf, word1)
+            : hostWrite(pm, fd, buf, word1);
+        memoWrite(pm, fd, buf, sret);
         if (sret < 0) {
             pm->cpu->r0 = errno & 0xffff;
             setC(pm->cpu); // error bit
@@ -1167,14 +1190,21 @@ void mysyscall16(machine_t *pm) {
         // open
         word0 = fetch(pm->cpu);
         word1 = fetch(pm->cpu);
-        addroot(path0, sizeof(path0), (const char *)&pm->virtualMemory[word0], pm->rootdir);
+        if ((e = addrootVirt(pm, path0, sizeof(path0), word0)) != 0) {
+            pm->cpu->r0 = e;
+            setC(pm->cpu); // error bit
+            break;
+        }
 #if MY_STRACE
         fprintf(stderr, "/ open(\"%s\", %d) // full=%s\n",
             (const char *)&pm->virtualMemory[word0],
             word1,
             path0);
 #endif
-        ret = open(path0, word1);
+        ret = (pm->v6fs != NULL) ? v6fsOpen(pm->v6fs, path0, word1) : hostOpen(pm, path0, word1, 0);
+        memoInput(pm, (const char *)mmuV2R(pm, word0), word1, ret);
+        fd = ret;
+        ret = procNewFd(pm, fd);
         if (ret < 0) {
             pm->cpu->r0 = errno & 0xffff;
             setC(pm->cpu); // error bit
@@ -1182,17 +1212,17 @@ void mysyscall16(machine_t *pm) {
             pm->cpu->r0 = ret & 0xffff;
             clearC(pm->cpu);
 
-            // check file or dir
-            int fd = ret;
+            // check file or dir, directories of the image are read as files
             struct stat s;
             ret = fstat(fd, &s);
-            if (ret == 0 && S_ISDIR(s.st_mode)) {
+            if (ret == 0 && S_ISDIR(s.st_mode) && pm->v6fs == NULL) {
                 // dir
                 DIR *dirp = fdopendir(fd);
                 if (dirp == NULL) {
-                    pm->cpu->r0 = errno & 0xffff;
+                    e = errno;
+                    procClose(pm, (int16_t)pm->cpu->r0);
+                    pm->cpu->r0 = e & 0xffff;
                     setC(pm->cpu); // error bit
-                    close(fd);
                 } else {
                     // TODO: support only one dir per process, currently
                     assert(pm->dirfd == -1);
@@ -1208,15 +1238,21 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ close(%d)\n", (int16_t)pm->cpu->r0);
 #endif
-        if (pm->dirfd != -1 && pm->dirp != NULL && (int16_t)pm->cpu->r0 == pm->dirfd) {
+        if (pm->procs != NULL) {
+            // host fd shared by guest processes
+            ret = procClose(pm, (int16_t)pm->cpu->r0);
+        } else if (pm->dirfd != -1 && pm->dirp != NULL && (int16_t)pm->cpu->r0 == pm->dirfd) {
             // dir
             ret = closedir(pm->dirp);
             pm->dirfd = -1;
             pm->dirp = NULL;
         } else {
             // file
-            ret = close((int16_t)pm->cpu->r0);
+            ret = (pm->v6fs != NULL)
+                ? v6fsClose(pm->v6fs, (int16_t)pm->cpu->r0)
+                : close((int16_t)pm->cpu->r0);
         }
+        memoClose(pm, (int16_t)pm->cpu->r0);
         if (ret < 0) {
             pm->cpu->r0 = errno & 0xffff;
             setC(pm->cpu); // error bit
@@ -1230,13 +1266,21 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ wait(&status)\n");
 #endif
+        memoTaint(pm, "wait");
         {
             int status;
-            ret = wait(&status);
+            ret = procWait(pm, &status);
+            if (ret == 0) {
+                // runs again
+                break;
+            }
             if (ret < 0) {
                 pm->cpu->r0 = errno & 0xffff;
                 setC(pm->cpu); // error bit
             } else {
+                if (pm->procs == NULL) {
+                    vtimeWait(pm, ret);
+                }
                 pm->cpu->r0 = ret & 0xffff;
                 pm->cpu->r1 = status & 0xffff;
                 clearC(pm->cpu);
@@ -1250,14 +1294,20 @@ void mysyscall16(machine_t *pm) {
         // creat
         word0 = fetch(pm->cpu);
         word1 = fetch(pm->cpu);
-        addroot(path0, sizeof(path0), (const char *)&pm->virtualMemory[word0], pm->rootdir);
+        if ((e = addrootVirt(pm, path0, sizeof(path0), word0)) != 0) {
+            pm->cpu->r0 = e;
+            setC(pm->cpu); // error bit
+            break;
+        }
 #if MY_STRACE
         fprintf(stderr, "/ creat(\"%s\", %06o) // full=%s\n",
             (const char *)&pm->virtualMemory[word0],
             word1,
             path0);
 #endif
-        ret = creat(path0, word1);
+        ret = (pm->v6fs != NULL) ? v6fsCreat(pm->v6fs, path0, word1) : hostOpen(pm, path0, O_WRONLY | O_CREAT | O_TRUNC, word1);
+        memoInput(pm, (const char *)mmuV2R(pm, word0), O_WRONLY | O_CREAT | O_TRUNC, ret);
+        ret = procNewFd(pm, ret);
         if (ret < 0) {
             pm->cpu->r0 = errno & 0xffff;
             setC(pm->cpu); // error bit
@@ -1270,8 +1320,12 @@ void mysyscall16(machine_t *pm) {
         // link
         word0 = fetch(pm->cpu);
         word1 = fetch(pm->cpu);
-        addroot(path0, sizeof(path0), (const char *)&pm->virtualMemory[word0], pm->rootdir);
-        addroot(path1, sizeof(path1), (const char *)&pm->virtualMemory[word1], pm->rootdir);
+        if ((e = addrootVirt(pm, path0, sizeof(path0), word0)) != 0
+            || (e = addrootVirt(pm, path1, sizeof(path1), word1)) != 0) {
+            pm->cpu->r0 = e;
+            setC(pm->cpu); // error bit
+            break;
+        }
 #if MY_STRACE
         fprintf(stderr, "/ link(\"%s\", \"%s\") // full=%s, full2=%s\n",
             (const char *)&pm->virtualMemory[word0],
@@ -1279,7 +1333,9 @@ void mysyscall16(machine_t *pm) {
             path0,
             path1);
 #endif
-        ret = link(path0, path1);
+        memoLookup(pm, (const char *)mmuV2R(pm, word0));
+        memoOutput(pm, (const char *)mmuV2R(pm, word1));
+        ret = (pm->v6fs != NULL) ? v6fsLink(pm->v6fs, path0, path1) : link(path0, path1);
         if (ret < 0) {
             pm->cpu->r0 = errno & 0xffff;
             setC(pm->cpu); // error bit
@@ -1291,13 +1347,18 @@ void mysyscall16(machine_t *pm) {
     case 10:
         // unlink
         word0 = fetch(pm->cpu);
-        addroot(path0, sizeof(path0), (const char *)&pm->virtualMemory[word0], pm->rootdir);
+        if ((e = addrootVirt(pm, path0, sizeof(path0), word0)) != 0) {
+            pm->cpu->r0 = e;
+            setC(pm->cpu); // error bit
+            break;
+        }
 #if MY_STRACE
         fprintf(stderr, "/ unlink(\"%s\") // full=%s\n",
             (const char *)&pm->virtualMemory[word0],
             path0);
 #endif
-        ret = unlink(path0);
+        memoOutput(pm, (const char *)mmuV2R(pm, word0));
+        ret = (pm->v6fs != NULL) ? v6fsUnlink(pm->v6fs, path0) : unlink(path0);
         if (ret < 0) {
             pm->cpu->r0 = errno & 0xffff;
             setC(pm->cpu); // error bit
@@ -1315,8 +1376,15 @@ void mysyscall16(machine_t *pm) {
             (const char *)&pm->virtualMemory[word0],
             word1);
 #endif
+        // name is overwritten by load()
+        if ((e = guestStrCopyIn(pm, path1, sizeof(path1), word0)) != 0) {
+            pm->cpu->r0 = e;
+            setC(pm->cpu); // error bit
+            break;
+        }
+        memoTaint(pm, "exec");
         // calc size of args & copy args
-        ret = serializeArgvVirt16(pm, &pm->virtualMemory[word1]);
+        ret = serializeArgvVirt16(pm, word1);
         if (ret < 0) {
             fprintf(stderr, "/ [ERR] Too big argv\n");
             pm->argc = 0;
@@ -1324,14 +1392,16 @@ void mysyscall16(machine_t *pm) {
             pm->cpu->r0 = 0xffff;
             setC(pm->cpu); // error bit
         } else {
-            ret = load(pm, (const char *)&pm->virtualMemory[word0]);
+            nativeExec(pm, path1);
+            ret = load(pm, path1);
             if (ret != 0) {
 #if MY_STRACE
-                fprintf(stderr, "/ [DBG] load(\"%s\"): %s\n", (const char *)&pm->virtualMemory[word0], strerror(ret));
+                fprintf(stderr, "/ [DBG] load(\"%s\"): %s\n", path1, strerror(ret));
 #endif
                 pm->cpu->r0 = 0xffff;
                 setC(pm->cpu); // error bit
             } else {
+                guestSignalExec(pm);
                 pm->cpu->r0 = 0;
                 // goto the end of the memory, then run the new text
                 uint16_t eom16 = (pm->sizeOfVM - 1) & 0xffff;
@@ -1346,17 +1416,25 @@ void mysyscall16(machine_t *pm) {
     case 12:
         // chdir
         word0 = fetch(pm->cpu);
-        const char *name = (const char *)&pm->virtualMemory[word0];
+        if ((e = addrootVirt(pm, path0, sizeof(path0), word0)) != 0) {
+            pm->cpu->r0 = e;
+            setC(pm->cpu); // error bit
+            break;
+        }
+        const char *name = (const char *)mmuV2R(pm, word0);
 #if MY_STRACE
         fprintf(stderr, "/ chdir(\"%s\")\n", name);
 #endif
-        if (name[0] == '.' && name[1] == '.' && name[2] == '\0') {
+        memoTaint(pm, "chdir");
+        if (pm->v6fs != NULL) {
+            ret = v6fsChdir(pm->v6fs, path0);
+        } else if (name[0] == '.' && name[1] == '.' && name[2] == '\0') {
             // TODO: support
             //  '../foo'
             //  './..'
             //  'foo/bar/../../..'
-            char *p = getcwd(path0, sizeof(path0));
-            if (p != NULL && strcmp(path0, pm->rootdir) == 0) {
+            char *p = getcwd(path1, sizeof(path1));
+            if (p != NULL && strcmp(path1, pm->rootdir) == 0) {
                 // do nothing
                 pm->cpu->r0 = 0;
                 clearC(pm->cpu);
@@ -1364,13 +1442,13 @@ void mysyscall16(machine_t *pm) {
             }
             ret = chdir("..");
         } else {
-            addroot(path0, sizeof(path0), name, pm->rootdir);
             ret = chdir(path0);
         }
         if (ret < 0) {
             pm->cpu->r0 = errno & 0xffff;
             setC(pm->cpu); // error bit
         } else {
+            procChdir(pm);
             pm->cpu->r0 = ret & 0xffff;
             clearC(pm->cpu);
         }
@@ -1380,8 +1458,9 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ time()\n");
 #endif
+        memoTaint(pm, "time");
         {
-            time_t t = time(NULL);
+            time_t t = (pm->vtime != NULL) ? vtimeNow(pm) : time(NULL);
             pm->cpu->r0 = (t >> 16) & 0xffff;
             pm->cpu->r1 = t & 0xffff;
         }
@@ -1390,14 +1469,19 @@ void mysyscall16(machine_t *pm) {
         // chmod
         word0 = fetch(pm->cpu);
         word1 = fetch(pm->cpu);
-        addroot(path0, sizeof(path0), (const char *)&pm->virtualMemory[word0], pm->rootdir);
+        if ((e = addrootVirt(pm, path0, sizeof(path0), word0)) != 0) {
+            pm->cpu->r0 = e;
+            setC(pm->cpu); // error bit
+            break;
+        }
 #if MY_STRACE
         fprintf(stderr, "/ chmod(\"%s\", %06o) // full=%s\n",
             (const char *)&pm->virtualMemory[word0],
             word1,
             path0);
 #endif
-        ret = chmod(path0, word1);
+        memoOutput(pm, (const char *)mmuV2R(pm, word0));
+        ret = (pm->v6fs != NULL) ? v6fsChmod(pm->v6fs, path0, word1) : chmod(path0, word1);
         if (ret < 0) {
             pm->cpu->r0 = errno & 0xffff;
             setC(pm->cpu); // error bit
@@ -1416,7 +1500,7 @@ void mysyscall16(machine_t *pm) {
         fprintf(stderr, "/   brk:    %04x -> %04x\n", pm->brk, addr64);
         fprintf(stderr, "/   SP:     %04x\n", pm->cpu->sp);
 #endif
-        if (addr64 < pm->bssEnd || pm->cpu->sp < addr64) {
+        if (addr64 < pm->bssEnd || pm->cpu->sp < addr64 || !budgetBreak(pm, addr64)) {
             pm->cpu->r0 = 0xffff;
             setC(pm->cpu); // error bit
         } else {
@@ -1430,7 +1514,12 @@ void mysyscall16(machine_t *pm) {
         word0 = fetch(pm->cpu);
         word1 = fetch(pm->cpu);
         {
-            addroot(path0, sizeof(path0), (const char *)&pm->virtualMemory[word0], pm->rootdir);
+            if ((e = addrootVirt(pm, path0, sizeof(path0), word0)) != 0
+                || (buf = guestSpan(pm, word1, 36)) == NULL) {
+                pm->cpu->r0 = (e != 0) ? e : EFAULT;
+                setC(pm->cpu); // error bit
+                break;
+            }
 #if MY_STRACE
             fprintf(stderr, "/ stat(\"%s\", %04x) // full=%s\n",
                 (const char *)&pm->virtualMemory[word0],
@@ -1438,20 +1527,22 @@ void mysyscall16(machine_t *pm) {
                 path0);
 #endif
 
+            memoLookup(pm, (const char *)mmuV2R(pm, word0));
             struct stat s;
-            ret = stat(path0, &s);
+            ret = (pm->v6fs != NULL) ? v6fsStat(pm->v6fs, path0, &s) : stat(path0, &s);
             if (ret < 0) {
                 pm->cpu->r0 = errno & 0xffff;
                 setC(pm->cpu); // error bit
             } else {
                 pm->cpu->r0 = ret & 0xffff;
                 clearC(pm->cpu);
-                uint8_t *pi = &pm->virtualMemory[word1];
+                uint8_t *pi = buf;
+                guestWillWrite(pm, mmuR2V(pm, pi), 36);
                 convstat16(pi, &s);
 #if MY_STRACE
                 fprintf(stderr, "/ [DBG] inode=%016lx\n", s.st_ino);
                 fprintf(stderr, "/ [DBG] stat src: %06o\n", s.st_mode);
-                fprintf(stderr, "/ [DBG] stat dst: %06o\n", *(uint16_t *)(pi + 4));
+                fprintf(stderr, "/ [DBG] stat dst: %06o\n", read16(pi + 4));
 #endif
             }
         }
@@ -1474,7 +1565,10 @@ void mysyscall16(machine_t *pm) {
         fprintf(stderr, "/ lseek(%d, %ld, %d)\n", (int16_t)pm->cpu->r0, offset, word1);
 #endif
         // TODO: seekdir
-        offset = lseek((int16_t)pm->cpu->r0, offset, word1);
+        fd = procHostFd(pm, (int16_t)pm->cpu->r0);
+        offset = (pm->v6fs != NULL)
+            ? v6fsLseek(pm->v6fs, fd, offset, word1)
+            : lseek(fd, offset, word1);
         if (offset < 0) {
             pm->cpu->r0 = errno & 0xffff;
             setC(pm->cpu); // error bit
@@ -1488,7 +1582,8 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ getpid()\n");
 #endif
-        pm->cpu->r0 = getpid() & 0xffff;
+        memoTaint(pm, "getpid");
+        pm->cpu->r0 = procGetpid(pm) & 0xffff;
         break;
     case 23:
         // setuid
@@ -1511,21 +1606,31 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ fstat(%d, %04x)\n", (int16_t)pm->cpu->r0, word0);
 #endif
+        buf = guestSpan(pm, word0, 36);
+        if (buf == NULL) {
+            pm->cpu->r0 = EFAULT;
+            setC(pm->cpu); // error bit
+            break;
+        }
         {
             struct stat s;
-            ret = fstat((int16_t)pm->cpu->r0, &s);
+            fd = procHostFd(pm, (int16_t)pm->cpu->r0);
+            ret = (pm->v6fs != NULL)
+                ? v6fsFstat(pm->v6fs, fd, &s)
+                : fstat(fd, &s);
             if (ret < 0) {
                 pm->cpu->r0 = errno & 0xffff;
                 setC(pm->cpu); // error bit
             } else {
                 pm->cpu->r0 = ret & 0xffff;
                 clearC(pm->cpu);
-                uint8_t *pi = &pm->virtualMemory[word0];
+                uint8_t *pi = buf;
+                guestWillWrite(pm, mmuR2V(pm, pi), 36);
                 convstat16(pi, &s);
 #if MY_STRACE
                 fprintf(stderr, "/ [DBG] inode=%016lx\n", s.st_ino);
                 fprintf(stderr, "/ [DBG] fstat src: %06o\n", s.st_mode);
-                fprintf(stderr, "/ [DBG] fstat dst: %06o\n", *(uint16_t *)(pi + 4));
+                fprintf(stderr, "/ [DBG] fstat dst: %06o\n", read16(pi + 4));
 #endif
             }
         }
@@ -1535,7 +1640,8 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ dup(%d)\n", (int16_t)pm->cpu->r0);
 #endif
-        ret = dup((int16_t)pm->cpu->r0);
+        memoTaint(pm, "dup");
+        ret = (pm->v6fs != NULL) ? v6fsDup(pm->v6fs, (int16_t)pm->cpu->r0) : procDup(pm, (int16_t)pm->cpu->r0);
 #if MY_STRACE
         if (ret == 2) {
             fprintf(stderr, "/ dup(%d)\n", (int16_t)pm->cpu->r0);
@@ -1556,8 +1662,19 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
             fprintf(stderr, "/ pipe()\n");
 #endif
+            memoTaint(pm, "pipe");
             int pipefd[2];
             ret = pipe(pipefd);
+            if (ret == 0) {
+                // the guest fds
+                if ((pipefd[0] = procNewFd(pm, pipefd[0])) < 0) {
+                    close(pipefd[1]);
+                    ret = -1;
+                } else if ((pipefd[1] = procNewFd(pm, pipefd[1])) < 0) {
+                    procClose(pm, pipefd[0]);
+                    ret = -1;
+                }
+            }
             e = errno;
 #if MY_STRACE
             fprintf(stderr, "/ [DBG] ret=%d, fd0=%d, fd1=%d\n", ret, pipefd[0], pipefd[1]);
@@ -1578,6 +1695,7 @@ void mysyscall16(machine_t *pm) {
 #if MY_STRACE
         fprintf(stderr, "/ times(%04x)\n", word0);
 #endif
+        memoTaint(pm, "times");
         /* in 1/60 seconds
         struct tbuffer {
             int16_t proc_user_time;
@@ -1597,14 +1715,27 @@ void mysyscall16(machine_t *pm) {
             sbuf.tms_stime = sbuf.tms_stime * 60 / ticks_per_sec;
             sbuf.tms_cutime = sbuf.tms_cutime * 60 / ticks_per_sec;
             sbuf.tms_cstime = sbuf.tms_cstime * 60 / ticks_per_sec;
+            if (pm->vtime != NULL) {
+                // the guest instructions, all user time
+                uint64_t user, children;
+                vtimeTimes(pm, 60, &user, &children);
+                sbuf.tms_utime = user;
+                sbuf.tms_stime = 0;
+                sbuf.tms_cutime = children;
+                sbuf.tms_cstime = 0;
+            }
 
-            uint16_t *dbuf = (uint16_t *)&pm->virtualMemory[word0];
-            dbuf[0] = sbuf.tms_utime & 0xffff;
-            dbuf[1] = sbuf.tms_stime & 0xffff;
-            dbuf[2] = (sbuf.tms_cutime >> 16) & 0xffff;
-            dbuf[3] = sbuf.tms_cutime & 0xffff;
-            dbuf[4] = (sbuf.tms_cstime >> 16) & 0xffff;
-            dbuf[5] = sbuf.tms_cstime & 0xffff;
+            uint8_t *dbuf = guestSpan(pm, word0, 12);
+            if (dbuf == NULL) {
+                pm->cpu->r0 = EFAULT;
+                setC(pm->cpu); // error bit
+                break;
+            }
+            // int utime, stime; long cutime, cstime
+            static const uint8_t widths[] = { 2, 2, 4, 4 };
+            const uint32_t values[] = { sbuf.tms_utime, sbuf.tms_stime, sbuf.tms_cutime, sbuf.tms_cstime };
+            guestWillWrite(pm, word0, 12);
+            packLE(dbuf, widths, values, 4);
         }
         break;
     case 46:
@@ -1626,10 +1757,25 @@ void mysyscall16(machine_t *pm) {
         // signal
         word0 = fetch(pm->cpu);
         word1 = fetch(pm->cpu);
-        fprintf(stderr, "/ [WRN] ignore signal(%d, %04x), (addr=%04x, bin=%04x)\n", word0, word1, pm->cpu->addr, pm->cpu->bin);
-        {
+#if MY_STRACE
+        fprintf(stderr, "/ signal(%d, %06o)\n", word0, word1);
+#endif
+        if (pm->procs != NULL || pm->io != NULL) {
+            // handlers are of the host process
+            fprintf(stderr, "/ [WRN] ignore signal(%d, %04x), (addr=%04x, bin=%04x)\n", word0, word1, pm->cpu->addr, pm->cpu->bin);
             pm->cpu->r0 = 0; // terminate
             clearC(pm->cpu);
+            break;
+        }
+        {
+            uint16_t old;
+            if ((e = guestSignal(pm, word0, word1, &old)) != 0) {
+                pm->cpu->r0 = e;
+                setC(pm->cpu); // error bit
+                break;
+            }
+            pm->cpu->r0 = old;
+            clearC(pm->cpu);
         }
         break;
     default:
@@ -1638,6 +1784,11 @@ void mysyscall16(machine_t *pm) {
         assert(0);
         break;
     }
+
+    // between syscalls only the registers and carry are live
+    if (pm->checkpoint != NULL) {
+        checkpointPoll(pm);
+    }
 }
 
 void syscallString16(machine_t *pm, char *str, size_t size, uint8_t id) {}
@@ -1,12 +1,70 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
-static inline void addroot(char *path, size_t len, const char *src, const char *rootdir) {
-    if (src[0] == '/') {
-        snprintf(path, len, "%s%s", rootdir, src);
-    } else {
-        snprintf(path, len, "%s", src);
+// guest path to host path, false if it does not fit
+static inline bool addroot(char *path, size_t len, const char *src, const char *rootdir) {
+    int n = snprintf(path, len, "%s%s", (src[0] == '/') ? rootdir : "", src);
+    return n >= 0 && (size_t)n < len;
+}
+
+// n bytes or false, over short reads and EINTR
+static inline bool readAll(int fd, void *buf, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t sret = read(fd, (uint8_t *)buf + done, n - done);
+        if (sret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sret <= 0) {
+            return false;
+        }
+        done += sret;
+    }
+    return true;
+}
+
+static inline bool writeAll(int fd, const void *buf, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t sret = write(fd, (const uint8_t *)buf + done, n - done);
+        if (sret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sret <= 0) {
+            return false;
+        }
+        done += sret;
+    }
+    return true;
+}
+
+// zero memory shared with the children of fork(), MAP_FAILED and errno on error
+static inline void *mapShared(size_t size) {
+    int fd = open("/dev/zero", O_RDWR);
+    if (fd < 0) {
+        return MAP_FAILED;
+    }
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int e = errno;
+    close(fd);
+    errno = e;
+    return p;
+}
+
+// FNV-1a
+#define HASH64_INIT 0xcbf29ce484222325ULL
+static inline uint64_t hash64(uint64_t h, const void *src, size_t len) {
+    const uint8_t *p = src;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
     }
+    return h;
 }
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+
+#define DEBUG_LOG 0
+
+#include "uuinterp.h"
+#include "machine.h"
+#include "aoutcache.h"
+#include "proc.h"
+#include "syscall.h"
+#ifdef UU_M68K_MINIX
+#include "../m68k/src/cpu.h"
+#else
+#include "../pdp11/src/cpu.h"
+#endif
+
+// no callbacks: host calls, exit() of the guest still returns from uuRun()
+static const uu_io_t hostIo;
+
+#ifdef UU_M68K_MINIX
+// the cpu is one per host process
+static int machines;
+#endif
+
+machine_t *uuCreate(const char *rootdir, const uu_io_t *io) {
+#ifdef UU_M68K_MINIX
+    if (machines > 0) {
+        errno = EBUSY;
+        return NULL;
+    }
+#endif
+    machine_t *pm = calloc(1, sizeof(machine_t));
+    if (pm == NULL) {
+        return NULL;
+    }
+    pm->dirfd = -1;
+    pm->textStart = SIZE_OF_VECTORS;
+    pm->io = (io != NULL) ? io : &hostIo;
+
+    int ret;
+    // the root as in uuinterp: from the cwd, then back
+    if (getcwd(pm->curdir, sizeof(pm->curdir)) == NULL || chdir(rootdir) != 0
+        || getcwd(pm->rootdir, sizeof(pm->rootdir)) == NULL || chdir(pm->curdir) != 0) {
+        ret = errno;
+        free(pm);
+        errno = ret;
+        return NULL;
+    }
+    pm->cpu = malloc(sizeof(cpu_t));
+    if (pm->cpu == NULL || (ret = guestMap(pm)) != 0 || (ret = aoutCacheInit(pm)) != 0) {
+        ret = (pm->cpu == NULL) ? ENOMEM : ret;
+        guestUnmap(pm);
+        free(pm->cpu);
+        free(pm);
+        errno = ret;
+        return NULL;
+    }
+#ifdef UU_M68K_MINIX
+    machines++;
+#endif
+    return pm;
+}
+
+int uuLoad(machine_t *pm, int argc, char *argv[]) {
+    if (!serializeArgvReal(pm, argc, argv)) {
+        return E2BIG;
+    }
+    int ret = load(pm, (const char *)pm->args);
+    if (ret != 0) {
+        return ret;
+    }
+    pm->exited = false;
+    pm->interrupted = 0;
+
+    // processes of the guest from the start, m68k forks the host
+    procFree(pm);
+    ret = procInit(pm);
+    return (ret == ENOTSUP) ? 0 : ret;
+}
+
+int uuRun(machine_t *pm) {
+    // the cwd of the program, after chdir() of the guest
+    int cwdfd = open(".", O_RDONLY);
+
+    while (!pm->exited) {
+        uint32_t sp = startAout(pm);
+        init(
+            pm->cpu,
+            pm,
+            (mmu_v2r_t)mmuV2R,
+            (mmu_r2v_t)mmuR2V,
+            (syscall_t)mysyscall16,
+            sp, pm->textStart);
+        runAout(pm);
+    }
+#if DEBUG_LOG
+    fprintf(stderr, "/ [DBG] uuRun: exit %d\n", pm->exitStatus);
+#endif
+
+    if (cwdfd >= 0) {
+        if (fchdir(cwdfd) != 0) {
+            fprintf(stderr, "/ [WRN] Can't restore cwd: %s\n", strerror(errno));
+        }
+        close(cwdfd);
+    }
+    if (pm->io->exit != NULL) {
+        pm->io->exit(pm->io->ctx, pm->exitStatus);
+    }
+    return pm->exitStatus;
+}
+
+void uuDestroy(machine_t *pm) {
+    if (pm == NULL) {
+        return;
+    }
+    procFree(pm);
+    free(pm->sigs);
+    if (pm->dirp != NULL) {
+        closedir(pm->dirp);
+    }
+    aoutCacheFree(pm);
+    guestUnmap(pm);
+    free(pm->cpu);
+    free(pm);
+#ifdef UU_M68K_MINIX
+    machines--;
+#endif
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// libuuinterp: guests run in the calling process, without fork() and exec() of uuinterp
+//
+// machine_t *pm = uuCreate("root", &io);
+// uuLoad(pm, argc, argv);
+// int status = uuRun(pm);
+// uuDestroy(pm);
+//
+// The guest memory is mapped per machine, and a PDP-11 machine keeps its processes
+// (fork() of the guest) inside the machine, so PDP-11 machines may run on different
+// threads. The host cwd is shared by the process: paths of the guests are relative to
+// it, so guests on threads at the same time have to use the paths from the root.
+// The m68k cpu is one per host process: a machine at a time, and fork() of the guest
+// forks the host process.
+// Host signals are of the process too: signal() of a guest catches them for the last
+// machine that called it, so a machine at a time may catch signals.
+// A guest memory fault ends the host process with the guest pc, as uuinterp does.
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+// callbacks of the embedding program, NULL for the host calls
+typedef struct {
+    void *ctx;
+
+    // stdin, stdout and stderr of the guest (fd 0, 1, 2): bytes, or -1 and errno
+    ssize_t (*read)(void *ctx, int fd, void *buf, size_t n);
+    ssize_t (*write)(void *ctx, int fd, const void *buf, size_t n);
+
+    // open() and creat() of the guest, path in the host: a host fd, or -1 and errno
+    int (*open)(void *ctx, const char *path, int flags, mode_t mode);
+
+    // the guest exited, uuRun() returns the status after this
+    void (*exit)(void *ctx, int status);
+} uu_io_t;
+
+// NULL and errno on error; io is used until uuDestroy()
+machine_t *uuCreate(const char *rootdir, const uu_io_t *io);
+
+// argv[0] is the aout in the root; errno on error
+int uuLoad(machine_t *pm, int argc, char *argv[]);
+
+// until the guest exits: its exit status
+int uuRun(machine_t *pm);
+
+void uuDestroy(machine_t *pm);
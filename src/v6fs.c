@@ -0,0 +1,1016 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "v6fs.h"
+#include "machine.h"
+#include "util.h"
+
+/* disk image:
+  block 0        boot
+  block 1        superblock
+  block 2...     inodes, 16 per block, isize blocks
+  ...fsize-1     data and free blocks
+  all words little endian, 32-bit values high word first
+*/
+#define BSIZE 512
+#define NADDR 8
+#define DIRSIZ 14
+#define ROOTINO 1
+#define INODE_SIZE 32
+#define DIRENT_SIZE 16
+#define NICFREE 100
+#define MAX_LBN 32768 // 16MB
+
+// superblock
+#define S_ISIZE   0
+#define S_FSIZE   2
+#define S_NFREE   4
+#define S_FREE    6
+
+// inode
+#define I_MODE    0
+#define I_NLINK   2
+#define I_UID     3
+#define I_GID     4
+#define I_SIZE0   5
+#define I_SIZE1   6
+#define I_ADDR    8
+#define I_ATIME  24
+#define I_MTIME  28
+
+// i_mode
+#define IALLOC 0100000
+#define IFMT    060000
+#define IFDIR   040000
+#define IFCHR   020000
+#define IFBLK   060000
+#define ILARG   010000
+
+// open files
+#define FREAD  1
+#define FWRITE 2
+
+#define V6FS_NOFILE 64  // host fds
+#define V6FS_NFILE 256  // open files of the process tree
+
+typedef struct {
+    uint16_t ino;
+    uint16_t ref;     // fds of all processes
+    uint16_t flags;
+    uint32_t offset;
+} v6fs_file_t;
+
+// shared by the process tree
+typedef struct {
+    volatile int lock;
+    v6fs_file_t file[V6FS_NFILE];
+    uint8_t dirty[8192]; // blocks copied on write, 65536 bits
+} v6fs_shared_t;
+
+struct v6fs_tag {
+    const uint8_t *image;
+    uint32_t nblocks;
+    uint16_t isize;
+    bool cow;
+
+    v6fs_shared_t *shared;
+    uint8_t *blocks; // written blocks, at the same offsets as in the image
+
+    // per process
+    uint16_t cwd;
+    uint16_t files[V6FS_NOFILE]; // index in shared->file + 1
+};
+
+static inline uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static inline void put16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static void lock(v6fs_t *fs) {
+    while (__sync_lock_test_and_set(&fs->shared->lock, 1)) {
+        sched_yield();
+    }
+}
+
+static void unlock(v6fs_t *fs) {
+    __sync_lock_release(&fs->shared->lock);
+}
+
+
+//////////////////////////
+// blocks
+//////////////////////////
+static const uint8_t *bread(v6fs_t *fs, uint16_t bno) {
+    if (bno >= fs->nblocks) {
+        errno = EIO;
+        return NULL;
+    }
+    if (fs->shared->dirty[bno >> 3] & (1 << (bno & 7))) {
+        return fs->blocks + (size_t)bno * BSIZE;
+    }
+    return fs->image + (size_t)bno * BSIZE;
+}
+
+// copy the block out of the image on the first write
+static uint8_t *bwrite(v6fs_t *fs, uint16_t bno) {
+    if (!fs->cow) {
+        errno = EROFS;
+        return NULL;
+    }
+    if (bno >= fs->nblocks) {
+        errno = EIO;
+        return NULL;
+    }
+    uint8_t *p = fs->blocks + (size_t)bno * BSIZE;
+    if (!(fs->shared->dirty[bno >> 3] & (1 << (bno & 7)))) {
+        memcpy(p, fs->image + (size_t)bno * BSIZE, BSIZE);
+        fs->shared->dirty[bno >> 3] |= 1 << (bno & 7);
+    }
+    return p;
+}
+
+static uint16_t balloc(v6fs_t *fs) {
+    uint8_t *sb = bwrite(fs, 1);
+    if (sb == NULL) {
+        return 0;
+    }
+    int16_t nfree = get16(sb + S_NFREE);
+    if (nfree <= 0 || nfree > NICFREE) {
+        errno = ENOSPC;
+        return 0;
+    }
+    uint16_t bno = get16(sb + S_FREE + (nfree - 1) * 2);
+    if (bno == 0) {
+        errno = ENOSPC;
+        return 0;
+    }
+    if (bno < 2 + fs->isize || bno >= fs->nblocks) {
+        errno = EIO;
+        return 0;
+    }
+    nfree--;
+    if (nfree == 0) {
+        // the block holds the next part of the free list
+        const uint8_t *b = bread(fs, bno);
+        nfree = get16(b);
+        if (nfree > NICFREE) {
+            errno = EIO;
+            return 0;
+        }
+        memcpy(sb + S_FREE, b + 2, NICFREE * 2);
+    }
+    put16(sb + S_NFREE, nfree);
+    uint8_t *b = bwrite(fs, bno);
+    memset(b, 0, BSIZE);
+    return bno;
+}
+
+static void bfree(v6fs_t *fs, uint16_t bno) {
+    if (bno < 2 + fs->isize || bno >= fs->nblocks) {
+        return;
+    }
+    uint8_t *sb = bwrite(fs, 1);
+    if (sb == NULL) {
+        return;
+    }
+    int16_t nfree = get16(sb + S_NFREE);
+    if (nfree <= 0) {
+        nfree = 1;
+        put16(sb + S_FREE, 0);
+    }
+    if (nfree >= NICFREE) {
+        // the full list goes into the freed block
+        uint8_t *b = bwrite(fs, bno);
+        put16(b, nfree);
+        memcpy(b + 2, sb + S_FREE, NICFREE * 2);
+        nfree = 0;
+    }
+    put16(sb + S_FREE + nfree * 2, bno);
+    put16(sb + S_NFREE, nfree + 1);
+}
+
+
+//////////////////////////
+// inodes
+//////////////////////////
+static const uint8_t *iget(v6fs_t *fs, uint16_t ino) {
+    if (ino == 0 || ino > fs->isize * 16) {
+        errno = EIO;
+        return NULL;
+    }
+    const uint8_t *b = bread(fs, 2 + (ino - 1) / 16);
+    return (b == NULL) ? NULL : b + ((ino - 1) % 16) * INODE_SIZE;
+}
+
+static uint8_t *igetw(v6fs_t *fs, uint16_t ino) {
+    if (ino == 0 || ino > fs->isize * 16) {
+        errno = EIO;
+        return NULL;
+    }
+    uint8_t *b = bwrite(fs, 2 + (ino - 1) / 16);
+    return (b == NULL) ? NULL : b + ((ino - 1) % 16) * INODE_SIZE;
+}
+
+static inline uint16_t inodeType(const uint8_t *ip) {
+    return get16(ip + I_MODE) & IFMT;
+}
+
+static inline uint32_t inodeSize(const uint8_t *ip) {
+    return (ip[I_SIZE0] << 16) | get16(ip + I_SIZE1);
+}
+
+static inline void setInodeSize(uint8_t *ip, uint32_t size) {
+    ip[I_SIZE0] = (size >> 16) & 0xff;
+    put16(ip + I_SIZE1, size & 0xffff);
+}
+
+static void touch(uint8_t *ip) {
+    time_t t = time(NULL);
+    put16(ip + I_MTIME, (t >> 16) & 0xffff);
+    put16(ip + I_MTIME + 2, t & 0xffff);
+}
+
+static uint16_t ialloc(v6fs_t *fs, uint16_t mode) {
+    for (uint32_t ino = ROOTINO; ino <= fs->isize * 16 && ino <= 0xffff; ino++) {
+        const uint8_t *ip = iget(fs, ino);
+        if (ip == NULL) {
+            return 0;
+        }
+        if (get16(ip + I_MODE) & IALLOC) {
+            continue;
+        }
+        uint8_t *wp = igetw(fs, ino);
+        if (wp == NULL) {
+            return 0;
+        }
+        memset(wp, 0, INODE_SIZE);
+        put16(wp + I_MODE, IALLOC | mode);
+        wp[I_NLINK] = 1;
+        wp[I_UID] = getuid() & 0xff;
+        wp[I_GID] = getgid() & 0xff;
+        touch(wp);
+        return ino;
+    }
+    errno = ENOSPC;
+    return 0;
+}
+
+// block number of the lbn-th block of the file, 0 for a hole
+static uint16_t bmap(v6fs_t *fs, const uint8_t *ip, uint32_t lbn) {
+    if (!(get16(ip + I_MODE) & ILARG)) {
+        return (lbn < NADDR) ? get16(ip + I_ADDR + lbn * 2) : 0;
+    }
+    // large: 7 indirect blocks, then a double indirect one
+    uint32_t i = lbn >> 8;
+    uint16_t nb;
+    if (i < NADDR - 1) {
+        nb = get16(ip + I_ADDR + i * 2);
+    } else {
+        nb = get16(ip + I_ADDR + (NADDR - 1) * 2);
+        const uint8_t *b = (nb != 0) ? bread(fs, nb) : NULL;
+        nb = (b != NULL && i - (NADDR - 1) < 256) ? get16(b + (i - (NADDR - 1)) * 2) : 0;
+    }
+    const uint8_t *b = (nb != 0) ? bread(fs, nb) : NULL;
+    return (b != NULL) ? get16(b + (lbn & 0xff) * 2) : 0;
+}
+
+// the slot holds a block number, allocated if it's 0
+static uint16_t slotAlloc(v6fs_t *fs, uint8_t *slot) {
+    uint16_t nb = get16(slot);
+    if (nb == 0 && (nb = balloc(fs)) != 0) {
+        put16(slot, nb);
+    }
+    return nb;
+}
+
+// same as bmap(), allocating the missing blocks
+static uint16_t bmapAlloc(v6fs_t *fs, uint16_t ino, uint32_t lbn) {
+    if (lbn >= MAX_LBN) {
+        errno = EFBIG;
+        return 0;
+    }
+    uint8_t *ip = igetw(fs, ino);
+    if (ip == NULL) {
+        return 0;
+    }
+    uint16_t mode = get16(ip + I_MODE);
+    if (!(mode & ILARG)) {
+        if (lbn < NADDR) {
+            return slotAlloc(fs, ip + I_ADDR + lbn * 2);
+        }
+        // to a large file: the direct blocks move into the first indirect block
+        uint16_t ind = balloc(fs);
+        if (ind == 0) {
+            return 0;
+        }
+        memcpy(bwrite(fs, ind), ip + I_ADDR, NADDR * 2);
+        memset(ip + I_ADDR, 0, NADDR * 2);
+        put16(ip + I_ADDR, ind);
+        put16(ip + I_MODE, mode | ILARG);
+    }
+    uint32_t i = lbn >> 8;
+    uint8_t *slot = ip + I_ADDR + i * 2;
+    if (i >= NADDR - 1) {
+        uint16_t dbl = slotAlloc(fs, ip + I_ADDR + (NADDR - 1) * 2);
+        uint8_t *b = (dbl != 0) ? bwrite(fs, dbl) : NULL;
+        if (b == NULL) {
+            return 0;
+        }
+        slot = b + (i - (NADDR - 1)) * 2;
+    }
+    uint16_t nb = slotAlloc(fs, slot);
+    uint8_t *b = (nb != 0) ? bwrite(fs, nb) : NULL;
+    if (b == NULL) {
+        return 0;
+    }
+    return slotAlloc(fs, b + (lbn & 0xff) * 2);
+}
+
+static void freeIndirect(v6fs_t *fs, uint16_t bno, int level) {
+    const uint8_t *b = bread(fs, bno);
+    if (b == NULL) {
+        return;
+    }
+    for (int i = 255; i >= 0; i--) {
+        uint16_t nb = get16(b + i * 2);
+        if (nb != 0) {
+            if (level > 1) {
+                freeIndirect(fs, nb, level - 1);
+            }
+            bfree(fs, nb);
+        }
+    }
+}
+
+static void itrunc(v6fs_t *fs, uint8_t *ip) {
+    uint16_t mode = get16(ip + I_MODE);
+    if ((mode & IFMT) == IFCHR || (mode & IFMT) == IFBLK) {
+        return;
+    }
+    for (int i = NADDR - 1; i >= 0; i--) {
+        uint16_t nb = get16(ip + I_ADDR + i * 2);
+        if (nb != 0) {
+            if (mode & ILARG) {
+                freeIndirect(fs, nb, (i == NADDR - 1) ? 2 : 1);
+            }
+            bfree(fs, nb);
+            put16(ip + I_ADDR + i * 2, 0);
+        }
+    }
+    put16(ip + I_MODE, mode & ~ILARG);
+    setInodeSize(ip, 0);
+    touch(ip);
+}
+
+static ssize_t readi(v6fs_t *fs, uint16_t ino, uint32_t offset, uint8_t *dst, size_t n) {
+    const uint8_t *ip = iget(fs, ino);
+    if (ip == NULL) {
+        return -1;
+    }
+    uint32_t size = inodeSize(ip);
+    if (offset >= size) {
+        return 0;
+    }
+    if (n > size - offset) {
+        n = size - offset;
+    }
+    for (size_t done = 0; done < n; ) {
+        uint32_t pos = offset + done;
+        size_t chunk = BSIZE - pos % BSIZE;
+        if (chunk > n - done) {
+            chunk = n - done;
+        }
+        uint16_t bno = bmap(fs, ip, pos / BSIZE);
+        if (bno == 0) {
+            // hole
+            memset(dst + done, 0, chunk);
+        } else {
+            const uint8_t *b = bread(fs, bno);
+            if (b == NULL) {
+                return -1;
+            }
+            memcpy(dst + done, b + pos % BSIZE, chunk);
+        }
+        done += chunk;
+    }
+    return n;
+}
+
+static ssize_t writei(v6fs_t *fs, uint16_t ino, uint32_t offset, const uint8_t *src, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+        uint32_t pos = offset + done;
+        size_t chunk = BSIZE - pos % BSIZE;
+        if (chunk > n - done) {
+            chunk = n - done;
+        }
+        uint16_t bno = bmapAlloc(fs, ino, pos / BSIZE);
+        uint8_t *b = (bno != 0) ? bwrite(fs, bno) : NULL;
+        if (b == NULL) {
+            break;
+        }
+        memcpy(b + pos % BSIZE, src + done, chunk);
+        done += chunk;
+    }
+    if (done == 0 && n > 0) {
+        return -1;
+    }
+    uint8_t *ip = igetw(fs, ino);
+    if (offset + done > inodeSize(ip)) {
+        setInodeSize(ip, offset + done);
+    }
+    touch(ip);
+    return done;
+}
+
+
+//////////////////////////
+// directories
+//////////////////////////
+// the entry of the name, or an unused one if name is NULL
+static bool dirFind(v6fs_t *fs, uint16_t dino, const char *name, size_t len, uint32_t *poff, uint16_t *pino) {
+    const uint8_t *dp = iget(fs, dino);
+    if (dp == NULL) {
+        return false;
+    }
+    if (len > DIRSIZ) {
+        len = DIRSIZ;
+    }
+    uint32_t size = inodeSize(dp);
+    const uint8_t *b = NULL;
+    for (uint32_t off = 0; off + DIRENT_SIZE <= size; off += DIRENT_SIZE) {
+        if (off % BSIZE == 0) {
+            uint16_t bno = bmap(fs, dp, off / BSIZE);
+            b = (bno != 0) ? bread(fs, bno) : NULL;
+        }
+        if (b == NULL) {
+            continue;
+        }
+        const uint8_t *e = b + off % BSIZE;
+        uint16_t ino = get16(e);
+        if (name == NULL) {
+            if (ino != 0) {
+                continue;
+            }
+        } else if (ino == 0
+            || memcmp(e + 2, name, len) != 0
+            || (len < DIRSIZ && e[2 + len] != '\0')) {
+            continue;
+        }
+        *poff = off;
+        *pino = ino;
+        return true;
+    }
+    *poff = size - size % DIRENT_SIZE;
+    return false;
+}
+
+static int dirEnter(v6fs_t *fs, uint16_t dino, const char *name, size_t len, uint16_t ino) {
+    uint32_t off;
+    uint16_t unused;
+    dirFind(fs, dino, NULL, 0, &off, &unused);
+    uint16_t bno = bmapAlloc(fs, dino, off / BSIZE);
+    uint8_t *b = (bno != 0) ? bwrite(fs, bno) : NULL;
+    if (b == NULL) {
+        return -1;
+    }
+    uint8_t *e = b + off % BSIZE;
+    put16(e, ino);
+    memset(e + 2, 0, DIRSIZ);
+    memcpy(e + 2, name, (len < DIRSIZ) ? len : DIRSIZ);
+    uint8_t *dp = igetw(fs, dino);
+    if (off + DIRENT_SIZE > inodeSize(dp)) {
+        setInodeSize(dp, off + DIRENT_SIZE);
+    }
+    touch(dp);
+    return 0;
+}
+
+/* inode of the path, 0 and errno if not found
+   with pname, the inode of the parent directory and the last name in it */
+static uint16_t namei(v6fs_t *fs, const char *path, const char **pname, size_t *plen) {
+    uint16_t ino = (path[0] == '/') ? ROOTINO : fs->cwd;
+    const char *p = path;
+    for (;;) {
+        while (*p == '/') {
+            p++;
+        }
+        if (*p == '\0') {
+            if (pname != NULL) {
+                // no name to create or remove
+                errno = ENOENT;
+                return 0;
+            }
+            return ino;
+        }
+        const char *q = p;
+        while (*q != '\0' && *q != '/') {
+            q++;
+        }
+        const uint8_t *ip = iget(fs, ino);
+        if (ip == NULL) {
+            return 0;
+        }
+        if (inodeType(ip) != IFDIR) {
+            errno = ENOTDIR;
+            return 0;
+        }
+        const char *r = q;
+        while (*r == '/') {
+            r++;
+        }
+        if (pname != NULL && *r == '\0') {
+            *pname = p;
+            *plen = q - p;
+            return ino;
+        }
+        uint32_t off;
+        if (!dirFind(fs, ino, p, q - p, &off, &ino)) {
+            errno = ENOENT;
+            return 0;
+        }
+        p = q;
+    }
+}
+
+
+//////////////////////////
+// open files
+//////////////////////////
+static v6fs_file_t *getFile(v6fs_t *fs, int fd) {
+    if (fd < 0 || fd >= V6FS_NOFILE || fs->files[fd] == 0) {
+        return NULL;
+    }
+    return &fs->shared->file[fs->files[fd] - 1];
+}
+
+static bool isOpen(v6fs_t *fs, uint16_t ino) {
+    for (int i = 0; i < V6FS_NFILE; i++) {
+        if (fs->shared->file[i].ref > 0 && fs->shared->file[i].ino == ino) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the last link is gone
+static void ifree(v6fs_t *fs, uint16_t ino) {
+    uint8_t *ip = igetw(fs, ino);
+    if (ip != NULL) {
+        itrunc(fs, ip);
+        memset(ip, 0, INODE_SIZE);
+    }
+}
+
+static void fileDrop(v6fs_t *fs, v6fs_file_t *pf) {
+    if (--pf->ref > 0) {
+        return;
+    }
+    const uint8_t *ip = iget(fs, pf->ino);
+    if (ip != NULL && ip[I_NLINK] == 0) {
+        ifree(fs, pf->ino);
+    }
+}
+
+// a host fd stands for the file, to keep the fd numbers of the host
+static int fileOpen(v6fs_t *fs, uint16_t ino, uint16_t flags) {
+    int i;
+    for (i = 0; i < V6FS_NFILE && fs->shared->file[i].ref > 0; i++);
+    if (i == V6FS_NFILE) {
+        errno = ENFILE;
+        return -1;
+    }
+    int fd = open("/dev/null", O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fd >= V6FS_NOFILE) {
+        close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+    v6fs_file_t *pf = &fs->shared->file[i];
+    pf->ino = ino;
+    pf->ref = 1;
+    pf->flags = flags;
+    pf->offset = 0;
+    fs->files[fd] = i + 1;
+    return fd;
+}
+
+static void fillStat(v6fs_t *fs, uint16_t ino, const uint8_t *ip, struct stat *ps) {
+    memset(ps, 0, sizeof(*ps));
+    ps->st_ino = ino;
+    ps->st_mode = get16(ip + I_MODE);
+    ps->st_nlink = ip[I_NLINK];
+    ps->st_uid = ip[I_UID];
+    ps->st_gid = ip[I_GID];
+    ps->st_size = inodeSize(ip);
+    ps->st_atime = (get16(ip + I_ATIME) << 16) | get16(ip + I_ATIME + 2);
+    ps->st_mtime = (get16(ip + I_MTIME) << 16) | get16(ip + I_MTIME + 2);
+}
+
+
+//////////////////////////
+// api
+//////////////////////////
+int v6fsMount(machine_t *pm, const char *image, bool cow) {
+    int fd = open(image, O_RDONLY);
+    if (fd < 0) {
+        return errno;
+    }
+    struct stat s;
+    if (fstat(fd, &s) != 0) {
+        int e = errno;
+        close(fd);
+        return e;
+    }
+    size_t size = s.st_size;
+    if (size < 3 * BSIZE) {
+        close(fd);
+        return EINVAL;
+    }
+    if (size > 65536 * BSIZE) {
+        size = 65536 * BSIZE;
+    }
+    // shared with the page cache
+    const uint8_t *p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return errno;
+    }
+
+    v6fs_t *fs = calloc(1, sizeof(v6fs_t));
+    if (fs == NULL) {
+        munmap((void *)p, size);
+        return ENOMEM;
+    }
+    fs->image = p;
+    fs->isize = get16(p + BSIZE + S_ISIZE);
+    fs->nblocks = get16(p + BSIZE + S_FSIZE);
+    fs->cow = cow;
+    fs->cwd = ROOTINO;
+    if (fs->nblocks * BSIZE > size || fs->nblocks < 2 + fs->isize || fs->isize == 0) {
+        munmap((void *)p, size);
+        free(fs);
+        return EINVAL;
+    }
+
+    // the lock, the open files and the written blocks are visible to all processes
+    size_t header = (sizeof(v6fs_shared_t) + BSIZE - 1) & ~(size_t)(BSIZE - 1);
+    size_t sharedSize = header + (cow ? (size_t)fs->nblocks * BSIZE : 0);
+    void *q = mapShared(sharedSize);
+    if (q == MAP_FAILED) {
+        int e = errno;
+        munmap((void *)p, size);
+        free(fs);
+        return e;
+    }
+    fs->shared = q;
+    fs->blocks = (uint8_t *)q + header;
+
+    const uint8_t *ip = iget(fs, ROOTINO);
+    if (ip == NULL || inodeType(ip) != IFDIR) {
+        munmap(q, sharedSize);
+        munmap((void *)p, size);
+        free(fs);
+        return EINVAL;
+    }
+
+    pm->v6fs = fs;
+    // guest paths are paths in the image
+    pm->rootdir[0] = '\0';
+    return 0;
+}
+
+int v6fsOpen(v6fs_t *fs, const char *path, int mode) {
+    int ret = -1;
+    lock(fs);
+    uint16_t ino = namei(fs, path, NULL, NULL);
+    const uint8_t *ip = (ino != 0) ? iget(fs, ino) : NULL;
+    if (ip != NULL) {
+        uint16_t type = inodeType(ip);
+        mode &= O_ACCMODE;
+        if (type == IFCHR || type == IFBLK) {
+            errno = ENXIO;
+        } else if (mode != O_RDONLY && type == IFDIR) {
+            errno = EISDIR;
+        } else if (mode != O_RDONLY && !fs->cow) {
+            errno = EROFS;
+        } else {
+            ret = fileOpen(fs, ino, (mode == O_RDONLY) ? FREAD : (mode == O_WRONLY) ? FWRITE : FREAD | FWRITE);
+        }
+    }
+    unlock(fs);
+    return ret;
+}
+
+int v6fsCreat(v6fs_t *fs, const char *path, mode_t mode) {
+    if (!fs->cow) {
+        errno = EROFS;
+        return -1;
+    }
+    int ret = -1;
+    lock(fs);
+    uint16_t ino = namei(fs, path, NULL, NULL);
+    if (ino != 0) {
+        uint8_t *ip = igetw(fs, ino);
+        if (ip == NULL) {
+            // error
+        } else if (inodeType(ip) == IFDIR) {
+            errno = EISDIR;
+        } else if (inodeType(ip) != 0) {
+            errno = ENXIO;
+        } else {
+            itrunc(fs, ip);
+            ret = fileOpen(fs, ino, FWRITE);
+        }
+    } else if (errno == ENOENT) {
+        const char *name;
+        size_t len;
+        uint16_t dino = namei(fs, path, &name, &len);
+        if (dino != 0 && (ino = ialloc(fs, mode & 07777)) != 0) {
+            if (dirEnter(fs, dino, name, len, ino) != 0) {
+                int e = errno;
+                ifree(fs, ino);
+                errno = e;
+            } else {
+                ret = fileOpen(fs, ino, FWRITE);
+            }
+        }
+    }
+    unlock(fs);
+    return ret;
+}
+
+int v6fsLink(v6fs_t *fs, const char *path1, const char *path2) {
+    if (!fs->cow) {
+        errno = EROFS;
+        return -1;
+    }
+    int ret = -1;
+    lock(fs);
+    const char *name;
+    size_t len;
+    uint32_t off;
+    uint16_t dino, exist;
+    uint16_t ino = namei(fs, path1, NULL, NULL);
+    const uint8_t *ip = (ino != 0) ? iget(fs, ino) : NULL;
+    if (ip == NULL) {
+        // error
+    } else if (inodeType(ip) == IFDIR) {
+        // super-user only
+        errno = EPERM;
+    } else if (ip[I_NLINK] == 255) {
+        errno = EMLINK;
+    } else if ((dino = namei(fs, path2, &name, &len)) == 0) {
+        // error
+    } else if (dirFind(fs, dino, name, len, &off, &exist)) {
+        errno = EEXIST;
+    } else if (dirEnter(fs, dino, name, len, ino) == 0) {
+        uint8_t *wp = igetw(fs, ino);
+        wp[I_NLINK]++;
+        ret = 0;
+    }
+    unlock(fs);
+    return ret;
+}
+
+int v6fsUnlink(v6fs_t *fs, const char *path) {
+    if (!fs->cow) {
+        errno = EROFS;
+        return -1;
+    }
+    int ret = -1;
+    lock(fs);
+    const char *name;
+    size_t len;
+    uint32_t off;
+    uint16_t ino;
+    const uint8_t *ip;
+    uint16_t dino = namei(fs, path, &name, &len);
+    if (dino == 0) {
+        // error
+    } else if (!dirFind(fs, dino, name, len, &off, &ino)) {
+        errno = ENOENT;
+    } else if ((ip = iget(fs, ino)) == NULL) {
+        // error
+    } else if (inodeType(ip) == IFDIR) {
+        // super-user only
+        errno = EPERM;
+    } else {
+        const uint8_t *dp = iget(fs, dino);
+        uint8_t *b = bwrite(fs, bmap(fs, dp, off / BSIZE));
+        put16(b + off % BSIZE, 0);
+        touch(igetw(fs, dino));
+        uint8_t *wp = igetw(fs, ino);
+        if (wp[I_NLINK] > 0 && --wp[I_NLINK] == 0 && !isOpen(fs, ino)) {
+            ifree(fs, ino);
+        }
+        ret = 0;
+    }
+    unlock(fs);
+    return ret;
+}
+
+int v6fsChdir(v6fs_t *fs, const char *path) {
+    int ret = -1;
+    lock(fs);
+    uint16_t ino = namei(fs, path, NULL, NULL);
+    const uint8_t *ip = (ino != 0) ? iget(fs, ino) : NULL;
+    if (ip == NULL) {
+        // error
+    } else if (inodeType(ip) != IFDIR) {
+        errno = ENOTDIR;
+    } else {
+        fs->cwd = ino;
+        ret = 0;
+    }
+    unlock(fs);
+    return ret;
+}
+
+int v6fsChmod(v6fs_t *fs, const char *path, mode_t mode) {
+    if (!fs->cow) {
+        errno = EROFS;
+        return -1;
+    }
+    int ret = -1;
+    lock(fs);
+    uint16_t ino = namei(fs, path, NULL, NULL);
+    uint8_t *ip = (ino != 0) ? igetw(fs, ino) : NULL;
+    if (ip != NULL) {
+        put16(ip + I_MODE, (get16(ip + I_MODE) & ~07777) | (mode & 07777));
+        ret = 0;
+    }
+    unlock(fs);
+    return ret;
+}
+
+int v6fsStat(v6fs_t *fs, const char *path, struct stat *ps) {
+    int ret = -1;
+    lock(fs);
+    uint16_t ino = namei(fs, path, NULL, NULL);
+    const uint8_t *ip = (ino != 0) ? iget(fs, ino) : NULL;
+    if (ip != NULL) {
+        fillStat(fs, ino, ip, ps);
+        ret = 0;
+    }
+    unlock(fs);
+    return ret;
+}
+
+ssize_t v6fsRead(v6fs_t *fs, int fd, void *buf, size_t n) {
+    v6fs_file_t *pf = getFile(fs, fd);
+    if (pf == NULL) {
+        return read(fd, buf, n);
+    }
+    ssize_t sret = -1;
+    lock(fs);
+    if (!(pf->flags & FREAD)) {
+        errno = EBADF;
+    } else if ((sret = readi(fs, pf->ino, pf->offset, buf, n)) > 0) {
+        pf->offset += sret;
+    }
+    unlock(fs);
+    return sret;
+}
+
+ssize_t v6fsWrite(v6fs_t *fs, int fd, const void *buf, size_t n) {
+    v6fs_file_t *pf = getFile(fs, fd);
+    if (pf == NULL) {
+        return write(fd, buf, n);
+    }
+    ssize_t sret = -1;
+    lock(fs);
+    if (!(pf->flags & FWRITE)) {
+        errno = EBADF;
+    } else if ((sret = writei(fs, pf->ino, pf->offset, buf, n)) > 0) {
+        pf->offset += sret;
+    }
+    unlock(fs);
+    return sret;
+}
+
+off_t v6fsLseek(v6fs_t *fs, int fd, off_t offset, int whence) {
+    v6fs_file_t *pf = getFile(fs, fd);
+    if (pf == NULL) {
+        return lseek(fd, offset, whence);
+    }
+    off_t ret = -1;
+    lock(fs);
+    const uint8_t *ip = iget(fs, pf->ino);
+    if (ip != NULL) {
+        if (whence == SEEK_CUR) {
+            offset += pf->offset;
+        } else if (whence == SEEK_END) {
+            offset += inodeSize(ip);
+        }
+        if (offset < 0 || offset >= MAX_LBN * BSIZE || whence < SEEK_SET || SEEK_END < whence) {
+            errno = EINVAL;
+        } else {
+            pf->offset = offset;
+            ret = offset;
+        }
+    }
+    unlock(fs);
+    return ret;
+}
+
+int v6fsFstat(v6fs_t *fs, int fd, struct stat *ps) {
+    v6fs_file_t *pf = getFile(fs, fd);
+    if (pf == NULL) {
+        return fstat(fd, ps);
+    }
+    int ret = -1;
+    lock(fs);
+    const uint8_t *ip = iget(fs, pf->ino);
+    if (ip != NULL) {
+        fillStat(fs, pf->ino, ip, ps);
+        ret = 0;
+    }
+    unlock(fs);
+    return ret;
+}
+
+int v6fsClose(v6fs_t *fs, int fd) {
+    v6fs_file_t *pf = getFile(fs, fd);
+    if (pf != NULL) {
+        lock(fs);
+        fileDrop(fs, pf);
+        fs->files[fd] = 0;
+        unlock(fs);
+    }
+    return close(fd);
+}
+
+int v6fsDup(v6fs_t *fs, int fd) {
+    int ret = dup(fd);
+    v6fs_file_t *pf = getFile(fs, fd);
+    if (ret < 0 || pf == NULL) {
+        return ret;
+    }
+    if (ret >= V6FS_NOFILE) {
+        close(ret);
+        errno = EMFILE;
+        return -1;
+    }
+    lock(fs);
+    pf->ref++;
+    fs->files[ret] = fs->files[fd];
+    unlock(fs);
+    return ret;
+}
+
+ssize_t v6fsPread(v6fs_t *fs, const char *path, void *buf, size_t n, off_t offset) {
+    ssize_t sret = -1;
+    lock(fs);
+    uint16_t ino = namei(fs, path, NULL, NULL);
+    const uint8_t *ip = (ino != 0) ? iget(fs, ino) : NULL;
+    if (ip == NULL) {
+        // error
+    } else if (inodeType(ip) != 0) {
+        errno = EACCES;
+    } else {
+        sret = readi(fs, ino, offset, buf, n);
+    }
+    unlock(fs);
+    return sret;
+}
+
+void v6fsRetain(v6fs_t *fs) {
+    lock(fs);
+    for (int fd = 0; fd < V6FS_NOFILE; fd++) {
+        v6fs_file_t *pf = getFile(fs, fd);
+        if (pf != NULL) {
+            pf->ref++;
+        }
+    }
+    unlock(fs);
+}
+
+void v6fsRelease(v6fs_t *fs) {
+    lock(fs);
+    for (int fd = 0; fd < V6FS_NOFILE; fd++) {
+        v6fs_file_t *pf = getFile(fs, fd);
+        if (pf != NULL) {
+            fileDrop(fs, pf);
+        }
+    }
+    unlock(fs);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+struct v6fs_tag;
+#ifndef _V6FS_T_
+#define _V6FS_T_
+typedef struct v6fs_tag v6fs_t;
+#endif
+
+// V6 file system in a disk image (RK05, RP, ...) as the guest root, read-only or copy-on-write
+int v6fsMount(machine_t *pm, const char *image, bool cow);
+
+// same as the host calls, -1 and errno on error; fds are host fds
+int v6fsOpen(v6fs_t *fs, const char *path, int mode);
+int v6fsCreat(v6fs_t *fs, const char *path, mode_t mode);
+int v6fsLink(v6fs_t *fs, const char *path1, const char *path2);
+int v6fsUnlink(v6fs_t *fs, const char *path);
+int v6fsChdir(v6fs_t *fs, const char *path);
+int v6fsChmod(v6fs_t *fs, const char *path, mode_t mode);
+int v6fsStat(v6fs_t *fs, const char *path, struct stat *ps);
+
+// fds not opened from the image go to the host
+ssize_t v6fsRead(v6fs_t *fs, int fd, void *buf, size_t n);
+ssize_t v6fsWrite(v6fs_t *fs, int fd, const void *buf, size_t n);
+off_t v6fsLseek(v6fs_t *fs, int fd, off_t offset, int whence);
+int v6fsFstat(v6fs_t *fs, int fd, struct stat *ps);
+int v6fsClose(v6fs_t *fs, int fd);
+int v6fsDup(v6fs_t *fs, int fd);
+
+// whole file read for load()
+ssize_t v6fsPread(v6fs_t *fs, const char *path, void *buf, size_t n, off_t offset);
+
+// open files are shared with the child: before fork(), and undone at exit or when fork() fails
+void v6fsRetain(v6fs_t *fs);
+void v6fsRelease(v6fs_t *fs);
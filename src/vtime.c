@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#define DEBUG_LOG 0
+
+#include "vtime.h"
+#include "machine.h"
+#include "util.h"
+
+// exits of the processes by host pid, shared by the process tree
+#define VTIME_SLOTS 1024
+
+typedef struct {
+    pid_t pid;
+    uint64_t clock;     // at the exit
+    uint64_t cpu;       // of the process and its waited children
+} slot_t;
+
+// in instructions: the process retired pm->retired - start, its clock is base plus that
+struct vtime_tag {
+    uint64_t hz;
+    int64_t epoch;
+    uint64_t start;
+    uint64_t base;
+    uint64_t children;
+    slot_t *slots;
+};
+
+static uint64_t own(machine_t *pm) {
+    return pm->retired - pm->vtime->start;
+}
+
+int vtimeOpen(machine_t *pm, const char *spec) {
+    char *end;
+    errno = 0;
+    uint64_t hz = strtoull(spec, &end, 10);
+    int64_t epoch = 0;
+    if (errno == 0 && *end == ',') {
+        epoch = strtoll(end + 1, &end, 10);
+    }
+    if (errno != 0 || hz == 0 || *end != '\0') {
+        return EINVAL;
+    }
+
+    vtime_t *pv = calloc(1, sizeof(vtime_t));
+    if (pv == NULL) {
+        return ENOMEM;
+    }
+    pv->slots = mapShared(VTIME_SLOTS * sizeof(slot_t));
+    if (pv->slots == MAP_FAILED) {
+        int e = errno;
+        free(pv);
+        return e;
+    }
+    pv->hz = hz;
+    pv->epoch = epoch;
+    pv->start = pm->retired;
+    pv->base = 0;
+    pm->vtime = pv;
+    return 0;
+}
+
+int64_t vtimeNow(machine_t *pm) {
+    const vtime_t *pv = pm->vtime;
+    return pv->epoch + (int64_t)((pv->base + own(pm)) / pv->hz);
+}
+
+void vtimeTimes(machine_t *pm, unsigned rate, uint64_t *puser, uint64_t *pchildren) {
+    const vtime_t *pv = pm->vtime;
+    // no guest time in the kernel: all user time
+    const uint64_t user = own(pm);
+    *puser = user / pv->hz * rate + user % pv->hz * rate / pv->hz;
+    *pchildren = pv->children / pv->hz * rate + pv->children % pv->hz * rate / pv->hz;
+}
+
+void vtimeFork(machine_t *pm) {
+    vtime_t *pv = pm->vtime;
+    if (pv == NULL) {
+        return;
+    }
+    pv->base += own(pm);
+    pv->children = 0;
+    pv->start = pm->retired;
+}
+
+void vtimeWait(machine_t *pm, pid_t pid) {
+    vtime_t *pv = pm->vtime;
+    if (pv == NULL || pid <= 0) {
+        return;
+    }
+    slot_t *ps = &pv->slots[pid % VTIME_SLOTS];
+    if (ps->pid != pid) {
+        // killed, or not a guest
+        return;
+    }
+    pv->children += ps->cpu;
+    // the wait took until the end of the child
+    if (ps->clock > pv->base + own(pm)) {
+        pv->base = ps->clock - own(pm);
+    }
+#if DEBUG_LOG
+    fprintf(stderr, "/ [DBG] vtime: %d: clock %llu cpu %llu\n", (int)pid,
+        (unsigned long long)ps->clock, (unsigned long long)ps->cpu);
+#endif
+    ps->pid = 0;
+}
+
+void vtimeExit(machine_t *pm) {
+    vtime_t *pv = pm->vtime;
+    if (pv == NULL) {
+        return;
+    }
+    const pid_t pid = getpid();
+    slot_t *ps = &pv->slots[pid % VTIME_SLOTS];
+    ps->clock = pv->base + own(pm);
+    ps->cpu = own(pm) + pv->children;
+    ps->pid = pid;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+struct vtime_tag;
+#ifndef _VTIME_T_
+#define _VTIME_T_
+typedef struct vtime_tag vtime_t;
+#endif
+
+// time of the guest from the instructions retired: spec is "hz[,epoch]", hz instructions
+// a second, the time of day from epoch (seconds since 1970, 0 by default)
+int vtimeOpen(machine_t *pm, const char *spec);
+
+// time(): seconds since 1970
+int64_t vtimeNow(machine_t *pm);
+
+// times(): user time of the process and of its waited children, in 1/rate seconds
+void vtimeTimes(machine_t *pm, unsigned rate, uint64_t *puser, uint64_t *pchildren);
+
+// the child of fork() starts its times at 0 and its clock at the one of the parent
+void vtimeFork(machine_t *pm);
+
+// after wait() of the guest returned pid: its times to the children, the clock after its end
+void vtimeWait(machine_t *pm, pid_t pid);
+
+// at exit(), for vtimeWait() of the parent
+void vtimeExit(machine_t *pm);
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <signal.h>
+#include <poll.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEBUG_LOG 0
+
+#include "zygote.h"
+#include "machine.h"
+#include "util.h"
+
+/* request, with stdin, stdout and stderr of the client in SCM_RIGHTS:
+  uint32_t len
+  cwd, argv[0], ..., argv[argc-1]   '\0' terminated, len bytes
+reply:
+  int32_t status
+*/
+#define ZYGOTE_MAX_RUNS 256
+#define ZYGOTE_MAX_REQUEST (PATH_MAX + 512 + 4096)
+
+// runs in progress: pid and the connection for the status
+static struct {
+    pid_t pid;
+    int fd;
+} runs[ZYGOTE_MAX_RUNS];
+
+static int sigchldPipe[2] = { -1, -1 };
+
+static void onSigchld(int sig) {
+    int e = errno;
+    ssize_t ret = write(sigchldPipe[1], "", 1);
+    (void)ret;
+    errno = e;
+}
+
+static int unixSocket(const char *path, struct sockaddr_un *pa) {
+    memset(pa, 0, sizeof(*pa));
+    pa->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(pa->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(pa->sun_path, path);
+    return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+// in the forked run: stdio, cwd and args of the request
+static int receive(machine_t *pm, int fd) {
+    static uint8_t buf[ZYGOTE_MAX_REQUEST];
+    uint32_t len;
+    union {
+        struct cmsghdr align;
+        uint8_t bytes[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    struct iovec iov = { &len, sizeof(len) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.bytes;
+    msg.msg_controllen = sizeof(control.bytes);
+
+    ssize_t sret;
+    do {
+        sret = recvmsg(fd, &msg, 0);
+    } while (sret < 0 && errno == EINTR);
+    struct cmsghdr *pc = CMSG_FIRSTHDR(&msg);
+    if (sret < 0) {
+        return errno;
+    }
+    if (sret < sizeof(len) && !readAll(fd, (uint8_t *)&len + sret, sizeof(len) - sret)) {
+        return EPROTO;
+    }
+    if (pc == NULL || pc->cmsg_level != SOL_SOCKET || pc->cmsg_type != SCM_RIGHTS
+        || pc->cmsg_len != CMSG_LEN(3 * sizeof(int))) {
+        return EPROTO;
+    }
+    if (len == 0 || len > sizeof(buf) || !readAll(fd, buf, len) || buf[len - 1] != '\0') {
+        return EPROTO;
+    }
+
+    int fds[3];
+    memcpy(fds, CMSG_DATA(pc), sizeof(fds));
+    for (int i = 0; i < 3; i++) {
+        if (dup2(fds[i], i) < 0) {
+            return errno;
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] > 2) {
+            close(fds[i]);
+        }
+    }
+
+    // cwd, then argv
+    const char *cwd = (const char *)buf;
+    if (chdir(cwd) != 0 || getcwd(pm->curdir, sizeof(pm->curdir)) == NULL) {
+        return errno;
+    }
+    int argc = 0;
+    for (size_t i = strlen(cwd) + 1; i < len; i += strlen((const char *)&buf[i]) + 1) {
+        argc++;
+    }
+    if (argc == 0) {
+        return EPROTO;
+    }
+    char **argv = malloc((argc + 1) * sizeof(char *));
+    if (argv == NULL) {
+        return ENOMEM;
+    }
+    size_t i = strlen(cwd) + 1;
+    for (int n = 0; n < argc; n++) {
+        argv[n] = (char *)&buf[i];
+        i += strlen(argv[n]) + 1;
+    }
+    argv[argc] = NULL;
+    bool ok = serializeArgvReal(pm, argc, argv);
+    free(argv);
+    return ok ? 0 : E2BIG;
+}
+
+// the status of the finished runs to their clients
+static void reap(void) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        int32_t ret = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        for (int i = 0; i < ZYGOTE_MAX_RUNS; i++) {
+            if (runs[i].pid == pid) {
+                writeAll(runs[i].fd, &ret, sizeof(ret));
+                close(runs[i].fd);
+                runs[i].pid = 0;
+                break;
+            }
+        }
+    }
+}
+
+int zygoteServe(machine_t *pm, const char *path, int npreload, char *preload[]) {
+    for (int i = 0; i < npreload; i++) {
+        int ret = preloadAout(pm, preload[i]);
+        if (ret != 0) {
+            fprintf(stderr, "/ [WRN] zygote: can't load \"%s\": %s\n", preload[i], strerror(ret));
+        }
+    }
+
+    struct sockaddr_un addr;
+    int lfd = unixSocket(path, &addr);
+    if (lfd < 0) {
+        return errno;
+    }
+    unlink(path);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(lfd, 64) != 0) {
+        int e = errno;
+        close(lfd);
+        return e;
+    }
+
+    if (pipe(sigchldPipe) != 0) {
+        int e = errno;
+        close(lfd);
+        return e;
+    }
+    fcntl(sigchldPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(sigchldPipe[1], F_SETFL, O_NONBLOCK);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSigchld;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+#if DEBUG_LOG
+    fprintf(stderr, "/ [DBG] zygote: pid %d: ready on %s\n", getpid(), path);
+#endif
+
+    while (1) {
+        struct pollfd pfds[2] = {
+            { lfd, POLLIN, 0 },
+            { sigchldPipe[0], POLLIN, 0 },
+        };
+        if (poll(pfds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "/ [ERR] zygote: poll: %s\n", strerror(errno));
+            return errno;
+        }
+        if (pfds[1].revents & POLLIN) {
+            uint8_t drain[64];
+            while (read(sigchldPipe[0], drain, sizeof(drain)) > 0) {
+            }
+            reap();
+        }
+        if (!(pfds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        int slot = 0;
+        while (slot < ZYGOTE_MAX_RUNS && runs[slot].pid != 0) {
+            slot++;
+        }
+        pid_t pid = (slot < ZYGOTE_MAX_RUNS) ? fork() : -1;
+        if (pid < 0) {
+            fprintf(stderr, "/ [WRN] zygote: can't run a request: %s\n",
+                (slot < ZYGOTE_MAX_RUNS) ? strerror(errno) : "too many runs");
+            close(fd);
+            continue;
+        }
+        if (pid > 0) {
+            runs[slot].pid = pid;
+            runs[slot].fd = fd;
+            continue;
+        }
+
+        // the run: nothing of the server stays open
+        signal(SIGCHLD, SIG_DFL);
+        close(lfd);
+        close(sigchldPipe[0]);
+        close(sigchldPipe[1]);
+        for (int i = 0; i < ZYGOTE_MAX_RUNS; i++) {
+            if (runs[i].pid != 0) {
+                close(runs[i].fd);
+            }
+        }
+        int ret = receive(pm, fd);
+        close(fd);
+        if (ret != 0) {
+            fprintf(stderr, "/ [ERR] zygote: bad request: %s\n", strerror(ret));
+            _exit(EXIT_FAILURE);
+        }
+        budgetRun(pm);
+        return 0;
+    }
+}
+
+int zygoteRequest(const char *path, int argc, char *argv[]) {
+    static uint8_t buf[sizeof(uint32_t) + ZYGOTE_MAX_REQUEST];
+    char *cwd = (char *)buf + sizeof(uint32_t);
+    if (getcwd(cwd, PATH_MAX) == NULL) {
+        fprintf(stderr, "/ [ERR] zygote: %s\n", strerror(errno));
+        return -1;
+    }
+    size_t len = strlen(cwd) + 1;
+    for (int i = 0; i < argc; i++) {
+        size_t n = strlen(argv[i]) + 1;
+        if (len + n > ZYGOTE_MAX_REQUEST) {
+            fprintf(stderr, "/ [ERR] Too big argv\n");
+            return -1;
+        }
+        memcpy(cwd + len, argv[i], n);
+        len += n;
+    }
+    uint32_t len32 = len;
+    memcpy(buf, &len32, sizeof(len32));
+
+    struct sockaddr_un addr;
+    int fd = unixSocket(path, &addr);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "/ [ERR] zygote: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // the length with stdio, then the rest
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    union {
+        struct cmsghdr align;
+        uint8_t bytes[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = { buf, sizeof(len32) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.bytes;
+    msg.msg_controllen = sizeof(control.bytes);
+    struct cmsghdr *pc = CMSG_FIRSTHDR(&msg);
+    pc->cmsg_level = SOL_SOCKET;
+    pc->cmsg_type = SCM_RIGHTS;
+    pc->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(pc), fds, sizeof(fds));
+
+    int32_t status;
+    if (sendmsg(fd, &msg, 0) != sizeof(len32)
+        || !writeAll(fd, buf + sizeof(len32), len)
+        || !readAll(fd, &status, sizeof(status))) {
+        fprintf(stderr, "/ [ERR] zygote: %s: %s\n", path, (errno != 0) ? strerror(errno) : "no status");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return status;
+}
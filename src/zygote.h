@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct machine_tag;
+#ifndef _MACHINE_T_
+#define _MACHINE_T_
+typedef struct machine_tag machine_t;
+#endif
+
+// server: loads the aouts into the aout cache, then forks a run for each request on the socket
+// returns 0 in the run, with args, cwd and stdio of the request
+int zygoteServe(machine_t *pm, const char *path, int npreload, char *preload[]);
+
+// client: runs argv on the server with this cwd and stdio, returns the exit status or -1
+int zygoteRequest(const char *path, int argc, char *argv[]);